@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "bench_scenes.h"
+#include "raster/renderer.h"
+#include "raster/frame_output.h"
+#include "raster/frame_pipeline.h"
+#include "raster/frame_stream.h"
+#include "job_system/js.h"
+
+#include "utils/mat4x4.h"
+#include "utils/timer.h"
+#include "utils/trace.h"
+#include "utils/utils.h"
+
+/*
+Headless benchmark, no window is opened
+    - Renders the scenes of bench_scenes.c along their camera path, the same frames every run
+    - Writes per frame and per stage p50/p95/p99 times, triangles and pixels per second as JSON
+
+    - --trace also writes the last frames of the last scene as a Chrome trace
+    - Frames go through Frame_Pipeline with BENCH_FRAMES_IN_FLIGHT, each is presented while the next one rasters
+    - --dump also writes every measured frame as a PNG into the directory, queued from the present. The writer
+        thread keeps up or the present waits for a buffer, which does show up in the raster and frame timings
+    - --stream also sends every measured frame to '-' (stdout), 'shm:<name>' (shared memory) or a file or FIFO,
+        as BGRA or with --yuv as I420. From the present like --dump, only what the raster jobs cannot hide is timed.
+        BGRA to shared memory is rastered straight into the slots
+    - simderella_bench_vertex_cache is the same benchmark built with SETUP_VERTEX_CACHE, "vertex_processing" in
+        the JSON says which one wrote it
+
+    simderella_bench [--res <dir>] [--frames <n>] [--out <file.json>] [--trace <file.json>] [--dump <dir>]
+                     [--stream <target>] [--yuv]
+*/
+
+#define BENCH_DEFAULT_RESOURCE_DIRECTORY "../../res"
+#define BENCH_DEFAULT_OUTPUT_FILE        "simderella_bench.json"
+#define BENCH_DEFAULT_FRAMES             240
+#define BENCH_WARMUP_FRAMES              16
+#define BENCH_FRAMES_IN_FLIGHT           2
+
+typedef enum
+{
+    BENCH_STAGE_RECORD = 0, /* Recording the draws */
+    BENCH_STAGE_SETUP,      /* Clear, vertex processing and triangle setup */
+    BENCH_STAGE_RASTER,
+    BENCH_STAGE_FRAME,
+    BENCH_STAGE_COUNT,
+} BenchStage_t;
+
+static const char *Bench_Stage_Names[BENCH_STAGE_COUNT] = {"record", "setup", "raster", "frame"};
+
+typedef struct
+{
+    double *samples[BENCH_STAGE_COUNT]; /* Milliseconds, one per frame */
+    size_t  number_of_frames;
+    size_t  triangles_submitted; /* Sum over the frames */
+    size_t  triangles_rastered;
+
+    PipelineStatistics_t statistics; /* Sum over the frames */
+} BenchResults_t;
+
+typedef struct
+{
+    const BenchScene_t *scene;
+    const char         *dump_directory;
+} BenchPresentData_t;
+
+/* Called by Frame_Pipeline with each finished frame, the warmup frames are not written */
+static void Bench_Present(const uint8_t *colour_buffer, const uint64_t frame_index, void *user_data)
+{
+    const BenchPresentData_t *present = (const BenchPresentData_t *)user_data;
+    if (frame_index < BENCH_WARMUP_FRAMES)
+        return;
+
+    const size_t frame = (size_t)frame_index - BENCH_WARMUP_FRAMES;
+    if (present->dump_directory)
+    {
+        char file_path[FRAME_OUTPUT_PATH_SIZE];
+        snprintf(file_path, sizeof(file_path), "%s/%s_%04zu.png", present->dump_directory, present->scene->name, frame);
+        Frame_Output_Submit_Colour(file_path, FRAME_OUTPUT_PNG, colour_buffer, true);
+    }
+
+    Frame_Stream_Write(colour_buffer); // Does nothing without --stream
+}
+
+/* Measured frames streamed to shared memory as BGRA are rastered straight into their slot */
+static uint8_t *Bench_Target(const uint64_t frame_index, void *user_data)
+{
+    LOG_UNUSED(user_data);
+    return (frame_index < BENCH_WARMUP_FRAMES) ? NULL : Frame_Stream_Slot();
+}
+
+static void Bench_Run_Scene(BenchSceneData_t *data, const BenchScene_t *scene, const size_t number_of_frames, const char *dump_directory, BenchResults_t *results)
+{
+    *results                  = (BenchResults_t){0};
+    results->number_of_frames = number_of_frames;
+    for (int s = 0; s < BENCH_STAGE_COUNT; s++)
+    {
+        results->samples[s] = calloc(number_of_frames + 1, sizeof(double));
+        ASSERT(results->samples[s]);
+    }
+
+    BenchPresentData_t present = {scene, dump_directory};
+    Frame_Pipeline_Init(Bench_Present, &present, BENCH_FRAMES_IN_FLIGHT);
+    Frame_Pipeline_Set_Target(Bench_Target);
+
+    for (size_t f = 0; f < BENCH_WARMUP_FRAMES + number_of_frames; f++)
+    {
+        const bool   recorded = f >= BENCH_WARMUP_FRAMES;
+        const size_t frame    = (recorded) ? f - BENCH_WARMUP_FRAMES : 0;
+
+        hp_timer_t frame_timer, stage_timer;
+        Timer_Start(&frame_timer);
+        Timer_Start(&stage_timer);
+
+        Frame_Pipeline_Begin_Frame();
+        Bench_Record_Scene(data, scene, frame, number_of_frames);
+        Timer_Update(&stage_timer);
+        const double record_ms = Timer_Get_Elapsed_MS(&stage_timer);
+
+        Setup_Triangles_For_MT();
+        Timer_Update(&stage_timer);
+        const double setup_ms = Timer_Get_Elapsed_MS(&stage_timer);
+
+        Raster_Triangles_Submit();
+        Frame_Pipeline_End_Frame(); // Presents the frame before while this one rasters
+        Timer_Update(&stage_timer);
+        const double raster_ms = Timer_Get_Elapsed_MS(&stage_timer);
+
+        Timer_Stop(&frame_timer);
+
+        PipelineStatistics_t frame_statistics;
+        Pipeline_Statistics_Collect(&frame_statistics);
+
+        if (!recorded)
+            continue;
+
+        results->samples[BENCH_STAGE_RECORD][frame] = record_ms;
+        results->samples[BENCH_STAGE_SETUP][frame]  = setup_ms;
+        results->samples[BENCH_STAGE_RASTER][frame] = raster_ms;
+        results->samples[BENCH_STAGE_FRAME][frame]  = Timer_Get_Elapsed_MS(&frame_timer);
+
+        results->triangles_submitted += data->number_of_triangles;
+        results->triangles_rastered += Trianges_To_Be_Rastered_Counter;
+        Pipeline_Statistics_Sum(&results->statistics, &frame_statistics);
+    }
+
+    Frame_Pipeline_Shutdown(); // Presents the last frame
+}
+
+static int Bench_Compare_Double(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank, 'sorted' has to be in ascending order */
+static double Bench_Percentile(const double *sorted, const size_t count, const double percentile)
+{
+    size_t rank = (size_t)ceil(percentile / 100.0 * (double)count);
+    rank        = (rank == 0) ? 1 : rank;
+    return sorted[((rank > count) ? count : rank) - 1];
+}
+
+static void Bench_Write_Scene_JSON(FILE *fp, const BenchScene_t *scene, const BenchSceneData_t *data, BenchResults_t *results)
+{
+    const size_t n = results->number_of_frames;
+
+    double total_frame_ms = 0.0;
+    for (size_t f = 0; f < n; f++)
+        total_frame_ms += results->samples[BENCH_STAGE_FRAME][f];
+
+    const double total_seconds = total_frame_ms / 1000.0;
+
+    fprintf(fp, "    {\n");
+    fprintf(fp, "      \"name\": \"%s\",\n", scene->name);
+    fprintf(fp, "      \"frames\": %zu,\n", n);
+    fprintf(fp, "      \"draws\": %zu,\n", data->number_of_draws);
+    fprintf(fp, "      \"triangles\": %zu,\n", data->number_of_triangles);
+    fprintf(fp, "      \"triangles_rastered_per_frame\": %.1f,\n", (double)results->triangles_rastered / (double)n);
+    fprintf(fp, "      \"triangles_per_second\": %.1f,\n", (double)results->triangles_submitted / total_seconds);
+    fprintf(fp, "      \"fragments_shaded_per_second\": %.1f,\n", (double)results->statistics.fragments_shaded / total_seconds);
+    fprintf(fp, "      \"fragments_written_per_second\": %.1f,\n", (double)results->statistics.fragments_written / total_seconds);
+    fprintf(fp, "      \"stages_ms\": {\n");
+
+    for (int s = 0; s < BENCH_STAGE_COUNT; s++)
+    {
+        double *samples = results->samples[s];
+        qsort(samples, n, sizeof(double), Bench_Compare_Double);
+
+        double sum = 0.0;
+        for (size_t f = 0; f < n; f++)
+            sum += samples[f];
+
+        fprintf(fp, "        \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"max\": %.4f}%s\n",
+                Bench_Stage_Names[s],
+                sum / (double)n,
+                Bench_Percentile(samples, n, 50.0),
+                Bench_Percentile(samples, n, 95.0),
+                Bench_Percentile(samples, n, 99.0),
+                samples[0],
+                samples[n - 1],
+                (s + 1 < BENCH_STAGE_COUNT) ? "," : "");
+    }
+
+    fprintf(fp, "      },\n");
+
+    /* Per frame averages */
+    const PipelineStatistics_t *stats = &results->statistics;
+    fprintf(fp, "      \"pipeline_statistics\": {\n");
+    fprintf(fp, "        \"vertices_shaded\": %.1f,\n", (double)stats->vertices_shaded / (double)n);
+    fprintf(fp, "        \"triangles_submitted\": %.1f,\n", (double)stats->triangles_submitted / (double)n);
+    fprintf(fp, "        \"triangles_culled_frustum\": %.1f,\n", (double)stats->triangles_culled_frustum / (double)n);
+    fprintf(fp, "        \"triangles_culled_back_face\": %.1f,\n", (double)stats->triangles_culled_back_face / (double)n);
+    fprintf(fp, "        \"triangles_culled_zero_area\": %.1f,\n", (double)stats->triangles_culled_zero_area / (double)n);
+    fprintf(fp, "        \"triangles_clipped\": %.1f,\n", (double)stats->triangles_clipped / (double)n);
+    fprintf(fp, "        \"triangles_rasterized\": %.1f,\n", (double)stats->triangles_rasterized / (double)n);
+    fprintf(fp, "        \"spans_tested\": %.1f,\n", (double)stats->spans_tested / (double)n);
+    fprintf(fp, "        \"spans_rejected_coverage\": %.1f,\n", (double)stats->spans_rejected_coverage / (double)n);
+    fprintf(fp, "        \"spans_rejected_depth\": %.1f,\n", (double)stats->spans_rejected_depth / (double)n);
+    fprintf(fp, "        \"fragments_shaded\": %.1f,\n", (double)stats->fragments_shaded / (double)n);
+    fprintf(fp, "        \"fragments_written\": %.1f\n", (double)stats->fragments_written / (double)n);
+    fprintf(fp, "      }\n");
+    fprintf(fp, "    }");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *resource_directory = BENCH_DEFAULT_RESOURCE_DIRECTORY;
+    const char *output_file        = BENCH_DEFAULT_OUTPUT_FILE;
+    const char *trace_file         = NULL;
+    const char *dump_directory     = NULL;
+    const char *stream_target      = NULL;
+    bool        stream_yuv         = false;
+    size_t      number_of_frames   = BENCH_DEFAULT_FRAMES;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--res") == 0 && i + 1 < argc)
+            resource_directory = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            number_of_frames = (size_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            output_file = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace_file = argv[++i];
+        else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc)
+            dump_directory = argv[++i];
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+            stream_target = argv[++i];
+        else if (strcmp(argv[i], "--yuv") == 0)
+            stream_yuv = true;
+        else
+        {
+            fprintf(stderr, "Usage : %s [--res <dir>] [--frames <n>] [--out <file.json>] [--trace <file.json>] [--dump <dir>] [--stream <target>] [--yuv]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (number_of_frames == 0)
+        number_of_frames = BENCH_DEFAULT_FRAMES;
+
+    FILE *fp = fopen(output_file, "w");
+    if (fp == NULL)
+    {
+        perror(output_file);
+        return EXIT_FAILURE;
+    }
+
+    Timer_Init();
+    Trace_Set_Thread_Name("main");
+    jobs_init();
+    Render_Set_Viewport(IMAGE_W, IMAGE_H);
+
+    if (dump_directory)
+        Frame_Output_Init();
+
+    if (stream_target)
+    {
+        FrameStreamDesc_t stream = {0};
+        stream.format            = (stream_yuv) ? FRAME_STREAM_YUV420 : FRAME_STREAM_BGRA;
+
+        if (strcmp(stream_target, "-") == 0)
+            stream.target = FRAME_STREAM_STDOUT;
+        else if (strncmp(stream_target, "shm:", 4) == 0)
+        {
+            stream.target = FRAME_STREAM_SHARED_MEMORY;
+            stream.name   = stream_target + 4;
+        }
+        else
+        {
+            stream.target = FRAME_STREAM_FILE;
+            stream.name   = stream_target;
+        }
+
+        if (!Frame_Stream_Open(&stream))
+        {
+            fclose(fp);
+            jobs_shutdown();
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"width\": %d,\n", IMAGE_W);
+    fprintf(fp, "  \"height\": %d,\n", IMAGE_H);
+    fprintf(fp, "  \"threads\": %d,\n", NUM_OF_THREADS + 1);
+#ifdef SETUP_VERTEX_CACHE
+    fprintf(fp, "  \"vertex_processing\": \"vertex_cache\",\n");
+#else
+    fprintf(fp, "  \"vertex_processing\": \"two_phase\",\n");
+#endif
+    fprintf(fp, "  \"warmup_frames\": %d,\n", BENCH_WARMUP_FRAMES);
+    fprintf(fp, "  \"frames_in_flight\": %d,\n", BENCH_FRAMES_IN_FLIGHT);
+    fprintf(fp, "  \"scenes\": [\n");
+
+    /* Scenes are written as they finish, the separator needs to know if another one follows */
+    bool written_any = false;
+    for (size_t i = 0; i < Bench_Number_Of_Scenes; i++)
+    {
+        const BenchScene_t *scene = &Bench_Scenes[i];
+
+        BenchSceneData_t data;
+        if (!Bench_Load_Scene(&data, scene, resource_directory))
+        {
+            Bench_Destroy_Scene(&data);
+            continue;
+        }
+
+        BenchResults_t results;
+        Bench_Run_Scene(&data, scene, number_of_frames, dump_directory, &results);
+
+        if (written_any)
+            fprintf(fp, ",\n");
+        Bench_Write_Scene_JSON(fp, scene, &data, &results);
+        written_any = true;
+
+        /* Sorted by the JSON writer */
+        fprintf(stderr, "%-12s : %8.3f ms/frame (p50)\n", scene->name, Bench_Percentile(results.samples[BENCH_STAGE_FRAME], number_of_frames, 50.0));
+
+        for (int s = 0; s < BENCH_STAGE_COUNT; s++)
+            free(results.samples[s]);
+        Bench_Destroy_Scene(&data);
+    }
+
+    fprintf(fp, "%s  ]\n", (written_any) ? "\n" : "");
+    fprintf(fp, "}\n");
+    fclose(fp);
+
+    if (trace_file)
+        Trace_Write_Chrome_JSON(trace_file);
+
+    Frame_Stream_Close();
+    Frame_Output_Shutdown();
+    jobs_shutdown();
+
+    fprintf(stderr, "Results written to : %s\n", output_file);
+    return EXIT_SUCCESS;
+}
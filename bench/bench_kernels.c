@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "raster/renderer.h"
+#include "job_system/js.h"
+
+#include "utils/mat4x4.h"
+#include "utils/timer.h"
+#include "utils/utils.h"
+
+/*
+Kernel microbenchmarks, each kernel is run on its own with synthetic input on the main thread
+    - Times are in cycles of the time stamp counter, the best of KERNEL_REPEATS runs so other work
+        on the machine does not count against a kernel
+    - Triangles come in 4 shapes, tiny (a few pixels), medium, huge (a good part of the screen) and slivers
+    - The raster kernels are given the output of the setup kernel, the same triangles the frame would raster
+    - Build with different instruction sets (/arch:AVX2, -mavx512f, ...) and compare the tables
+
+    simderella_kernels [--triangles <n>]
+*/
+
+#define KERNEL_DEFAULT_TRIANGLES 4096
+#define KERNEL_REPEATS           16
+#define KERNEL_SAMPLES           (1 << 20) /* Matrix multiplies and texture fetches per run */
+
+typedef struct
+{
+    const char *name;
+    float       min_size; /* Pixels along x */
+    float       max_size;
+    float       aspect; /* Height over width */
+} KernelShape_t;
+
+static const KernelShape_t Kernel_Shapes[] = {
+    {"tiny", 1.0f, 4.0f, 1.0f},
+    {"medium", 16.0f, 48.0f, 1.0f},
+    {"huge", 200.0f, 400.0f, 1.0f},
+    {"sliver", 200.0f, 500.0f, 0.01f},
+};
+
+#define KERNEL_NUMBER_OF_SHAPES (sizeof(Kernel_Shapes) / sizeof(Kernel_Shapes[0]))
+
+static uint32_t Kernel_Random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static float Kernel_Random_Float(uint32_t *state, const float min, const float max)
+{
+    return min + (max - min) * ((float)(Kernel_Random(state) >> 8) / (float)(1 << 24));
+}
+
+static const char *Kernel_Instruction_Set(void)
+{
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__)
+    return "AVX2";
+#elif defined(__AVX__)
+    return "AVX";
+#else
+    return "SSE";
+#endif
+}
+
+static texture_t Kernel_Make_Texture(const int size)
+{
+    texture_t t = {0};
+    t.w         = size;
+    t.h         = size;
+    t.bpp       = 4;
+    t.data      = malloc((size_t)size * size * 4);
+    ASSERT(t.data);
+
+    uint32_t seed = 0xC0FFEEu;
+    for (int i = 0; i < size * size * 4; i++)
+        t.data[i] = (uint8_t)Kernel_Random(&seed);
+
+    return t;
+}
+
+/*
+Triangles of one shape inside the screen, wound the way the rasterizer wants them, as a vertex buffer in NDC
+    - {posX, posY, posZ}{texU, texV} like the meshes, drawn with an identity MVP
+*/
+static float *Kernel_Make_Triangles(const KernelShape_t *shape, const size_t number_of_triangles, uint32_t **index_buffer)
+{
+    float    *vertices = malloc(sizeof(float) * MESH_VERTEX_STRIDE * 3 * number_of_triangles);
+    uint32_t *indices  = malloc(sizeof(uint32_t) * 3 * number_of_triangles);
+    ASSERT(vertices && indices);
+
+    uint32_t seed = 0x5EED1234u;
+    for (size_t t = 0; t < number_of_triangles; t++)
+    {
+        const float width  = Kernel_Random_Float(&seed, shape->min_size, shape->max_size);
+        const float height = (width * shape->aspect < 1.0f) ? 1.0f : width * shape->aspect;
+
+        /* Screen space, kept a pixel inside the edges */
+        const float x = Kernel_Random_Float(&seed, 1.0f, (float)IMAGE_W - 2.0f - width);
+        const float y = Kernel_Random_Float(&seed, 1.0f, (float)IMAGE_H - 2.0f - height);
+
+        float screen[3][2] = {{x, y}, {x + width, y + Kernel_Random_Float(&seed, 0.0f, height)}, {x + Kernel_Random_Float(&seed, 0.0f, width), y + height}};
+
+        /* The same area the rasterizer works out, back facing triangles are flipped */
+        const float area = (screen[2][0] - screen[0][0]) * (screen[1][1] - screen[0][1]) - (screen[0][0] - screen[1][0]) * (screen[0][1] - screen[2][1]);
+        if (area < 0.0f)
+        {
+            const float swap[2] = {screen[1][0], screen[1][1]};
+            screen[1][0]        = screen[2][0];
+            screen[1][1]        = screen[2][1];
+            screen[2][0]        = swap[0];
+            screen[2][1]        = swap[1];
+        }
+
+        for (size_t v = 0; v < 3; v++)
+        {
+            float *vertex = &vertices[(t * 3 + v) * MESH_VERTEX_STRIDE];
+            vertex[0]     = screen[v][0] / (0.5f * IMAGE_W) - 1.0f;
+            vertex[1]     = 1.0f - screen[v][1] / (0.5f * IMAGE_H);
+            vertex[2]     = 0.5f;
+            vertex[3]     = screen[v][0] / (float)IMAGE_W;
+            vertex[4]     = screen[v][1] / (float)IMAGE_H;
+
+            indices[t * 3 + v] = (uint32_t)(t * 3 + v);
+        }
+    }
+
+    *index_buffer = indices;
+    return vertices;
+}
+
+static void Kernel_Print_Result(const char *kernel, const char *input, const uint64_t cycles, const size_t triangles, const uint64_t pixels)
+{
+    printf("%-34s %-8s %14llu", kernel, input, (unsigned long long)cycles);
+
+    if (triangles)
+        printf(" %14.1f", (double)cycles / (double)triangles);
+    else
+        printf(" %14s", "-");
+
+    if (pixels)
+        printf(" %12.2f\n", (double)cycles / (double)pixels);
+    else
+        printf(" %12s\n", "-");
+}
+
+static void Kernel_Bench_Shape(const KernelShape_t *shape, const size_t number_of_triangles, texture_t *texture)
+{
+    uint32_t *indices  = NULL;
+    float    *vertices = Kernel_Make_Triangles(shape, number_of_triangles, &indices);
+
+    UniformData_t uniforms = {0};
+    uniforms.diffuse       = texture;
+    dash_make_identity(uniforms.MVP);
+
+    DrawCommand_t draw          = {0};
+    draw.vertex_buffer          = vertices;
+    draw.vertex_stride          = MESH_VERTEX_STRIDE;
+    draw.vertex_buffer_length   = number_of_triangles * 3 * MESH_VERTEX_STRIDE;
+    draw.index_buffer           = indices;
+    draw.number_of_indices      = number_of_triangles * 3;
+    draw.number_of_vertices     = number_of_triangles * 3;
+    draw.vertex_shader_uniforms = (void *)&uniforms;
+    dash_mat_copy(uniforms.MVP, draw.object_to_clip_matrix);
+
+    Render_Begin_Draws();
+    Render_Draw(&draw);
+
+    /* Setup, vertex processing included */
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < KERNEL_REPEATS; r++)
+    {
+        uint64_t cycles = 0;
+        CYCLES_SCOPE(cycles)
+        {
+            Setup_Triangles_Single_Thread();
+        }
+        best = (cycles < best) ? cycles : best;
+    }
+    ASSERT(Trianges_To_Be_Rastered_Counter == number_of_triangles);
+    Kernel_Print_Result("Setup_Triangles", shape->name, best, number_of_triangles, 0);
+
+    /* Raster, float then integer edge functions. The depth buffer is cleared between runs or every span would fail the depth test */
+    PipelineStatistics_t stats = {0};
+
+    best = UINT64_MAX;
+    for (int r = 0; r < KERNEL_REPEATS; r++)
+    {
+        Framebuffer_Clear_Depth();
+        memset(&stats, 0, sizeof(stats));
+
+        uint64_t cycles = 0;
+        CYCLES_SCOPE(cycles)
+        {
+            for (size_t i = 0; i < Trianges_To_Be_Rastered_Counter; i += 4)
+                Raster_Triangle_Batchf(i, &stats);
+        }
+        best = (cycles < best) ? cycles : best;
+    }
+    Kernel_Print_Result("Raster_Triangle_Batchf", shape->name, best, number_of_triangles, stats.fragments_written);
+
+    best = UINT64_MAX;
+    for (int r = 0; r < KERNEL_REPEATS; r++)
+    {
+        Framebuffer_Clear_Depth();
+
+        uint64_t cycles = 0;
+        CYCLES_SCOPE(cycles)
+        {
+            for (size_t i = 0; i < Trianges_To_Be_Rastered_Counter; i += 4)
+                Raster_Triangle_Batch(i);
+        }
+        best = (cycles < best) ? cycles : best;
+    }
+    Kernel_Print_Result("Raster_Triangle_Batch (integer)", shape->name, best, number_of_triangles, stats.fragments_written);
+
+    Render_Begin_Draws();
+    free(indices);
+    free(vertices);
+}
+
+static void Kernel_Bench_Buffers(void)
+{
+    const uint64_t number_of_pixels = IMAGE_W * IMAGE_H;
+
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < KERNEL_REPEATS; r++)
+    {
+        uint64_t cycles = 0;
+        CYCLES_SCOPE(cycles)
+        {
+            Framebuffer_Clear_Depth();
+        }
+        best = (cycles < best) ? cycles : best;
+    }
+    Kernel_Print_Result("Framebuffer_Clear_Depth", "screen", best, 0, number_of_pixels);
+
+    /* Something other than the clear value, or the whole buffer is skipped */
+    for (uint64_t i = 0; i < number_of_pixels; i++)
+        RenderState.depth_buffer[i] = 1.0f + (float)(i % 9);
+
+    best = UINT64_MAX;
+    for (int r = 0; r < KERNEL_REPEATS; r++)
+    {
+        uint64_t cycles = 0;
+        CYCLES_SCOPE(cycles)
+        {
+            Convert_Depth_Buffer_For_Drawing();
+        }
+        best = (cycles < best) ? cycles : best;
+    }
+    Kernel_Print_Result("Convert_Depth_Buffer_For_Drawing", "screen", best, 0, number_of_pixels);
+}
+
+static void Kernel_Bench_Matrix(void)
+{
+    mat4x4 matrix;
+    dash_rotate_make(matrix, 0.5f, (vec3){0.0f, 1.0f, 0.0f});
+
+    /* Each result feeds the next, a rotation keeps the length so the numbers do not blow up, and the multiplies cannot be skipped */
+    __m128 vector = _mm_setr_ps(1.0f, 2.0f, 3.0f, 1.0f);
+
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < KERNEL_REPEATS; r++)
+    {
+        uint64_t cycles = 0;
+        CYCLES_SCOPE(cycles)
+        {
+            for (size_t i = 0; i < KERNEL_SAMPLES; i++)
+                vector = mat4x4_mul_m128(matrix, vector);
+        }
+        best = (cycles < best) ? cycles : best;
+    }
+
+    printf("%-34s %-8s %14.2f cycles per call (%f)\n", "mat4x4_mul_m128", "vec4", (double)best / KERNEL_SAMPLES, _mm_cvtss_f32(vector));
+}
+
+static void Kernel_Bench_Texture(const char *name, const texture_t *texture)
+{
+    int *coordinates = malloc(sizeof(int) * 2 * KERNEL_SAMPLES);
+    ASSERT(coordinates);
+
+    uint32_t seed = 0xBADA55u;
+    for (size_t i = 0; i < KERNEL_SAMPLES; i++)
+    {
+        coordinates[i * 2 + 0] = (int)(Kernel_Random(&seed) % (uint32_t)texture->w);
+        coordinates[i * 2 + 1] = (int)(Kernel_Random(&seed) % (uint32_t)texture->h);
+    }
+
+    uint32_t checksum = 0;
+    uint64_t best     = UINT64_MAX;
+    for (int r = 0; r < KERNEL_REPEATS; r++)
+    {
+        uint64_t cycles = 0;
+        CYCLES_SCOPE(cycles)
+        {
+            for (size_t i = 0; i < KERNEL_SAMPLES; i++)
+            {
+                uint8_t texel[4];
+                Texture_Fetch(texture, coordinates[i * 2 + 0], coordinates[i * 2 + 1], texel);
+                checksum += texel[0];
+            }
+        }
+        best = (cycles < best) ? cycles : best;
+    }
+
+    printf("%-34s %-8s %14.2f cycles per fetch (%u)\n", "Texture_Fetch", name, (double)best / KERNEL_SAMPLES, checksum);
+    free(coordinates);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t number_of_triangles = KERNEL_DEFAULT_TRIANGLES;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--triangles") == 0 && i + 1 < argc)
+            number_of_triangles = (size_t)strtoul(argv[++i], NULL, 10);
+        else
+        {
+            fprintf(stderr, "Usage : %s [--triangles <n>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (number_of_triangles == 0)
+        number_of_triangles = KERNEL_DEFAULT_TRIANGLES;
+
+    Timer_Init();
+
+    /* Setup_Triangles_For_MT is never called, the job system is only here for completeness */
+    jobs_init();
+    Render_Set_Viewport(IMAGE_W, IMAGE_H);
+
+    printf("Instruction set : %s, %.0f MHz time stamp counter\n", Kernel_Instruction_Set(), Cycles_Per_Second() / 1000000.0);
+    printf("%-34s %-8s %14s %14s %12s\n", "Kernel", "Input", "Cycles", "Per triangle", "Per pixel");
+
+    texture_t texture = Kernel_Make_Texture(256);
+
+    for (size_t i = 0; i < KERNEL_NUMBER_OF_SHAPES; i++)
+        Kernel_Bench_Shape(&Kernel_Shapes[i], number_of_triangles, &texture);
+
+    Kernel_Bench_Buffers();
+    Kernel_Bench_Matrix();
+
+    texture_t compressed = Texture_Compress(texture, TEXTURE_FORMAT_BC1);
+    Kernel_Bench_Texture("rgba8", &texture);
+    Kernel_Bench_Texture("bc1", &compressed);
+
+    Texture_Destroy(&compressed);
+    Texture_Destroy(&texture);
+    jobs_shutdown();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "bench_scenes.h"
+#include "utils/file_map.h"
+#include "utils/utils.h"
+
+const BenchScene_t Bench_Scenes[] = {
+    {"crate", "Wooden Box/wooden crate.obj", 0, 0.0f, 2.5f, 0.5f},
+    {"teapot", "Teapot/teapot.obj", 0, 0.0f, 2.5f, 0.5f},
+    {"sponza", "sponza/sponza.obj", 0, 0.0f, 0.6f, 0.1f},
+    {"dragon", "dragon.obj", 0, 0.0f, 2.0f, 0.3f},
+    {"soup_tiny", NULL, 200000, 0.01f, 2.5f, 0.3f},  /* Setup bound, most triangles cover a pixel or two */
+    {"soup_medium", NULL, 20000, 0.1f, 2.5f, 0.3f},  /* Mix of both */
+    {"soup_large", NULL, 200, 1.5f, 2.5f, 0.3f},     /* Fill bound, heavy overdraw */
+};
+
+const size_t Bench_Number_Of_Scenes = sizeof(Bench_Scenes) / sizeof(Bench_Scenes[0]);
+
+/* Small fixed seed generator, the soups have to be the same every run and on every platform */
+static uint32_t Bench_Random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static float Bench_Random_Float(uint32_t *state, const float min, const float max)
+{
+    return min + (max - min) * ((float)(Bench_Random(state) >> 8) / (float)(1 << 24));
+}
+
+texture_t Bench_Make_Checker_Texture(const int size)
+{
+    texture_t t = {0};
+    t.w         = size;
+    t.h         = size;
+    t.bpp       = 4;
+    t.data      = malloc((size_t)size * size * 4);
+    ASSERT(t.data);
+
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            const uint8_t value = (((x / 8) + (y / 8)) & 1) ? 230 : 40;
+            uint8_t      *texel = &t.data[(y * size + x) * 4];
+            texel[0]            = value;
+            texel[1]            = value;
+            texel[2]            = value;
+            texel[3]            = 255;
+        }
+    }
+    return t;
+}
+
+/* Triangles scattered through the unit cube, each one facing a random way */
+static void Bench_Make_Triangle_Soup(BenchSceneData_t *data, const BenchScene_t *scene)
+{
+    uint32_t seed = 0x5EED1234u;
+
+    data->number_of_vertices = scene->number_of_triangles * 3;
+    data->number_of_indices  = scene->number_of_triangles * 3;
+    data->vertex_data        = malloc(sizeof(float) * MESH_VERTEX_STRIDE * data->number_of_vertices);
+    data->index_data         = malloc(sizeof(uint32_t) * data->number_of_indices);
+    ASSERT(data->vertex_data && data->index_data);
+
+    const float uv[3][2] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {0.0f, 1.0f}};
+
+    for (size_t t = 0; t < scene->number_of_triangles; t++)
+    {
+        vec3 centre = {Bench_Random_Float(&seed, -1.0f, 1.0f), Bench_Random_Float(&seed, -1.0f, 1.0f), Bench_Random_Float(&seed, -1.0f, 1.0f)};
+
+        for (size_t v = 0; v < 3; v++)
+        {
+            float *vertex = &data->vertex_data[(t * 3 + v) * MESH_VERTEX_STRIDE];
+            for (int axis = 0; axis < 3; axis++)
+                vertex[axis] = centre[axis] + Bench_Random_Float(&seed, -0.5f, 0.5f) * scene->triangle_size;
+
+            vertex[3] = uv[v][0];
+            vertex[4] = uv[v][1];
+
+            data->index_data[t * 3 + v] = (uint32_t)(t * 3 + v);
+        }
+    }
+
+    glm_vec4_copy((vec4){0.0f, 0.0f, 0.0f, sqrtf(3.0f) + scene->triangle_size}, data->bounding_sphere);
+
+    data->checker = Bench_Make_Checker_Texture(64);
+
+    data->uniform_data = calloc(1, sizeof(UniformData_t));
+    data->draws        = calloc(1, sizeof(DrawCommand_t));
+    ASSERT(data->uniform_data && data->draws);
+
+    data->uniform_data[0].diffuse = &data->checker;
+
+    DrawCommand_t *draw          = &data->draws[0];
+    draw->vertex_buffer          = data->vertex_data;
+    draw->vertex_stride          = MESH_VERTEX_STRIDE;
+    draw->vertex_buffer_length   = data->number_of_vertices * MESH_VERTEX_STRIDE;
+    draw->index_buffer           = data->index_data;
+    draw->number_of_indices      = data->number_of_indices;
+    draw->number_of_vertices     = data->number_of_vertices;
+    draw->vertex_shader_uniforms = (void *)&data->uniform_data[0];
+    glm_vec4_copy(data->bounding_sphere, draw->bounding_sphere);
+
+    data->number_of_draws     = 1;
+    data->number_of_triangles = scene->number_of_triangles;
+}
+
+/* A draw per material, the same as main.c */
+static void Bench_Make_Mesh_Draws(BenchSceneData_t *data)
+{
+    struct Mesh *obj = &data->mesh;
+
+    data->vertex_data        = obj->vertex_data;
+    data->number_of_vertices = obj->number_of_vertices;
+    data->index_data         = obj->index_data;
+    data->number_of_indices  = obj->number_of_indices;
+
+    Mesh_Bounding_Sphere(obj, data->bounding_sphere);
+
+    data->uniform_data = calloc(obj->number_of_draw_ranges + 1, sizeof(UniformData_t));
+    data->draws        = calloc(obj->number_of_draw_ranges + 1, sizeof(DrawCommand_t));
+    ASSERT(data->uniform_data && data->draws);
+
+    for (size_t i = 0; i < obj->number_of_draw_ranges; i++)
+    {
+        const MeshDrawRange_t *range = &obj->draw_ranges[i];
+
+        if (range->diffuse_texture < 0 || obj->textures[range->diffuse_texture] == NULL ||
+            obj->textures[range->diffuse_texture]->data == NULL)
+            continue;
+
+        UniformData_t *uniforms = &data->uniform_data[data->number_of_draws];
+        uniforms->diffuse       = obj->textures[range->diffuse_texture];
+
+        DrawCommand_t *draw          = &data->draws[data->number_of_draws++];
+        draw->vertex_buffer          = obj->vertex_data;
+        draw->vertex_stride          = MESH_VERTEX_STRIDE;
+        draw->vertex_buffer_length   = obj->number_of_vertices * MESH_VERTEX_STRIDE;
+        draw->index_buffer           = obj->index_data;
+        draw->first_index            = range->first_index;
+        draw->number_of_indices      = range->number_of_indices;
+        draw->first_vertex           = range->first_vertex;
+        draw->number_of_vertices     = range->number_of_vertices;
+        draw->vertex_shader_uniforms = (void *)uniforms;
+        draw->sort_key               = (uint32_t)range->diffuse_texture;
+        draw->clusters               = (range->number_of_clusters) ? &obj->clusters[range->first_cluster] : NULL;
+        draw->number_of_clusters     = range->number_of_clusters;
+        glm_vec4_copy(data->bounding_sphere, draw->bounding_sphere);
+
+        data->number_of_triangles += range->number_of_indices / 3;
+    }
+}
+
+bool Bench_Load_Scene(BenchSceneData_t *data, const BenchScene_t *scene, const char *resource_directory)
+{
+    *data = (BenchSceneData_t){0};
+
+    if (scene->file_name == NULL)
+    {
+        Bench_Make_Triangle_Soup(data, scene);
+        return true;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", resource_directory, scene->file_name);
+
+    if (!File_Get_Info(path, NULL, NULL))
+    {
+        fprintf(stderr, "Skipping scene '%s', cannot find : %s\n", scene->name, path);
+        return false;
+    }
+
+    data->mesh     = Mesh_Load(path);
+    data->has_mesh = true;
+    Bench_Make_Mesh_Draws(data);
+
+    if (data->number_of_draws == 0)
+        fprintf(stderr, "Scene '%s' has nothing with a diffuse texture to draw\n", scene->name);
+
+    return data->number_of_draws > 0;
+}
+
+void Bench_Destroy_Scene(BenchSceneData_t *data)
+{
+    free(data->draws);
+    free(data->uniform_data);
+
+    if (data->has_mesh)
+        Mesh_Destroy(&data->mesh);
+    else
+    {
+        free(data->vertex_data);
+        free(data->index_data);
+        Texture_Destroy(&data->checker);
+    }
+    *data = (BenchSceneData_t){0};
+}
+
+/* One orbit of the bounding sphere over the run, looking at its centre */
+void Bench_Camera(const BenchScene_t *scene, const vec4 sphere, const size_t frame, const size_t number_of_frames, vec3 eye, mat4x4 view)
+{
+    const float angle  = 2.0f * 3.14159265f * (float)frame / (float)number_of_frames;
+    const float radius = sphere[3] * scene->camera_distance_scale;
+
+    eye[0] = sphere[0] + radius * sinf(angle);
+    eye[1] = sphere[1] + sphere[3] * scene->camera_height_scale;
+    eye[2] = sphere[2] + radius * cosf(angle);
+
+    vec3 centre = {sphere[0], sphere[1], sphere[2]};
+    vec3 up     = {0.0f, 1.0f, 0.0f};
+
+    mat4 tmp_view;
+    glm_lookat(eye, centre, up, tmp_view);
+    mat4_to_mat4x4(tmp_view, view);
+}
+
+void Bench_Record_Scene(BenchSceneData_t *data, const BenchScene_t *scene, const size_t frame, const size_t number_of_frames)
+{
+    mat4x4 proj, model;
+    Raster_Projection_Matrix(proj, IMAGE_W, IMAGE_H);
+    dash_translate_make(model, 0.0f, 0.0f, 0.0f);
+
+    vec3   eye;
+    mat4x4 view, MVP;
+    Bench_Camera(scene, data->bounding_sphere, frame, number_of_frames, eye, view);
+    dash_mat_mul_mat(view, model, MVP);
+    dash_mat_mul_mat(proj, MVP, MVP);
+
+    Render_Begin_Draws();
+    for (size_t i = 0; i < data->number_of_draws; i++)
+    {
+        dash_mat_copy(MVP, ((UniformData_t *)data->draws[i].vertex_shader_uniforms)->MVP);
+        dash_mat_copy(MVP, data->draws[i].object_to_clip_matrix);
+        Render_Set_Camera_Position(&data->draws[i], model, eye);
+        Render_Draw(&data->draws[i]);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef __BENCH_SCENES_H__
+#define __BENCH_SCENES_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "raster/renderer.h"
+#include "utils/mat4x4.h"
+
+/*
+The fixed scenes shared by the headless tools, the benchmark and the golden image tests
+    - Scene files are looked for under the resource directory, scenes that are not there are skipped
+    - The soups are made from a fixed seed, they are the same every run and on every platform
+    - The camera orbits the bounding sphere, frame 'frame' of 'number_of_frames' is always the same view
+*/
+
+typedef struct
+{
+    const char *name;
+    const char *file_name;             /* Relative to the resource directory, NULL for a synthetic scene */
+    size_t      number_of_triangles;   /* Synthetic scenes only */
+    float       triangle_size;         /* Synthetic scenes only, edge length in object space */
+    float       camera_distance_scale; /* Orbit radius, in bounding sphere radii */
+    float       camera_height_scale;   /* Orbit height, in bounding sphere radii */
+} BenchScene_t;
+
+extern const BenchScene_t Bench_Scenes[];
+extern const size_t       Bench_Number_Of_Scenes;
+
+/* Everything that is drawn for a scene */
+typedef struct
+{
+    struct Mesh mesh; /* Unused by synthetic scenes */
+    bool        has_mesh;
+
+    float    *vertex_data;  /* Points into the mesh, or owned by a synthetic scene */
+    size_t    number_of_vertices;
+    uint32_t *index_data;
+    size_t    number_of_indices;
+
+    texture_t checker; /* Synthetic scenes only */
+
+    UniformData_t *uniform_data;
+    DrawCommand_t *draws;
+    size_t         number_of_draws;
+    size_t         number_of_triangles;
+
+    vec4 bounding_sphere;
+} BenchSceneData_t;
+
+texture_t Bench_Make_Checker_Texture(int size);
+
+bool Bench_Load_Scene(BenchSceneData_t *data, const BenchScene_t *scene, const char *resource_directory);
+void Bench_Destroy_Scene(BenchSceneData_t *data);
+void Bench_Camera(const BenchScene_t *scene, const vec4 sphere, size_t frame, size_t number_of_frames, vec3 eye, mat4x4 view);
+
+/* Record every draw of the scene for one frame of the camera path */
+void Bench_Record_Scene(BenchSceneData_t *data, const BenchScene_t *scene, size_t frame, size_t number_of_frames);
+
+#endif // __BENCH_SCENES_H__
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "bench_scenes.h"
+#include "raster/renderer.h"
+#include "raster/image_write.h"
+#include "job_system/js.h"
+#include "stb_image.h"
+
+#include "utils/file_map.h"
+#include "utils/timer.h"
+#include "utils/utils.h"
+
+/*
+Golden image tests, headless so they run in CI without a display
+    - Renders a few views of the fixed scenes and compares the colour and depth buffers with PNGs in the golden directory
+    - Every view is rendered twice, through the frame path (float edge functions on the job system) and through the
+        integer edge function kernel on the main thread, both are held to the same golden
+    - Colour is compared per pixel by a distance weighted like luma, so green counts the most and blue the least.
+        A pixel fails past --tolerance, a view fails when more than --max-bad of its pixels fail
+    - Depth goldens hold the raw float of each pixel in its 4 channels, PNG keeps it exactly. Depth fails past a
+        relative difference of --depth-tolerance, or where only one side has drawn anything
+    - A failing buffer gets a diff image in the output directory, the failing pixels in red over the dimmed golden
+    - --update writes the goldens from the frame path instead of comparing, check the images before committing them
+    - --scene limits the run to the scenes it names, it can be given more than once. The procedural soups need
+        no files from the resource directory, ctest runs those
+    - Exits with EXIT_FAILURE if any view fails, a missing golden is a failure
+
+    simderella_golden [--res <dir>] [--golden <dir>] [--out <dir>] [--update] [--scene <name>]...
+                      [--tolerance <0-255>] [--max-bad <fraction>] [--depth-tolerance <fraction>]
+*/
+
+#define GOLDEN_DEFAULT_RESOURCE_DIRECTORY "../../res"
+#define GOLDEN_DEFAULT_DIRECTORY          "../../golden"
+#define GOLDEN_DEFAULT_OUTPUT_DIRECTORY   "."
+#define GOLDEN_DEFAULT_TOLERANCE          8.0f
+#define GOLDEN_DEFAULT_MAX_BAD            0.001f
+#define GOLDEN_DEFAULT_DEPTH_TOLERANCE    0.001f
+
+#define GOLDEN_PATH_FRAMES 12 /* Views are frames of the scene's camera path */
+
+static const char *Golden_Scenes[] = {"crate", "teapot", "soup_medium", "soup_large"};
+static const int   Golden_Views[]  = {0, 4, 8};
+
+#define GOLDEN_NUMBER_OF_SCENES (sizeof(Golden_Scenes) / sizeof(Golden_Scenes[0]))
+#define GOLDEN_NUMBER_OF_VIEWS  (sizeof(Golden_Views) / sizeof(Golden_Views[0]))
+
+typedef enum
+{
+    GOLDEN_PATH_FRAME = 0, /* Raster_Triangles_MT, what the window draws with */
+    GOLDEN_PATH_INTEGER,
+    GOLDEN_PATH_COUNT,
+} GoldenPath_t;
+
+static const char *Golden_Path_Names[GOLDEN_PATH_COUNT] = {"frame", "integer"};
+
+typedef struct
+{
+    const char *golden_directory;
+    const char *output_directory;
+    bool        update;
+    float       tolerance;
+    float       max_bad;
+    float       depth_tolerance;
+} GoldenOptions_t;
+
+/* Both buffers of a finished frame, the way the goldens store them */
+typedef struct
+{
+    uint8_t colour[IMAGE_W * IMAGE_H * 3];
+    float   depth[IMAGE_W * IMAGE_H];
+} GoldenFrame_t;
+
+static void Golden_Render(const GoldenPath_t path)
+{
+    Setup_Triangles_For_MT();
+
+    if (path == GOLDEN_PATH_FRAME)
+    {
+        Raster_Triangles_MT();
+    }
+    else
+    {
+        for (size_t i = 0; i < Trianges_To_Be_Rastered_Counter; i += 4)
+            Raster_Triangle_Batch(i);
+    }
+
+    PipelineStatistics_t statistics;
+    Pipeline_Statistics_Collect(&statistics);
+}
+
+static void Golden_Capture(GoldenFrame_t *frame)
+{
+    Image_Swizzle_To_RGB(RenderState.colour_buffer, frame->colour, IMAGE_W * IMAGE_H, Render_Colour_Format_Offsets[RenderState.colour_format]);
+    memcpy(frame->depth, RenderState.depth_buffer, sizeof(frame->depth));
+}
+
+static float Golden_Colour_Distance(const uint8_t *a, const uint8_t *b)
+{
+    const float dr = (float)a[0] - (float)b[0];
+    const float dg = (float)a[1] - (float)b[1];
+    const float db = (float)a[2] - (float)b[2];
+    return sqrtf(0.299f * dr * dr + 0.587f * dg * dg + 0.114f * db * db);
+}
+
+static bool Golden_Depth_Matches(const float a, const float b, const float tolerance)
+{
+    if (a == b)
+        return true;
+
+    /* Drawn on one side only */
+    if (a == FLT_MAX || b == FLT_MAX)
+        return false;
+
+    const float largest = (fabsf(a) > fabsf(b)) ? fabsf(a) : fabsf(b);
+    return fabsf(a - b) <= tolerance * largest;
+}
+
+/* Red where 'bad' is set, the golden's luma at a third of its brightness everywhere else */
+static void Golden_Write_Diff(const char *file_path, const uint8_t *golden_rgb, const bool *bad)
+{
+    uint8_t *diff = malloc((size_t)IMAGE_W * IMAGE_H * 3);
+    ASSERT(diff);
+
+    for (size_t i = 0; i < (size_t)IMAGE_W * IMAGE_H; i++)
+    {
+        const uint8_t *g    = &golden_rgb[i * 3];
+        const uint8_t  luma = (uint8_t)((0.299f * g[0] + 0.587f * g[1] + 0.114f * g[2]) / 3.0f);
+
+        diff[i * 3 + 0] = (bad[i]) ? 255 : luma;
+        diff[i * 3 + 1] = (bad[i]) ? 0 : luma;
+        diff[i * 3 + 2] = (bad[i]) ? 0 : luma;
+    }
+
+    Image_Write_PNG(file_path, IMAGE_W, IMAGE_H, 3, diff);
+    free(diff);
+}
+
+/* Loads a golden with exactly 'channels' channels at the frame size, NULL if it is missing or does not fit */
+static uint8_t *Golden_Load(const char *file_path, const int channels)
+{
+    if (!File_Get_Info(file_path, NULL, NULL))
+    {
+        fprintf(stderr, "Missing golden : %s\n", file_path);
+        return NULL;
+    }
+
+    /* Texture_Load flips its images for the UVs, goldens are stored top row first like the frame buffer */
+    stbi_set_flip_vertically_on_load_thread(0);
+
+    int      w, h, n;
+    uint8_t *pixels = stbi_load(file_path, &w, &h, &n, channels);
+    if (pixels == NULL)
+    {
+        fprintf(stderr, "Cannot load golden : %s : %s\n", stbi_failure_reason(), file_path);
+        return NULL;
+    }
+
+    if (w != IMAGE_W || h != IMAGE_H)
+    {
+        fprintf(stderr, "Golden is %dx%d, the frame is %dx%d : %s\n", w, h, IMAGE_W, IMAGE_H, file_path);
+        stbi_image_free(pixels);
+        return NULL;
+    }
+    return pixels;
+}
+
+static bool Golden_Compare(const GoldenOptions_t *options, const GoldenFrame_t *frame, const char *name, const char *path_name)
+{
+    char colour_path[1024], depth_path[1024], diff_path[1024];
+    snprintf(colour_path, sizeof(colour_path), "%s/%s_colour.png", options->golden_directory, name);
+    snprintf(depth_path, sizeof(depth_path), "%s/%s_depth.png", options->golden_directory, name);
+
+    uint8_t *golden_colour = Golden_Load(colour_path, 3);
+    uint8_t *golden_depth  = Golden_Load(depth_path, 4);
+
+    bool passed = golden_colour && golden_depth;
+    if (passed)
+    {
+        const size_t number_of_pixels = (size_t)IMAGE_W * IMAGE_H;
+
+        bool *bad = malloc(sizeof(bool) * number_of_pixels);
+        ASSERT(bad);
+
+        /* Colour */
+        size_t bad_colour     = 0;
+        float  worst_distance = 0.0f;
+        for (size_t i = 0; i < number_of_pixels; i++)
+        {
+            const float distance = Golden_Colour_Distance(&frame->colour[i * 3], &golden_colour[i * 3]);
+            worst_distance       = (distance > worst_distance) ? distance : worst_distance;
+
+            bad[i] = distance > options->tolerance;
+            bad_colour += bad[i];
+        }
+
+        const bool colour_passed = (float)bad_colour <= options->max_bad * (float)number_of_pixels;
+        if (!colour_passed)
+        {
+            snprintf(diff_path, sizeof(diff_path), "%s/%s_%s_colour_diff.png", options->output_directory, name, path_name);
+            Golden_Write_Diff(diff_path, golden_colour, bad);
+        }
+
+        /* Depth */
+        size_t bad_depth = 0;
+        for (size_t i = 0; i < number_of_pixels; i++)
+        {
+            float golden;
+            memcpy(&golden, &golden_depth[i * 4], sizeof(float));
+
+            bad[i] = !Golden_Depth_Matches(frame->depth[i], golden, options->depth_tolerance);
+            bad_depth += bad[i];
+        }
+
+        const bool depth_passed = (float)bad_depth <= options->max_bad * (float)number_of_pixels;
+        if (!depth_passed)
+        {
+            snprintf(diff_path, sizeof(diff_path), "%s/%s_%s_depth_diff.png", options->output_directory, name, path_name);
+            Golden_Write_Diff(diff_path, golden_colour, bad);
+        }
+
+        printf("%-24s %-8s colour %7zu bad (worst %6.1f)  depth %7zu bad  %s\n",
+               name, path_name, bad_colour, worst_distance, bad_depth, (colour_passed && depth_passed) ? "PASS" : "FAIL");
+
+        passed = colour_passed && depth_passed;
+        free(bad);
+    }
+    else
+    {
+        printf("%-24s %-8s FAIL\n", name, path_name);
+    }
+
+    stbi_image_free(golden_colour);
+    stbi_image_free(golden_depth);
+    return passed;
+}
+
+static bool Golden_Update(const GoldenOptions_t *options, const GoldenFrame_t *frame, const char *name)
+{
+    char colour_path[1024], depth_path[1024];
+    snprintf(colour_path, sizeof(colour_path), "%s/%s_colour.png", options->golden_directory, name);
+    snprintf(depth_path, sizeof(depth_path), "%s/%s_depth.png", options->golden_directory, name);
+
+    const bool written = Image_Write_PNG(colour_path, IMAGE_W, IMAGE_H, 3, frame->colour) &&
+                         Image_Write_PNG(depth_path, IMAGE_W, IMAGE_H, 4, (const uint8_t *)frame->depth);
+
+    printf("%-24s %s\n", name, (written) ? "updated" : "FAILED TO WRITE");
+    return written;
+}
+
+static const BenchScene_t *Golden_Find_Scene(const char *name)
+{
+    for (size_t i = 0; i < Bench_Number_Of_Scenes; i++)
+        if (strcmp(Bench_Scenes[i].name, name) == 0)
+            return &Bench_Scenes[i];
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char     *resource_directory = GOLDEN_DEFAULT_RESOURCE_DIRECTORY;
+    GoldenOptions_t options            = {GOLDEN_DEFAULT_DIRECTORY, GOLDEN_DEFAULT_OUTPUT_DIRECTORY, false,
+                                          GOLDEN_DEFAULT_TOLERANCE, GOLDEN_DEFAULT_MAX_BAD, GOLDEN_DEFAULT_DEPTH_TOLERANCE};
+
+    /* Every golden scene unless --scene picks some */
+    const char *scenes[GOLDEN_NUMBER_OF_SCENES];
+    size_t      number_of_scenes = 0;
+    bool        usage_error      = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--res") == 0 && i + 1 < argc)
+            resource_directory = argv[++i];
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+            options.golden_directory = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            options.output_directory = argv[++i];
+        else if (strcmp(argv[i], "--update") == 0)
+            options.update = true;
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc && number_of_scenes < GOLDEN_NUMBER_OF_SCENES)
+        {
+            const char *name = argv[++i];
+
+            bool known = false;
+            for (size_t s = 0; s < GOLDEN_NUMBER_OF_SCENES; s++)
+                known |= (strcmp(Golden_Scenes[s], name) == 0);
+
+            if (!known)
+            {
+                fprintf(stderr, "Golden: there is no golden scene called %s\n", name);
+                usage_error = true;
+            }
+            scenes[number_of_scenes++] = name;
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            options.tolerance = strtof(argv[++i], NULL);
+        else if (strcmp(argv[i], "--max-bad") == 0 && i + 1 < argc)
+            options.max_bad = strtof(argv[++i], NULL);
+        else if (strcmp(argv[i], "--depth-tolerance") == 0 && i + 1 < argc)
+            options.depth_tolerance = strtof(argv[++i], NULL);
+        else
+            usage_error = true;
+    }
+
+    if (usage_error)
+    {
+        fprintf(stderr, "Usage : %s [--res <dir>] [--golden <dir>] [--out <dir>] [--update] [--scene <name>]... "
+                        "[--tolerance <0-255>] [--max-bad <fraction>] [--depth-tolerance <fraction>]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (number_of_scenes == 0)
+    {
+        for (size_t s = 0; s < GOLDEN_NUMBER_OF_SCENES; s++)
+            scenes[s] = Golden_Scenes[s];
+        number_of_scenes = GOLDEN_NUMBER_OF_SCENES;
+    }
+
+    Timer_Init();
+    jobs_init();
+    Render_Set_Viewport(IMAGE_W, IMAGE_H);
+
+    /* Too big for the stack */
+    GoldenFrame_t *frame = malloc(sizeof(GoldenFrame_t));
+    ASSERT(frame);
+
+    size_t number_of_passed = 0;
+    size_t number_of_failed = 0;
+
+    for (size_t s = 0; s < number_of_scenes; s++)
+    {
+        const BenchScene_t *scene = Golden_Find_Scene(scenes[s]);
+        ASSERT(scene);
+
+        /* Missing scene files are a failure here, a test that quietly does nothing passes every time */
+        BenchSceneData_t data;
+        if (!Bench_Load_Scene(&data, scene, resource_directory))
+        {
+            Bench_Destroy_Scene(&data);
+            number_of_failed += GOLDEN_NUMBER_OF_VIEWS;
+            continue;
+        }
+
+        for (size_t v = 0; v < GOLDEN_NUMBER_OF_VIEWS; v++)
+        {
+            char name[256];
+            snprintf(name, sizeof(name), "%s_view%d", scene->name, Golden_Views[v]);
+
+            for (int path = 0; path < GOLDEN_PATH_COUNT; path++)
+            {
+                if (options.update && path != GOLDEN_PATH_FRAME)
+                    break;
+
+                Bench_Record_Scene(&data, scene, (size_t)Golden_Views[v], GOLDEN_PATH_FRAMES);
+                Golden_Render((GoldenPath_t)path);
+                Golden_Capture(frame);
+
+                const bool passed = (options.update) ? Golden_Update(&options, frame, name)
+                                                     : Golden_Compare(&options, frame, name, Golden_Path_Names[path]);
+
+                number_of_passed += passed;
+                number_of_failed += !passed;
+            }
+        }
+
+        Bench_Destroy_Scene(&data);
+    }
+
+    free(frame);
+    jobs_shutdown();
+
+    printf("%zu passed, %zu failed\n", number_of_passed, number_of_failed);
+
+    return (number_of_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -6,92 +6,85 @@
 
 #include "raster/graphics.h"
 #include "raster/renderer.h"
+#include "raster/frame_output.h"
+#include "raster/frame_pipeline.h"
 
 #include "job_system/js.h"
+#include "utils/trace.h"
 
 #include "raster/light.h"
 #include "utils/mat4x4.h"
 #include "utils/utils.h"
 
-// TODO : Fix jobs full error
+#if !SDL_VERSION_ATLEAST(2, 0, 18)
+    #define SDL_WINDOWEVENT_DISPLAY_CHANGED SDL_WINDOWEVENT_SIZE_CHANGED // Before 2.0.18 there is no such event
+#endif
 
-static inline void BindVertexBuffer(void *vertex_buffer, const size_t length, const size_t stride)
+/*
+Called with each finished frame, from Frame_Pipeline_End_Frame on the main thread
+    - SDL window, surface and renderer calls only work on the thread that made the window, Frame_Pipeline calls
+        this there while the workers raster the next frame
+*/
+static void Present_Frame(const uint8_t *colour_buffer, const uint64_t frame_index, void *user_data)
 {
-    ASSERT(vertex_buffer);
-    ASSERT(stride > 0);
+    LOG_UNUSED(frame_index);
+    LOG_UNUSED(user_data);
 
-    RenderState.vertex_buffer        = vertex_buffer;
-    RenderState.vertex_stride        = stride;
-    RenderState.vertex_buffer_length = length;
+#ifdef GRAPHICS_USE_SDL_RENDERER
+    SDL_UpdateTexture(global_renderer.texture, NULL, colour_buffer, IMAGE_W * IMAGE_BPP);
+    SDL_RenderCopy(global_renderer.renderer, global_renderer.texture, NULL, NULL);
+    SDL_RenderPresent(global_renderer.renderer);
+#else
+    /* Whatever the surface's format and pitch, clipped to it if it is smaller */
+    SDL_Surface *surface = global_renderer.surface;
+    const int    width   = (surface->w < IMAGE_W) ? surface->w : IMAGE_W;
+    const int    height  = (surface->h < IMAGE_H) ? surface->h : IMAGE_H;
+
+    if (SDL_LockSurface(surface) == 0)
+    {
+        SDL_ConvertPixels(width, height, Renderer_SDL_Format_From_Colour_Format(RenderState.colour_format), colour_buffer, IMAGE_W * IMAGE_BPP,
+                          surface->format->format, surface->pixels, surface->pitch);
+        SDL_UnlockSurface(surface);
+    }
+    SDL_UpdateWindowSurface(global_renderer.window);
+#endif
 }
 
-static inline void BindIndexBuffer(int *index_buffer, const size_t length)
+/* The frame was rasterized into the window surface, it only has to be shown */
+static void Present_Surface(const uint8_t *colour_buffer, const uint64_t frame_index, void *user_data)
 {
-    ASSERT(index_buffer);
-    ASSERT(length > 0);
+    LOG_UNUSED(colour_buffer);
+    LOG_UNUSED(frame_index);
+    LOG_UNUSED(user_data);
 
-    RenderState.index_buffer        = index_buffer;
-    RenderState.index_buffer_length = length;
+    Renderer_Present();
 }
 
-void Convert_Depth_Buffer_For_Drawing(void)
+#ifndef GRAPHICS_USE_SDL_RENDERER
+/*
+Rasterize straight into the window surface when it can take the frames as they are, into the colour targets
+and copy with Present_Frame when it cannot. Again every time the window surface changes
+*/
+static void Bind_Window_Surface(void)
 {
-    // Define the minimum and maximum depth values in your depth buffer
-    const float minDepth = 0.0f /* Set the minimum depth value */;
-    const float maxDepth = 10.0f /* Set the maximum depth value */;
+    Frame_Pipeline_Flush(); // The frames still waiting go out in the format they were rastered in
 
-#if 0
-    // Iterate over each depth value in the depth buffer
-     for (size_t i = 0; i < IMAGE_W * IMAGE_H; ++i)
+    RenderColourFormat_t surface_format = RENDER_FORMAT_BGRA;
+    uint8_t             *surface_pixels = Renderer_Direct_Surface(IMAGE_W, IMAGE_H, &surface_format);
+    if (surface_pixels)
     {
-         const float depthValue = RenderState.depth_buffer[i];
-
-        if (depthValue == FLT_MAX)
-            continue;
-
-        // Normalize the depth value between 0 and 1
-        const float normalizedDepth = ((depthValue - minDepth) / (maxDepth - minDepth));
-
-        // Map the normalized depth value to the range of 0 to 255
-        const uint8_t colorValue = (uint8_t)(normalizedDepth * 255.0f);
-
-        // Assign the color value to the RGBA color buffer
-        RenderState.colour_buffer[i * 4 + 0] = colorValue; // Red component
-        RenderState.colour_buffer[i * 4 + 1] = colorValue; // Green component
-        RenderState.colour_buffer[i * 4 + 2] = colorValue; // Blue component
-        RenderState.colour_buffer[i * 4 + 3] = 255;        // Alpha component (fully opaque)
+        Render_Set_Colour_Format(surface_format);
+        Frame_Pipeline_Init_Direct(Present_Surface, NULL, surface_pixels); // Rasterize into the surface, nothing to copy
     }
-#else
-    // Load the minimum and maximum depth values into SIMD registers
-    __m128 minDepthVec = _mm_set1_ps(minDepth);
-    __m128 maxDepthVec = _mm_set1_ps(maxDepth);
-
-    // Iterate over each depth value in the depth buffer (processing 4 values at a time)
-    for (size_t i = 0; i < IMAGE_W * IMAGE_H; i += 4)
+    else
     {
-        // Load 4 depth values from the depth buffer into a SIMD register
-        __m128 depthVec = _mm_load_ps(&RenderState.depth_buffer[i]);
-
-        __m128 cmp = _mm_cmpeq_ps(depthVec, _mm_set1_ps(FLT_MAX));
-
-        if (_mm_testz_si128(_mm_cvtps_epi32(cmp), _mm_cvtps_epi32(cmp)) == 0)
-            continue;
-
-        // Normalize the depth values between 0 and 1
-        __m128 normalizedDepthVec = _mm_div_ps(_mm_sub_ps(depthVec, minDepthVec), _mm_sub_ps(maxDepthVec, minDepthVec));
-
-        // Map the normalized depth values to the range of 0 to 255
-        __m128i colorValueVec = _mm_cvtps_epi32(_mm_mul_ps(normalizedDepthVec, _mm_set1_ps(255.0f)));
-
-        // Convert the packed integer values to 8-bit unsigned integers
-        __m128i colorValueU8Vec = _mm_packus_epi32(colorValueVec, colorValueVec);
-        colorValueU8Vec         = _mm_packus_epi16(colorValueU8Vec, colorValueU8Vec);
-
-        // Store the color values into the RGBA color buffer
-        _mm_storeu_si128((__m128i *)&RenderState.colour_buffer[i], colorValueU8Vec);
+        if (Renderer_Colour_Format_From_SDL(global_renderer.fmt->format, &surface_format))
+            Render_Set_Colour_Format(surface_format);
+        Frame_Pipeline_Init(Present_Frame, NULL, 2);
     }
-#endif
+    printf("Presenting %s\n", (surface_pixels) ? "straight from the window surface" : "by copying into the window surface");
 }
+#endif
 
 int main(int argc, char *argv[])
 {
@@ -103,7 +96,16 @@ int main(int argc, char *argv[])
     if (!Reneder_Startup("Simderella", IMAGE_W, IMAGE_H))
         return EXIT_FAILURE;
 
+    Timer_Init();
+    Trace_Set_Thread_Name("main"); // First, so the main thread is thread 0 in the trace
     jobs_init();
+    Frame_Output_Init();
+
+#ifdef GRAPHICS_USE_SDL_RENDERER
+    Frame_Pipeline_Init(Present_Frame, NULL, 2);
+#else
+    Bind_Window_Surface();
+#endif
 
     /* Load a object */
     struct Mesh obj = Mesh_Load("../../res/Wooden Box/wooden crate.obj");
@@ -118,38 +120,59 @@ int main(int argc, char *argv[])
     Raster_View_Matrix(view, cam_position);
     Raster_Projection_Matrix(proj, IMAGE_W, IMAGE_H);
 
-    timer_t rasterizer_timer;
+    hp_timer_t rasterizer_timer;
     Timer_Start(&rasterizer_timer);
 
-    // Side quest to get vertex index data...
-    float *vertex_data = malloc(sizeof(float) * obj.attribute.num_faces * 5); // 3 for vert, 2 for tex
-    int   *index_data  = malloc(sizeof(int) * obj.attribute.num_faces);
-    for (size_t i = 0; i < obj.attribute.num_faces; i++)
-    {
-        tinyobj_vertex_index_t face = obj.attribute.faces[i];
-        index_data[i]               = (int)i; // NOTE : We are not setting unique indices
-
-        vertex_data[i * 5 + 0] = obj.attribute.vertices[face.v_idx * 3 + 0];
-        vertex_data[i * 5 + 1] = obj.attribute.vertices[face.v_idx * 3 + 1];
-        vertex_data[i * 5 + 2] = obj.attribute.vertices[face.v_idx * 3 + 2];
-        vertex_data[i * 5 + 3] = obj.attribute.texcoords[face.vt_idx * 2 + 0];
-        vertex_data[i * 5 + 4] = obj.attribute.texcoords[face.vt_idx * 2 + 1];
-    }
+    vec4 bounding_sphere;
+    Mesh_Bounding_Sphere(&obj, bounding_sphere);
 
-    /* Convert obj format to {posX, posY, posZ}{texU, texV} */
+    /* A draw per material, each with its own diffuse texture */
+    UniformData_t *uniform_data    = malloc(sizeof(UniformData_t) * obj.number_of_draw_ranges);
+    DrawCommand_t *draws           = malloc(sizeof(DrawCommand_t) * obj.number_of_draw_ranges);
+    size_t         number_of_draws = 0;
+    ASSERT(uniform_data && draws);
 
-    UniformData_t uniform_data = {0};
-    uniform_data.diffuse       = obj.diffuse_tex;
+    for (size_t i = 0; i < obj.number_of_draw_ranges; i++)
+    {
+        const MeshDrawRange_t *range = &obj.draw_ranges[i];
 
-    RenderState.vertex_shader_uniforms = (void *)&uniform_data;
+        if (range->diffuse_texture < 0 || obj.textures[range->diffuse_texture] == NULL ||
+            obj.textures[range->diffuse_texture]->data == NULL)
+        {
+            fprintf(stderr, "Skipping draw range %zu, it has no diffuse texture\n", i);
+            continue;
+        }
 
-    BindIndexBuffer(index_data, obj.attribute.num_faces);
-    BindVertexBuffer((void *)vertex_data, obj.attribute.num_faces * 5, 5);
+        UniformData_t *uniforms = &uniform_data[number_of_draws];
+        *uniforms               = (UniformData_t){0};
+        uniforms->diffuse       = obj.textures[range->diffuse_texture];
+
+        /* Buffers are in the format {posX, posY, posZ}{texU, texV} */
+        DrawCommand_t *draw          = &draws[number_of_draws++];
+        *draw                        = (DrawCommand_t){0};
+        draw->vertex_buffer          = obj.vertex_data;
+        draw->vertex_stride          = MESH_VERTEX_STRIDE;
+        draw->vertex_buffer_length   = obj.number_of_vertices * MESH_VERTEX_STRIDE;
+        draw->index_buffer           = obj.index_data;
+        draw->first_index            = range->first_index;
+        draw->number_of_indices      = range->number_of_indices;
+        draw->first_vertex           = range->first_vertex;
+        draw->number_of_vertices     = range->number_of_vertices;
+        draw->vertex_shader_uniforms = (void *)uniforms;
+        draw->sort_key               = (uint32_t)range->diffuse_texture;
+        draw->clusters               = (range->number_of_clusters) ? &obj.clusters[range->first_cluster] : NULL;
+        draw->number_of_clusters     = range->number_of_clusters;
+        glm_vec4_copy(bounding_sphere, draw->bounding_sphere);
+    }
 
     Render_Set_Viewport(IMAGE_W, IMAGE_H);
 
-    float fTheta              = 0.0f;
-    bool  render_depth_buffer = false;
+    float    fTheta              = 0.0f;
+    bool     render_depth_buffer = false;
+    bool     dump_frame          = false;
+    uint32_t dump_counter        = 0;
+
+    PipelineStatistics_t frame_statistics = {0};
 
     double   frame_accumulated_time = 0.0;
     uint32_t frame_counter          = 0;
@@ -157,6 +180,7 @@ int main(int argc, char *argv[])
     while (global_renderer.running)
     {
         SDL_Event event;
+        bool      window_changed = false;
         while (SDL_PollEvent(&event))
         {
             if ((SDL_QUIT == event.type) ||
@@ -170,8 +194,41 @@ int main(int argc, char *argv[])
                 render_depth_buffer = !render_depth_buffer;
                 break;
             }
+            if (SDL_KEYDOWN == event.type && SDL_SCANCODE_S == event.key.keysym.scancode)
+            {
+                Pipeline_Statistics_Print(&frame_statistics); // Of the last frame
+                break;
+            }
+            if (SDL_KEYDOWN == event.type && SDL_SCANCODE_T == event.key.keysym.scancode)
+            {
+                Trace_Write_Chrome_JSON("simderella_trace.json"); // The last few frames, between frames so no jobs are running
+                break;
+            }
+            if (SDL_KEYDOWN == event.type && SDL_SCANCODE_P == event.key.keysym.scancode)
+            {
+                dump_frame = true; // Written in the background once this frame is rastered
+                break;
+            }
+            if (SDL_WINDOWEVENT == event.type &&
+                (SDL_WINDOWEVENT_SIZE_CHANGED == event.window.event || SDL_WINDOWEVENT_DISPLAY_CHANGED == event.window.event))
+            {
+                window_changed = true; // The surface's size, format or pitch may be new
+                break;
+            }
         }
 
+#ifndef GRAPHICS_USE_SDL_RENDERER
+        /* Every frame, SDL can hand out a new surface without either event */
+        if (Renderer_Update_Surface(window_changed))
+            Bind_Window_Surface();
+#else
+        LOG_UNUSED(window_changed);
+#endif
+
+        TraceScope_t frame_trace = Trace_Begin("Frame");
+
+        Frame_Pipeline_Begin_Frame();
+
         fTheta += (float)Timer_Get_Elapsed_MS(&rasterizer_timer) / 32.0f;
 
         // Update the MVP matrix for the Vertex Shader
@@ -180,35 +237,54 @@ int main(int argc, char *argv[])
         dash_rotate(model, glm_rad(30.0f), (vec3){0.0f, 1.0f, 0.0f});
         // dash_rotate(model, glm_rad(fTheta), (vec3){0.0f, 1.0f, 0.0f});
 
-        dash_mat_mul_mat(view, model, uniform_data.MVP);
-        dash_mat_mul_mat(proj, uniform_data.MVP, uniform_data.MVP);
+        mat4x4 MVP;
+        dash_mat_mul_mat(view, model, MVP);
+        dash_mat_mul_mat(proj, MVP, MVP);
 
         /* Update Scene here */
-        Setup_Triangles_For_MT();
-        Raster_Triangles_MT();
+        Render_Begin_Draws();
+        for (size_t i = 0; i < number_of_draws; i++)
+        {
+            dash_mat_copy(MVP, ((UniformData_t *)draws[i].vertex_shader_uniforms)->MVP);
+            dash_mat_copy(MVP, draws[i].object_to_clip_matrix);
+            Render_Set_Camera_Position(&draws[i], model, cam_position);
+            Render_Draw(&draws[i]);
+        }
 
-        // Update the pixels of the surface with the color buffer data
-        ASSERT(global_renderer.screen_num_pixels == IMAGE_W * IMAGE_H * IMAGE_BPP);
+        Setup_Triangles_For_MT();
 
-        if (render_depth_buffer) /* Draw Depth buffer */
+        if (render_depth_buffer) /* Draw Depth buffer, over the colour buffer once the frame is rastered */
+        {
+            Raster_Triangles_MT();
             Convert_Depth_Buffer_For_Drawing();
+        }
+        else
+            Raster_Triangles_Submit();
 
-/* Draw Colour buffer */
-#ifdef GRAPHICS_USE_SDL_RENDERER
-        SDL_UpdateTexture(global_renderer.texture, NULL, RenderState.colour_buffer, IMAGE_W * IMAGE_BPP);
-        SDL_RenderCopy(global_renderer.renderer, global_renderer.texture, NULL, NULL);
-        SDL_RenderPresent(global_renderer.renderer);
-#else
-        memcpy_s(global_renderer.pixels, global_renderer.screen_num_pixels, RenderState.colour_buffer, IMAGE_W * IMAGE_H * IMAGE_BPP);
-        SDL_UpdateWindowSurface(global_renderer.window);
-#endif
+        Frame_Pipeline_End_Frame(); // Presents the previous frame while this one rasters
+        Pipeline_Statistics_Collect(&frame_statistics);
+
+        /* Until the next Frame_Pipeline_Begin_Frame RenderState still holds this frame */
+        if (dump_frame)
+        {
+            char file_path[FRAME_OUTPUT_PATH_SIZE];
+            snprintf(file_path, sizeof(file_path), "simderella_frame_%04u.png", dump_counter);
+            Frame_Output_Submit(file_path, FRAME_OUTPUT_PNG, false);
+            snprintf(file_path, sizeof(file_path), "simderella_frame_%04u_depth.exr", dump_counter);
+            Frame_Output_Submit(file_path, FRAME_OUTPUT_EXR_DEPTH, false);
+
+            dump_counter++;
+            dump_frame = false;
+        }
+
+        Trace_End(&frame_trace);
 
         Timer_Update(&rasterizer_timer);
 
         if (frame_counter >= 120)
         {
             char buff[16] = {0};
-            sprintf_s(buff, 16, "%fms", frame_accumulated_time / frame_counter);
+            snprintf(buff, sizeof(buff), "%fms", frame_accumulated_time / frame_counter);
             Renderer_Set_Title(buff);
 
             frame_counter          = 0;
@@ -221,11 +297,12 @@ int main(int argc, char *argv[])
         }
     }
 
-    free(index_data);
-    free(vertex_data);
-
+    free(draws);
+    free(uniform_data);
     Mesh_Destroy(&obj);
+    Frame_Pipeline_Shutdown();
     Renderer_Destroy();
+    Frame_Output_Shutdown();
     jobs_shutdown();
 
     printf("EXIT_SUCCESS\n");
@@ -5,9 +5,16 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 
-#include <windows.h>
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <errno.h>
+    #include <pthread.h>
+    #include <semaphore.h>
+#endif
 
 /*
 
@@ -120,8 +127,10 @@ typedef struct
     size_t volatile number_of_jobs;          /* count of jobs in the job queue. */
     size_t volatile number_of_jobs_complete; /* count of completed jobs. */
 
-    size_t        number_of_threads;    /* number of worker threads in the job system. */
-    thread_info_t info[NUM_OF_THREADS]; /* array to store thread information. */
+    size_t        number_of_threads;       /* number of worker threads in the job system. */
+    thread_info_t info[NUM_OF_THREADS];    /* array to store thread information. */
+    void         *threads[NUM_OF_THREADS]; /* handles of the worker threads, joined by jobs_shutdown. */
+    volatile bool shutting_down;           /* set by jobs_shutdown, the workers return when they see it. */
 } job_system_t;
 
 extern job_system_t *JOB_STATE;
@@ -142,6 +151,21 @@ extern int32_t Platform_InterlockedIncrement(int32_t *addend);
 extern int32_t Platform_InterlockedDecrement(int32_t *addend);
 extern void    Platform_CloseHandle(void *handle);
 extern void   *Platform_create_semaphore(size_t initial_count, size_t maximum_count);
+extern bool    Platform_Try_Wait(void *semaphore); // Takes the semaphore only if it can without waiting
+extern void    Platform_Memory_Barrier(void);
+
+// Dedicated threads. Platform_Join_Thread waits for the thread and releases its handle
+
+#if defined(_WIN32)
+typedef DWORD(WINAPI *PlatformThreadProc_t)(LPVOID);
+    #define PLATFORM_THREAD_PROC(name) DWORD WINAPI name(LPVOID parameter)
+#else
+typedef void *(*PlatformThreadProc_t)(void *);
+    #define PLATFORM_THREAD_PROC(name) void *name(void *parameter)
+#endif
+
+extern void *Platform_Create_Thread(PlatformThreadProc_t proc, void *parameter);
+extern void  Platform_Join_Thread(void *thread);
 
 // Job system implementation
 
@@ -187,11 +211,11 @@ static bool _Do_Work_Queue_Entry(int worker_thread_id)
     return false; // Dont sleep the thread
 }
 
-static DWORD WINAPI WorkerThread(LPVOID lpParam)
+static PLATFORM_THREAD_PROC(WorkerThread)
 {
-    thread_info_t *thread_info = (thread_info_t *)(lpParam);
+    thread_info_t *thread_info = (thread_info_t *)(parameter);
 
-    while (true)
+    while (!JOB_STATE->shutting_down)
     {
         if (_Do_Work_Queue_Entry(thread_info->logical_thread_index))
         {
@@ -255,8 +279,8 @@ void jobs_init(void)
     JOB_STATE->number_of_threads = NUM_OF_THREADS;
 
     // Initialize job semaphore with a count of 0, indicating no jobs are pending
-    const LONG thread_count  = (LONG)NUM_OF_THREADS;
-    const LONG initial_count = 0;
+    const size_t thread_count  = NUM_OF_THREADS;
+    const size_t initial_count = 0;
 
     JOB_STATE->job_semaphore = Platform_create_semaphore(initial_count, thread_count);
 
@@ -269,9 +293,8 @@ void jobs_init(void)
         thread_info_t *thread_info        = JOB_STATE->info + thread_index;
         thread_info->logical_thread_index = thread_index;
 
-        LPDWORD thread_id     = NULL;
-        HANDLE  thread_handle = CreateThread(0, 0, WorkerThread, (void *)(thread_info), 0, thread_id);
-        Platform_CloseHandle(thread_handle);
+        JOB_STATE->threads[thread_index] = Platform_Create_Thread(WorkerThread, (void *)(thread_info));
+        assert(JOB_STATE->threads[thread_index]);
     }
 }
 
@@ -288,12 +311,20 @@ void jobs_shutdown(void)
            JOB_STATE->number_of_jobs,
            JOB_STATE->number_of_jobs_complete);
     #endif
-    // Release all worker threads
-    for (int i = 0; i < JOB_STATE->number_of_threads; i++)
+    // Release all worker threads, and wait for them to return before the state they read is freed
+    JOB_STATE->shutting_down = true;
+    Platform_Memory_Barrier();
+
+    for (size_t i = 0; i < JOB_STATE->number_of_threads; i++)
     {
         Platform_ReleaseSemaphore(JOB_STATE->job_semaphore);
     }
 
+    for (size_t i = 0; i < JOB_STATE->number_of_threads; i++)
+    {
+        Platform_Join_Thread(JOB_STATE->threads[i]);
+    }
+
     // Clean up the job queue, semaphore, and mutex
     memset(JOB_STATE->job_queue.jobs, 0, sizeof(job_t) * MAX_NUMBER_OF_JOBS);
 
@@ -356,87 +387,119 @@ bool job_submit(job_t job)
 
     JOB_STATE->number_of_jobs++;
 
-    MemoryBarrier();
+    Platform_Memory_Barrier();
 
     //_WriteBarrier();
     //_mm_sfence(); // insure that you have a store barrier
 
     queue->write_index = next_entry_to_write;
 
-    ReleaseSemaphore(JOB_STATE->job_semaphore, 1, 0);
+    Platform_ReleaseSemaphore(JOB_STATE->job_semaphore);
 
     return true;
 }
 
-    // Linux version using GCC built-in function
-    #if defined(__GNUC__)
-        #include <semaphore.h>
+    #if defined(__unix__) // Not macOS, it has no unnamed semaphores
 
 job_system_t *JOB_STATE = NULL;
 
-static inline int Platform_ReleaseSemaphore(sem_t *semaphore)
+/*
+POSIX versions of the platform layer
+    - Semaphores are unnamed sem_t on the heap, the maximum count is not enforced. They are the only handles
+        Platform_CloseHandle is given here, threads are released with Platform_Join_Thread
+    - Threads are pthread_t on the heap, so they fit the same void * as a Windows HANDLE
+    - The atomics are the GCC/Clang __sync builtins, full barriers like their Interlocked counterparts
+*/
+
+inline int Platform_ReleaseSemaphore(void *semaphore)
 {
+    const int result = sem_post((sem_t *)semaphore);
         #ifdef DEBUG
-    int err = sem_post(sem);
-    if (err == -1)
-    {
-        char errorMsg[1024];
-        strerror_r(errno, errorMsg, sizeof(errorMsg));
-        printf("sem_post failed with error: %s\n", errorMsg);
-    }
-        #else
-    return sem_post(semaphore);
+    if (result == -1)
+        perror("sem_post");
         #endif
+    // Nonzero on success, like ReleaseSemaphore
+    return result == 0;
 }
 
-static inline int Platform_WaitForSingleObject(sem_t *semaphore)
+inline int Platform_WaitForSingleObject(void *semaphore)
 {
-        #ifdef DEBUG
-    int err = sem_wait(sem);
-    if (err == -1)
+    int result;
+    do
     {
-        char errorMsg[1024];
-        strerror_r(errno, errorMsg, sizeof(errorMsg));
-        printf("sem_wait failed with error: %s\n", errorMsg);
-    }
-        #else
-    return sem_wait(semaphore);
+        result = sem_wait((sem_t *)semaphore);
+    } while (result == -1 && errno == EINTR);
+        #ifdef DEBUG
+    if (result == -1)
+        perror("sem_wait");
         #endif
+    return result;
 }
 
-static inline int32_t Platform_InterlockedCompareExchange(int32_t *dest, int32_t exchange, int32_t compare)
+inline int32_t Platform_InterlockedCompareExchange(int32_t *dest, int32_t exchange, int32_t compare)
 {
+    assert(dest);
     return __sync_val_compare_and_swap(dest, compare, exchange);
 }
 
-static inline int32_t Platform_InterlockedIncrement(int32_t *addend)
+inline int32_t Platform_InterlockedIncrement(int32_t *addend)
 {
+    assert(addend);
     return __sync_add_and_fetch(addend, 1);
 }
 
-static inline int32_t Platform_InterlockedDecrement(int32_t *addend)
+inline int32_t Platform_InterlockedDecrement(int32_t *addend)
 {
+    assert(addend);
     return __sync_sub_and_fetch(addend, 1);
 }
 
-sem_t *Platform_create_semaphore(unsigned int initial_value, unsigned int maximum_value, const char *name, int flags, mode_t mode)
+inline void Platform_CloseHandle(void *handle)
+{
+    assert(handle);
+    sem_destroy((sem_t *)handle);
+    free(handle);
+}
+
+inline void *Platform_create_semaphore(size_t initial_count, size_t maximum_count)
 {
-    sem_t *semaphore = sem_open(name, flags, mode, initial_value);
-    if (semaphore == SEM_FAILED)
+    (void)maximum_count;
+
+    sem_t *semaphore = malloc(sizeof(sem_t));
+    if (semaphore && sem_init(semaphore, 0, (unsigned int)initial_count) != 0)
     {
+        free(semaphore);
         return NULL;
     }
+    return semaphore;
+}
 
-    // Set the maximum value of the semaphore
-    int set_value_result = sem_setvalue(semaphore, maximum_value);
-    if (set_value_result == -1)
+inline bool Platform_Try_Wait(void *semaphore)
+{
+    return sem_trywait((sem_t *)semaphore) == 0;
+}
+
+inline void Platform_Memory_Barrier(void)
+{
+    __sync_synchronize();
+}
+
+inline void *Platform_Create_Thread(PlatformThreadProc_t proc, void *parameter)
+{
+    pthread_t *thread = malloc(sizeof(pthread_t));
+    if (thread && pthread_create(thread, NULL, proc, parameter) != 0)
     {
-        sem_close(semaphore);
-        sem_unlink(name);
+        free(thread);
         return NULL;
     }
+    return thread;
+}
 
-    return semaphore;
+inline void Platform_Join_Thread(void *thread)
+{
+    assert(thread);
+    pthread_join(*(pthread_t *)thread, NULL);
+    free(thread);
 }
 
     #elif defined(_WIN32)
@@ -630,6 +693,50 @@ inline void *Platform_create_semaphore(size_t initial_count, size_t maximum_coun
     return CreateSemaphoreEx(0, (LONG)initial_count, (LONG)maximum_count, 0, 0, SEMAPHORE_ALL_ACCESS);
 }
 
+/**
+ * Takes the semaphore if its count is above zero, without waiting.
+ *
+ * @param semaphore A handle to the semaphore object.
+ *
+ * @return true if the count was taken, false if it was zero.
+ */
+inline bool Platform_Try_Wait(void *semaphore)
+{
+    return WaitForSingleObject((HANDLE)semaphore, 0) == WAIT_OBJECT_0;
+}
+
+/**
+ * Starts a thread running proc(parameter).
+ *
+ * @return A handle to the thread, NULL if it could not be created.
+ *
+ * @warning The caller has to release the handle with Platform_Join_Thread.
+ */
+inline void *Platform_Create_Thread(PlatformThreadProc_t proc, void *parameter)
+{
+    return CreateThread(0, 0, proc, parameter, 0, NULL);
+}
+
+/**
+ * Waits for the thread to return and closes its handle.
+ *
+ * @param thread A handle from Platform_Create_Thread.
+ */
+inline void Platform_Join_Thread(void *thread)
+{
+    assert(thread);
+    WaitForSingleObject((HANDLE)thread, INFINITE);
+    CloseHandle((HANDLE)thread);
+}
+
+/**
+ * Full memory barrier, stores before it are visible to other threads before stores after it.
+ */
+inline void Platform_Memory_Barrier(void)
+{
+    MemoryBarrier();
+}
+
     #else
         #error Certain functions are not supported on this platform
     #endif
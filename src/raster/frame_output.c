@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "frame_output.h"
+#include "image_write.h"
+#include "renderer.h"
+#include "job_system/js.h"
+#include "utils/trace.h"
+#include "utils/utils.h"
+
+/*
+One producer, the render loop, and one consumer, the writer thread
+    - 'free_buffers' counts the buffers the render loop can take, 'queued_frames' the ones waiting to be written
+    - Buffers are taken and given back in the same order, so the queue index is also the buffer index
+    - Colour and depth are both 4 bytes a pixel, every buffer can hold either
+*/
+
+typedef struct
+{
+    FrameOutputFormat_t  format;
+    RenderColourFormat_t colour_format; /* Of the colour buffer when it was copied */
+    char                 file_path[FRAME_OUTPUT_PATH_SIZE];
+    uint8_t             *pixels;
+} FrameOutputEntry_t;
+
+static struct
+{
+    FrameOutputEntry_t entries[FRAME_OUTPUT_POOL_SIZE];
+    size_t             write_index; /* Only the render loop touches it */
+    size_t             read_index;  /* Only the writer thread touches it */
+
+    void *free_buffers;
+    void *queued_frames;
+    void *thread;
+
+    uint8_t      *rgb; /* Writer thread scratch for the colour formats */
+    volatile bool quit;
+    bool          initialised;
+
+    size_t dropped_frames;
+} Frame_Output;
+
+static void Write_Entry(FrameOutputEntry_t *entry)
+{
+    TraceScope_t trace = Trace_Begin("Frame_Output_Write");
+
+    switch (entry->format)
+    {
+    case FRAME_OUTPUT_PNG:
+        Image_Swizzle_To_RGB(entry->pixels, Frame_Output.rgb, IMAGE_W * IMAGE_H, Render_Colour_Format_Offsets[entry->colour_format]);
+        Image_Write_PNG(entry->file_path, IMAGE_W, IMAGE_H, 3, Frame_Output.rgb);
+        break;
+    case FRAME_OUTPUT_PPM:
+        Image_Swizzle_To_RGB(entry->pixels, Frame_Output.rgb, IMAGE_W * IMAGE_H, Render_Colour_Format_Offsets[entry->colour_format]);
+        Image_Write_PPM(entry->file_path, IMAGE_W, IMAGE_H, Frame_Output.rgb);
+        break;
+    case FRAME_OUTPUT_EXR_DEPTH:
+        Image_Write_EXR_Depth(entry->file_path, IMAGE_W, IMAGE_H, (const float *)entry->pixels);
+        break;
+    default:
+        ASSERT(false && "Unknown frame output format");
+        break;
+    }
+
+    Trace_End(&trace);
+}
+
+static PLATFORM_THREAD_PROC(Frame_Output_Thread)
+{
+    LOG_UNUSED(parameter);
+    Trace_Set_Thread_Name("frame_output");
+
+    for (;;)
+    {
+        Platform_WaitForSingleObject(Frame_Output.queued_frames);
+
+        /* Shutdown flushes first, nothing is queued by the time this is set */
+        if (Frame_Output.quit)
+            break;
+
+        Write_Entry(&Frame_Output.entries[Frame_Output.read_index]);
+        Frame_Output.read_index = (Frame_Output.read_index + 1) % FRAME_OUTPUT_POOL_SIZE;
+
+        Platform_ReleaseSemaphore(Frame_Output.free_buffers);
+    }
+
+    return 0;
+}
+
+void Frame_Output_Init(void)
+{
+    if (Frame_Output.initialised)
+        return;
+
+    for (size_t i = 0; i < FRAME_OUTPUT_POOL_SIZE; i++)
+    {
+        Frame_Output.entries[i].pixels = _mm_malloc(IMAGE_W * IMAGE_H * 4, 64);
+        ASSERT(Frame_Output.entries[i].pixels);
+    }
+
+    Frame_Output.rgb = malloc(IMAGE_W * IMAGE_H * 3);
+    ASSERT(Frame_Output.rgb);
+
+    Frame_Output.write_index    = 0;
+    Frame_Output.read_index     = 0;
+    Frame_Output.quit           = false;
+    Frame_Output.dropped_frames = 0;
+
+    Frame_Output.free_buffers  = Platform_create_semaphore(FRAME_OUTPUT_POOL_SIZE, FRAME_OUTPUT_POOL_SIZE);
+    Frame_Output.queued_frames = Platform_create_semaphore(0, FRAME_OUTPUT_POOL_SIZE + 1); /* +1 for the quit signal */
+
+    Frame_Output.thread = Platform_Create_Thread(Frame_Output_Thread, NULL);
+    ASSERT(Frame_Output.thread);
+
+    Frame_Output.initialised = true;
+}
+
+bool Frame_Output_Submit_Colour(const char *file_path, const FrameOutputFormat_t format, const uint8_t *colour_buffer, const bool wait_for_buffer)
+{
+    ASSERT(Frame_Output.initialised);
+
+    if (wait_for_buffer)
+    {
+        Platform_WaitForSingleObject(Frame_Output.free_buffers);
+    }
+    else if (!Platform_Try_Wait(Frame_Output.free_buffers))
+    {
+        Frame_Output.dropped_frames++;
+        return false;
+    }
+
+    TraceScope_t trace = Trace_Begin("Frame_Output_Submit");
+
+    FrameOutputEntry_t *entry = &Frame_Output.entries[Frame_Output.write_index];
+    entry->format             = format;
+    entry->colour_format      = RenderState.colour_format;
+    snprintf(entry->file_path, sizeof(entry->file_path), "%s", file_path);
+
+    if (format == FRAME_OUTPUT_EXR_DEPTH)
+        memcpy(entry->pixels, RenderState.depth_buffer, sizeof(float) * IMAGE_W * IMAGE_H);
+    else
+        memcpy(entry->pixels, colour_buffer, IMAGE_W * IMAGE_H * IMAGE_BPP);
+
+    Frame_Output.write_index = (Frame_Output.write_index + 1) % FRAME_OUTPUT_POOL_SIZE;
+
+    /* The semaphore release is the barrier, the entry is written before the writer thread can see it */
+    Platform_ReleaseSemaphore(Frame_Output.queued_frames);
+
+    Trace_End(&trace);
+    return true;
+}
+
+bool Frame_Output_Submit(const char *file_path, const FrameOutputFormat_t format, const bool wait_for_buffer)
+{
+    return Frame_Output_Submit_Colour(file_path, format, RenderState.colour_buffer, wait_for_buffer);
+}
+
+void Frame_Output_Flush(void)
+{
+    if (!Frame_Output.initialised)
+        return;
+
+    /* Every buffer free means nothing is left to write */
+    for (size_t i = 0; i < FRAME_OUTPUT_POOL_SIZE; i++)
+        Platform_WaitForSingleObject(Frame_Output.free_buffers);
+
+    for (size_t i = 0; i < FRAME_OUTPUT_POOL_SIZE; i++)
+        Platform_ReleaseSemaphore(Frame_Output.free_buffers);
+}
+
+void Frame_Output_Shutdown(void)
+{
+    if (!Frame_Output.initialised)
+        return;
+
+    Frame_Output_Flush();
+
+    Frame_Output.quit = true;
+    Platform_ReleaseSemaphore(Frame_Output.queued_frames);
+    Platform_Join_Thread(Frame_Output.thread);
+
+    Platform_CloseHandle(Frame_Output.free_buffers);
+    Platform_CloseHandle(Frame_Output.queued_frames);
+
+    for (size_t i = 0; i < FRAME_OUTPUT_POOL_SIZE; i++)
+        _mm_free(Frame_Output.entries[i].pixels);
+    free(Frame_Output.rgb);
+
+    if (Frame_Output.dropped_frames)
+        fprintf(stderr, "Frame output dropped %zu frames, every buffer was still being written\n", Frame_Output.dropped_frames);
+
+    Frame_Output.initialised = false;
+}
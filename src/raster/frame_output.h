@@ -0,0 +1,51 @@
+#ifndef __FRAME_OUTPUT_H__
+#define __FRAME_OUTPUT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Getting finished frames out to disk without holding up the render loop
+    - Frame_Output_Submit copies the colour or depth buffer into a free buffer of the pool and queues it,
+        that copy is all the render loop pays for, the encoding and writing happen on the writer thread
+    - The pool holds FRAME_OUTPUT_POOL_SIZE frames, buffers are allocated once in Frame_Output_Init
+    - When every buffer is waiting to be written the submit either waits for one, for batch renders that
+        need every frame, or drops the frame and returns false, for interactive use
+    - Frames are written in the order they were submitted
+
+Example:
+
+    Frame_Output_Init();
+    ... render ...
+    Frame_Output_Submit("frame_0001.png", FRAME_OUTPUT_PNG, true);
+    Frame_Output_Submit("frame_0001.exr", FRAME_OUTPUT_EXR_DEPTH, true);
+    ...
+    Frame_Output_Shutdown(); // Writes whatever is still queued
+*/
+
+#define FRAME_OUTPUT_POOL_SIZE 4
+#define FRAME_OUTPUT_PATH_SIZE 1024
+
+typedef enum
+{
+    FRAME_OUTPUT_PNG = 0,   /* Colour buffer */
+    FRAME_OUTPUT_PPM,       /* Colour buffer */
+    FRAME_OUTPUT_EXR_DEPTH, /* Depth buffer, as floats */
+} FrameOutputFormat_t;
+
+void Frame_Output_Init(void);
+void Frame_Output_Shutdown(void);
+
+/* Queues the current contents of RenderState, call it once the raster stage is done */
+bool Frame_Output_Submit(const char *file_path, FrameOutputFormat_t format, bool wait_for_buffer);
+
+/*
+The same with 'colour_buffer' in place of RenderState's, for a Frame_Pipeline present
+    - Depth still comes from RenderState, which during a present already belongs to the frame being rastered
+*/
+bool Frame_Output_Submit_Colour(const char *file_path, FrameOutputFormat_t format, const uint8_t *colour_buffer, bool wait_for_buffer);
+
+/* Waits until every queued frame is on disk */
+void Frame_Output_Flush(void);
+
+#endif // __FRAME_OUTPUT_H__
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_pipeline.h"
+#include "renderer.h"
+#include "job_system/js.h"
+#include "utils/trace.h"
+#include "utils/utils.h"
+
+/*
+Everything happens on the thread that drives the job system, the workers only ever see the raster jobs
+    - Frames [present_frame, next_frame) are finished or being rastered and not yet presented
+    - Frames are presented in order, so frame N always uses colour target N % RENDER_TARGET_COUNT. At most
+        max_frames_in_flight <= RENDER_TARGET_COUNT are in use and they are the latest ones, the target frame N
+        gets was last used by a frame that has been presented
+    - With a direct target every frame is rendered into that one buffer, so the frame has to be presented before
+        the next one can start, there is only ever one in flight
+*/
+
+static struct
+{
+    FramePresentFn_t present;
+    void            *user_data;
+    uint32_t         max_frames_in_flight;
+    uint8_t         *direct_target; /* NULL unless made with Frame_Pipeline_Init_Direct */
+    FrameTargetFn_t  target;        /* NULL unless set with Frame_Pipeline_Set_Target */
+
+    uint8_t *frame_targets[RENDER_TARGET_COUNT]; /* Of frame N at N % RENDER_TARGET_COUNT, from when it begins */
+
+    uint64_t next_frame;
+    uint64_t present_frame;
+
+    bool initialised;
+} Frame_Pipeline;
+
+static uint8_t *Frame_Target(const uint64_t frame)
+{
+    return Frame_Pipeline.frame_targets[frame % RENDER_TARGET_COUNT];
+}
+
+static void Present(const uint64_t frame)
+{
+    TraceScope_t trace = Trace_Begin("Present");
+    Frame_Pipeline.present(Frame_Target(frame), frame, Frame_Pipeline.user_data);
+    Trace_End(&trace);
+}
+
+/* Frames that are finished or being rastered but not presented */
+static uint64_t Frames_In_Flight(void)
+{
+    return Frame_Pipeline.next_frame - Frame_Pipeline.present_frame;
+}
+
+void Frame_Pipeline_Init(FramePresentFn_t present, void *user_data, uint32_t max_frames_in_flight)
+{
+    ASSERT(present);
+    if (Frame_Pipeline.initialised)
+        Frame_Pipeline_Shutdown();
+
+    if (max_frames_in_flight < 1)
+        max_frames_in_flight = 1;
+    if (max_frames_in_flight > RENDER_TARGET_COUNT)
+        max_frames_in_flight = RENDER_TARGET_COUNT;
+
+    Frame_Pipeline.present              = present;
+    Frame_Pipeline.user_data            = user_data;
+    Frame_Pipeline.max_frames_in_flight = max_frames_in_flight;
+    Frame_Pipeline.direct_target        = NULL;
+    Frame_Pipeline.target               = NULL;
+    Frame_Pipeline.next_frame           = 0;
+    Frame_Pipeline.present_frame        = 0;
+    Frame_Pipeline.initialised          = true;
+}
+
+void Frame_Pipeline_Init_Direct(FramePresentFn_t present, void *user_data, uint8_t *target)
+{
+    ASSERT(target);
+    Frame_Pipeline_Init(present, user_data, 1);
+    Frame_Pipeline.direct_target = target;
+}
+
+void Frame_Pipeline_Set_Target(FrameTargetFn_t target)
+{
+    ASSERT(Frame_Pipeline.initialised && Frame_Pipeline.direct_target == NULL);
+    Frame_Pipeline.target = target;
+}
+
+void Frame_Pipeline_Begin_Frame(void)
+{
+    if (!Frame_Pipeline.initialised)
+        return;
+
+    ASSERT(Frames_In_Flight() < Frame_Pipeline.max_frames_in_flight);
+
+    const uint64_t frame  = Frame_Pipeline.next_frame;
+    uint8_t       *target = Frame_Pipeline.direct_target;
+    if (target == NULL && Frame_Pipeline.target)
+        target = Frame_Pipeline.target(frame, Frame_Pipeline.user_data);
+    if (target == NULL)
+        target = Render_Get_Colour_Target((size_t)(frame % RENDER_TARGET_COUNT));
+
+    Frame_Pipeline.frame_targets[frame % RENDER_TARGET_COUNT] = target;
+    Render_Set_Colour_Buffer(target);
+}
+
+void Frame_Pipeline_End_Frame(void)
+{
+    if (!Frame_Pipeline.initialised)
+        return;
+
+    const uint64_t frame = Frame_Pipeline.next_frame++;
+
+    /* The older frames go out while the workers raster this one, then there is room for the next */
+    while (Frame_Pipeline.present_frame < frame && Frames_In_Flight() >= Frame_Pipeline.max_frames_in_flight)
+        Present(Frame_Pipeline.present_frame++);
+
+    TraceScope_t trace = Trace_Begin("Wait Frame");
+    jobs_complete_all_work();
+    Trace_End(&trace);
+
+    /* Only with one frame in flight, this one is presented as soon as it is done */
+    while (Frames_In_Flight() >= Frame_Pipeline.max_frames_in_flight)
+        Present(Frame_Pipeline.present_frame++);
+}
+
+void Frame_Pipeline_Flush(void)
+{
+    if (!Frame_Pipeline.initialised)
+        return;
+
+    jobs_complete_all_work();
+    while (Frame_Pipeline.present_frame < Frame_Pipeline.next_frame)
+        Present(Frame_Pipeline.present_frame++);
+}
+
+void Frame_Pipeline_Shutdown(void)
+{
+    if (!Frame_Pipeline.initialised)
+        return;
+
+    Frame_Pipeline_Flush();
+
+    Render_Set_Colour_Target(0);
+    Frame_Pipeline.direct_target = NULL;
+    Frame_Pipeline.initialised   = false;
+}
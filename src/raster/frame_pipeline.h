@@ -0,0 +1,57 @@
+#ifndef __FRAME_PIPELINE_H__
+#define __FRAME_PIPELINE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Presenting frame N while frame N + 1 is rastered
+    - Every frame renders into the next colour target. Frame_Pipeline_End_Frame calls 'present' for the finished
+        frames on the calling thread while the workers raster the frame that was just submitted with
+        Raster_Triangles_Submit, then waits for it. 'present' can call anything tied to that thread, like SDL's
+        window and surface functions, and the job system
+    - max_frames_in_flight bounds the latency, the frame being rastered plus those waiting to be presented
+        - 1, no overlap, the frame is presented as soon as it is rastered
+        - 2, double buffered, the previous frame is presented while this one rasters
+        - 3 (RENDER_TARGET_COUNT), the frame before that is presented instead, a frame more of latency for
+            the callers that want one more frame to look back at
+    - 'present' can only read the colour buffer it is given, the depth buffer and RenderState belong to the frame
+        being rastered. Between Frame_Pipeline_End_Frame and the next Frame_Pipeline_Begin_Frame both are still the
+        last frame's, Frame_Output_Submit and friends can read them there
+    - Frame_Pipeline_Init_Direct renders every frame straight into 'target' instead, memory that is presented as
+        it is, like a window surface the renderer can draw in. Nothing is copied, at the cost of any overlap
+    - Frame_Pipeline_Set_Target lets every frame pick where it is rendered when it begins, like a shared memory
+        slot of Frame_Stream. The buffer has to stay put until the frame is presented, NULL uses the colour target
+    - Raster_Triangles_MT works too, the frame is rastered before Frame_Pipeline_End_Frame and nothing overlaps
+
+Example:
+
+    Frame_Pipeline_Init(Present_Frame, NULL, 2);
+
+    while (running)
+    {
+        Frame_Pipeline_Begin_Frame();
+        ... record, Setup_Triangles_For_MT(), Raster_Triangles_Submit() ...
+        Frame_Pipeline_End_Frame(); // Presents the previous frame, then waits for this one
+    }
+
+    Frame_Pipeline_Shutdown(); // Presents whatever is still waiting
+*/
+
+typedef void (*FramePresentFn_t)(const uint8_t *colour_buffer, uint64_t frame_index, void *user_data);
+typedef uint8_t *(*FrameTargetFn_t)(uint64_t frame_index, void *user_data);
+
+void Frame_Pipeline_Init(FramePresentFn_t present, void *user_data, uint32_t max_frames_in_flight);
+void Frame_Pipeline_Init_Direct(FramePresentFn_t present, void *user_data, uint8_t *target);
+void Frame_Pipeline_Shutdown(void);
+
+/* After Frame_Pipeline_Init, with the same user_data as 'present' */
+void Frame_Pipeline_Set_Target(FrameTargetFn_t target);
+
+void Frame_Pipeline_Begin_Frame(void);
+void Frame_Pipeline_End_Frame(void);
+
+/* Presents every finished frame, call it between frames */
+void Frame_Pipeline_Flush(void);
+
+#endif // __FRAME_PIPELINE_H__
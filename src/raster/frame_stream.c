@@ -0,0 +1,514 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <io.h>
+    #include <fcntl.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#include "frame_stream.h"
+#include "renderer.h"
+#include "job_system/js.h"
+#include "utils/trace.h"
+#include "utils/utils.h"
+
+#define FRAME_STREAM_NAME_SIZE          256
+#define FRAME_STREAM_ROW_PAIRS_PER_ITEM 8 /* Work item of the YUV conversion, 2 rows of luma and 1 of each chroma plane each */
+
+static struct
+{
+    FrameStreamDesc_t desc;
+    char              name[FRAME_STREAM_NAME_SIZE];
+
+    FILE    *file;
+    uint8_t *scratch; /* Pipes only, YUV or swizzled BGRA has to land somewhere before it is written */
+
+    FrameStreamRing_t *ring;
+    size_t             ring_size;
+#if defined(_WIN32)
+    HANDLE mapping;
+#endif
+
+    uint64_t sequence;      /* Of the last frame written */
+    uint64_t slot_sequence; /* Of the last slot handed out by Frame_Stream_Slot */
+    bool     open;
+} Frame_Stream;
+
+/*
+Conversions of the colour buffer, in whatever byte order RenderState.colour_format says it is
+    - YUV weighs each byte of a pixel by the weight of the channel in it, so every order costs the same
+    - BGRA is one shuffle, only done when the colour buffer is not BGRA already
+*/
+typedef struct
+{
+    const uint8_t *colour;
+    uint8_t       *y_plane;
+    uint8_t       *u_plane;
+    uint8_t       *v_plane;
+    uint8_t       *bgra;
+
+    int16_t y_weights[8]; /* For the bytes of 2 pixels */
+    int16_t u_weights[8];
+    int16_t v_weights[8];
+    uint8_t swizzle[16]; /* 4 pixels of the colour buffer to BGRA */
+
+    int32_t next_item;
+    size_t  number_of_items;
+} StreamConvertData_t;
+
+uint64_t Frame_Stream_Frame_Size(const FrameStreamFormat_t format)
+{
+    return (format == FRAME_STREAM_YUV420) ? (uint64_t)IMAGE_W * IMAGE_H * 3 / 2 : (uint64_t)IMAGE_W * IMAGE_H * 4;
+}
+
+/* 8 pixels widened to 16 bits, 2 pixels a vector. Y = ((66R + 129G + 25B + 128) >> 8) + 16 */
+static inline __m128i Luma_8(const __m128i pixels[4], const __m128i coefficients)
+{
+    /* madd leaves {B + G, R + A} for each pixel, hadd finishes the sum */
+    const __m128i y0 = _mm_hadd_epi32(_mm_madd_epi16(pixels[0], coefficients), _mm_madd_epi16(pixels[1], coefficients));
+    const __m128i y1 = _mm_hadd_epi32(_mm_madd_epi16(pixels[2], coefficients), _mm_madd_epi16(pixels[3], coefficients));
+
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i y     = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(y0, round), 8), _mm_srai_epi32(_mm_add_epi32(y1, round), 8));
+    return _mm_packus_epi16(_mm_add_epi16(y, _mm_set1_epi16(16)), _mm_setzero_si128());
+}
+
+/* 4 chroma values from the sums of 2x2 blocks, 2 blocks a vector, the shift also divides by the 4 pixels */
+static inline int32_t Chroma_4(const __m128i blocks01, const __m128i blocks23, const __m128i coefficients)
+{
+    const __m128i sum    = _mm_hadd_epi32(_mm_madd_epi16(blocks01, coefficients), _mm_madd_epi16(blocks23, coefficients));
+    const __m128i scaled = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(512)), 10);
+    const __m128i packed = _mm_add_epi16(_mm_packs_epi32(scaled, scaled), _mm_set1_epi16(128));
+    return _mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+}
+
+static void Convert_Row_Pair(const StreamConvertData_t *cd, const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    /* U = ((-38R - 74G + 112B + 128) >> 8) + 128, V = ((112R - 94G - 18B + 128) >> 8) + 128 */
+    const __m128i y_coefficients = _mm_loadu_si128((const __m128i *)cd->y_weights);
+    const __m128i u_coefficients = _mm_loadu_si128((const __m128i *)cd->u_weights);
+    const __m128i v_coefficients = _mm_loadu_si128((const __m128i *)cd->v_weights);
+    const __m128i zero           = _mm_setzero_si128();
+
+    for (size_t x = 0; x < IMAGE_W; x += 8)
+    {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + x * 4));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(row0 + x * 4 + 16));
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(row1 + x * 4));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + x * 4 + 16));
+
+        const __m128i top[4]    = {_mm_unpacklo_epi8(a0, zero), _mm_unpackhi_epi8(a0, zero), _mm_unpacklo_epi8(a1, zero), _mm_unpackhi_epi8(a1, zero)};
+        const __m128i bottom[4] = {_mm_unpacklo_epi8(b0, zero), _mm_unpackhi_epi8(b0, zero), _mm_unpacklo_epi8(b1, zero), _mm_unpackhi_epi8(b1, zero)};
+
+        _mm_storel_epi64((__m128i *)(y0 + x), Luma_8(top, y_coefficients));
+        _mm_storel_epi64((__m128i *)(y1 + x), Luma_8(bottom, y_coefficients));
+
+        /* Each vector holds 2 columns, adding the rows and then the 2 pixels leaves one 2x2 block in the low half */
+        __m128i blocks[4];
+        for (int i = 0; i < 4; i++)
+        {
+            const __m128i columns = _mm_add_epi16(top[i], bottom[i]);
+            blocks[i]             = _mm_add_epi16(columns, _mm_srli_si128(columns, 8));
+        }
+
+        const __m128i blocks01 = _mm_unpacklo_epi64(blocks[0], blocks[1]);
+        const __m128i blocks23 = _mm_unpacklo_epi64(blocks[2], blocks[3]);
+
+        const int32_t u4 = Chroma_4(blocks01, blocks23, u_coefficients);
+        const int32_t v4 = Chroma_4(blocks01, blocks23, v_coefficients);
+        memcpy(u + x / 2, &u4, 4);
+        memcpy(v + x / 2, &v4, 4);
+    }
+}
+
+static void Convert_To_YUV420(void *arguments)
+{
+    StreamConvertData_t *cd = (StreamConvertData_t *)arguments;
+
+    TraceScope_t trace = Trace_Begin("Convert_To_YUV420");
+
+    size_t item;
+    while (Render_Next_Work_Item(&cd->next_item, cd->number_of_items, &item))
+    {
+        const size_t first_pair = item * FRAME_STREAM_ROW_PAIRS_PER_ITEM;
+        const size_t last_pair  = (first_pair + FRAME_STREAM_ROW_PAIRS_PER_ITEM < IMAGE_H / 2) ? first_pair + FRAME_STREAM_ROW_PAIRS_PER_ITEM : IMAGE_H / 2;
+
+        for (size_t pair = first_pair; pair < last_pair; pair++)
+        {
+            const uint8_t *row0 = cd->colour + pair * 2 * IMAGE_W * 4;
+
+            Convert_Row_Pair(cd, row0, row0 + IMAGE_W * 4,
+                             cd->y_plane + pair * 2 * IMAGE_W, cd->y_plane + (pair * 2 + 1) * IMAGE_W,
+                             cd->u_plane + pair * (IMAGE_W / 2), cd->v_plane + pair * (IMAGE_W / 2));
+        }
+    }
+
+    Trace_End(&trace);
+}
+
+static void Convert_To_BGRA(void *arguments)
+{
+    StreamConvertData_t *cd = (StreamConvertData_t *)arguments;
+
+    TraceScope_t trace = Trace_Begin("Convert_To_BGRA");
+
+    const __m128i swizzle = _mm_loadu_si128((const __m128i *)cd->swizzle);
+
+    size_t item;
+    while (Render_Next_Work_Item(&cd->next_item, cd->number_of_items, &item))
+    {
+        const size_t first_row = item * FRAME_STREAM_ROW_PAIRS_PER_ITEM * 2;
+        const size_t last_row  = (first_row + FRAME_STREAM_ROW_PAIRS_PER_ITEM * 2 < IMAGE_H) ? first_row + FRAME_STREAM_ROW_PAIRS_PER_ITEM * 2 : IMAGE_H;
+
+        for (size_t i = first_row * IMAGE_W * 4; i < last_row * IMAGE_W * 4; i += 16)
+        {
+            const __m128i pixels = _mm_loadu_si128((const __m128i *)(cd->colour + i));
+            _mm_storeu_si128((__m128i *)(cd->bgra + i), _mm_shuffle_epi8(pixels, swizzle));
+        }
+    }
+
+    Trace_End(&trace);
+}
+
+/* Weights of 'r', 'g' and 'b' at the bytes those channels are in, for 2 pixels */
+static void Set_Channel_Weights(int16_t weights[8], const uint8_t offsets[4], const int16_t r, const int16_t g, const int16_t b)
+{
+    for (int pixel = 0; pixel < 2; pixel++)
+    {
+        weights[pixel * 4 + offsets[0]] = r;
+        weights[pixel * 4 + offsets[1]] = g;
+        weights[pixel * 4 + offsets[2]] = b;
+        weights[pixel * 4 + offsets[3]] = 0;
+    }
+}
+
+/* FRAME_STREAM_YUV420 is I420 into 'dest', the Y plane then U then V. FRAME_STREAM_BGRA swizzles into 'dest' */
+static void Convert_Colour_Buffer(const uint8_t *colour_buffer, uint8_t *dest, const FrameStreamFormat_t format)
+{
+    const uint8_t *offsets = Render_Colour_Format_Offsets[RenderState.colour_format];
+
+    static StreamConvertData_t cd = {0};
+    cd.colour                     = colour_buffer;
+    cd.next_item                  = 0;
+    cd.number_of_items            = (IMAGE_H / 2 + FRAME_STREAM_ROW_PAIRS_PER_ITEM - 1) / FRAME_STREAM_ROW_PAIRS_PER_ITEM;
+
+    job_t job = {Convert_To_YUV420, (void *)&cd};
+    if (format == FRAME_STREAM_YUV420)
+    {
+        cd.y_plane = dest;
+        cd.u_plane = dest + IMAGE_W * IMAGE_H;
+        cd.v_plane = cd.u_plane + (IMAGE_W / 2) * (IMAGE_H / 2);
+
+        Set_Channel_Weights(cd.y_weights, offsets, 66, 129, 25);
+        Set_Channel_Weights(cd.u_weights, offsets, -38, -74, 112);
+        Set_Channel_Weights(cd.v_weights, offsets, 112, -94, -18);
+    }
+    else
+    {
+        cd.bgra = dest;
+
+        /* B, G, R and A of each output pixel come from the bytes the colour buffer keeps them in */
+        for (int pixel = 0; pixel < 4; pixel++)
+        {
+            cd.swizzle[pixel * 4 + 0] = (uint8_t)(pixel * 4 + offsets[2]);
+            cd.swizzle[pixel * 4 + 1] = (uint8_t)(pixel * 4 + offsets[1]);
+            cd.swizzle[pixel * 4 + 2] = (uint8_t)(pixel * 4 + offsets[0]);
+            cd.swizzle[pixel * 4 + 3] = (uint8_t)(pixel * 4 + offsets[3]);
+        }
+        job.function = Convert_To_BGRA;
+    }
+
+    const size_t number_of_jobs = (cd.number_of_items < RENDER_JOBS_PER_STAGE) ? cd.number_of_items : RENDER_JOBS_PER_STAGE;
+    for (size_t i = 0; i < number_of_jobs; i++)
+        job_submit(job);
+
+    jobs_complete_all_work();
+}
+
+static FrameStreamHeader_t Make_Header(const uint64_t sequence)
+{
+    FrameStreamHeader_t header = {0};
+    header.magic               = FRAME_STREAM_MAGIC;
+    header.format              = (uint32_t)Frame_Stream.desc.format;
+    header.width               = IMAGE_W;
+    header.height              = IMAGE_H;
+    header.sequence            = sequence;
+    header.size                = Frame_Stream_Frame_Size(Frame_Stream.desc.format);
+    return header;
+}
+
+/* Log lines go to stderr from here on, the real stdout only carries frames */
+static FILE *Open_Stdout(void)
+{
+    fflush(stdout);
+
+#if defined(_WIN32)
+    const int fd = _dup(_fileno(stdout));
+    if (fd == -1 || _dup2(_fileno(stderr), _fileno(stdout)) == -1)
+        return NULL;
+
+    _setmode(fd, _O_BINARY);
+    return _fdopen(fd, "wb");
+#else
+    const int fd = dup(fileno(stdout));
+    if (fd == -1 || dup2(fileno(stderr), fileno(stdout)) == -1)
+        return NULL;
+
+    return fdopen(fd, "wb");
+#endif
+}
+
+static bool Open_Shared_Memory(void)
+{
+    const uint32_t number_of_slots = (Frame_Stream.desc.number_of_slots) ? Frame_Stream.desc.number_of_slots : FRAME_STREAM_DEFAULT_SLOTS;
+    const uint64_t slot_size       = (sizeof(FrameStreamHeader_t) + Frame_Stream_Frame_Size(Frame_Stream.desc.format) + 63) & ~(uint64_t)63;
+
+    Frame_Stream.ring_size = sizeof(FrameStreamRing_t) + (size_t)(slot_size * number_of_slots);
+
+#if defined(_WIN32)
+    Frame_Stream.mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                              (DWORD)((uint64_t)Frame_Stream.ring_size >> 32), (DWORD)Frame_Stream.ring_size, Frame_Stream.name);
+    if (Frame_Stream.mapping == NULL)
+        return false;
+
+    Frame_Stream.ring = MapViewOfFile(Frame_Stream.mapping, FILE_MAP_ALL_ACCESS, 0, 0, Frame_Stream.ring_size);
+    if (Frame_Stream.ring == NULL)
+    {
+        CloseHandle(Frame_Stream.mapping);
+        return false;
+    }
+#else
+    const int fd = shm_open(Frame_Stream.name, O_CREAT | O_RDWR, 0600);
+    if (fd == -1)
+        return false;
+
+    if (ftruncate(fd, (off_t)Frame_Stream.ring_size) != 0)
+    {
+        close(fd);
+        shm_unlink(Frame_Stream.name);
+        return false;
+    }
+
+    void *data = mmap(NULL, Frame_Stream.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps its own reference
+    if (data == MAP_FAILED)
+    {
+        shm_unlink(Frame_Stream.name);
+        return false;
+    }
+    Frame_Stream.ring = (FrameStreamRing_t *)data;
+#endif
+
+    FrameStreamRing_t *ring = Frame_Stream.ring;
+    memset(ring, 0, sizeof(FrameStreamRing_t));
+    ring->version         = FRAME_STREAM_VERSION;
+    ring->format          = (uint32_t)Frame_Stream.desc.format;
+    ring->width           = IMAGE_W;
+    ring->height          = IMAGE_H;
+    ring->number_of_slots = number_of_slots;
+    ring->slot_size       = slot_size;
+
+    /* Last, a reader that finds the magic finds everything else filled in */
+    _mm_sfence();
+    ring->magic = FRAME_STREAM_MAGIC;
+    return true;
+}
+
+bool Frame_Stream_Open(const FrameStreamDesc_t *desc)
+{
+    ASSERT(desc);
+    if (Frame_Stream.open)
+        Frame_Stream_Close();
+
+    Frame_Stream.desc          = *desc;
+    Frame_Stream.sequence      = 0;
+    Frame_Stream.slot_sequence = 0;
+    Frame_Stream.name[0]  = '\0';
+
+    if (desc->name)
+    {
+#if defined(_WIN32)
+        snprintf(Frame_Stream.name, sizeof(Frame_Stream.name), "%s", desc->name);
+#else
+        /* POSIX shared memory names start with a slash */
+        const bool add_slash = desc->target == FRAME_STREAM_SHARED_MEMORY && desc->name[0] != '/';
+        snprintf(Frame_Stream.name, sizeof(Frame_Stream.name), "%s%s", (add_slash) ? "/" : "", desc->name);
+#endif
+    }
+    Frame_Stream.desc.name = Frame_Stream.name;
+
+    bool opened = false;
+    switch (desc->target)
+    {
+    case FRAME_STREAM_STDOUT:
+        Frame_Stream.file = Open_Stdout();
+        opened            = Frame_Stream.file != NULL;
+        break;
+    case FRAME_STREAM_FILE:
+        Frame_Stream.file = fopen(Frame_Stream.name, "wb"); /* Opening a FIFO waits here for the reader */
+        opened            = Frame_Stream.file != NULL;
+        break;
+    case FRAME_STREAM_SHARED_MEMORY:
+        opened = Open_Shared_Memory();
+        break;
+    default:
+        break;
+    }
+
+    if (!opened)
+    {
+        perror((desc->target == FRAME_STREAM_STDOUT) ? "stdout" : Frame_Stream.name);
+        return false;
+    }
+
+    if (Frame_Stream.file)
+    {
+        /* Whole frames go straight to the OS, nothing is gained by staging them in stdio's buffer */
+        setvbuf(Frame_Stream.file, NULL, _IONBF, 0);
+
+        Frame_Stream.scratch = _mm_malloc((size_t)Frame_Stream_Frame_Size(desc->format), 64);
+        ASSERT(Frame_Stream.scratch);
+    }
+
+    Frame_Stream.open = true;
+    return true;
+}
+
+static FrameStreamHeader_t *Ring_Slot(const uint64_t sequence)
+{
+    FrameStreamRing_t *ring = Frame_Stream.ring;
+    return (FrameStreamHeader_t *)((uint8_t *)ring + sizeof(FrameStreamRing_t) + (size_t)(ring->slot_size * ((sequence - 1) % ring->number_of_slots)));
+}
+
+/* Readers still copying the frame that was here see the sequence change and drop it */
+static void Begin_Slot(FrameStreamHeader_t *header)
+{
+    ((volatile FrameStreamHeader_t *)header)->sequence = 0;
+    _mm_sfence();
+}
+
+uint8_t *Frame_Stream_Slot(void)
+{
+    if (!Frame_Stream.open || Frame_Stream.ring == NULL)
+        return NULL;
+
+    if (Frame_Stream.slot_sequence < Frame_Stream.sequence)
+        Frame_Stream.slot_sequence = Frame_Stream.sequence;
+
+    /* Taken by a frame every time, so the slots stay in step with the writes even when this one is copied */
+    const uint64_t sequence = ++Frame_Stream.slot_sequence;
+
+    if (Frame_Stream.desc.format != FRAME_STREAM_BGRA || RenderState.colour_format != RENDER_FORMAT_BGRA)
+        return NULL;
+
+    /* The slot still belongs to a frame that has been handed it and not written yet */
+    if (sequence - Frame_Stream.sequence > Frame_Stream.ring->number_of_slots)
+        return NULL;
+
+    FrameStreamHeader_t *header = Ring_Slot(sequence);
+    Begin_Slot(header);
+    return (uint8_t *)header + sizeof(FrameStreamHeader_t);
+}
+
+static bool Write_To_Ring(const uint8_t *colour_buffer, const uint64_t sequence)
+{
+    FrameStreamRing_t *ring = Frame_Stream.ring;
+
+    FrameStreamHeader_t *header = Ring_Slot(sequence);
+    uint8_t             *pixels = (uint8_t *)header + sizeof(FrameStreamHeader_t);
+
+    /* Rastered in place, the slot was taken from the readers when Frame_Stream_Slot handed it out */
+    if (colour_buffer != pixels)
+    {
+        Begin_Slot(header);
+
+        if (Frame_Stream.desc.format == FRAME_STREAM_BGRA && RenderState.colour_format == RENDER_FORMAT_BGRA)
+            memcpy(pixels, colour_buffer, (size_t)Frame_Stream_Frame_Size(FRAME_STREAM_BGRA));
+        else
+            Convert_Colour_Buffer(colour_buffer, pixels, Frame_Stream.desc.format);
+    }
+
+    FrameStreamHeader_t new_header = Make_Header(sequence);
+    new_header.sequence            = 0;
+    memcpy(header, &new_header, sizeof(FrameStreamHeader_t));
+
+    _mm_sfence();
+    ((volatile FrameStreamHeader_t *)header)->sequence = sequence;
+    ring->latest_sequence                              = sequence;
+    return true;
+}
+
+static bool Write_To_File(const uint8_t *colour_buffer, const uint64_t sequence)
+{
+    const uint64_t size = Frame_Stream_Frame_Size(Frame_Stream.desc.format);
+
+    if (Frame_Stream.desc.write_headers)
+    {
+        const FrameStreamHeader_t header = Make_Header(sequence);
+        if (fwrite(&header, sizeof(header), 1, Frame_Stream.file) != 1)
+            return false;
+    }
+
+    const uint8_t *pixels = colour_buffer;
+    if (Frame_Stream.desc.format == FRAME_STREAM_YUV420 || RenderState.colour_format != RENDER_FORMAT_BGRA)
+    {
+        Convert_Colour_Buffer(colour_buffer, Frame_Stream.scratch, Frame_Stream.desc.format);
+        pixels = Frame_Stream.scratch;
+    }
+
+    return fwrite(pixels, 1, (size_t)size, Frame_Stream.file) == (size_t)size;
+}
+
+bool Frame_Stream_Write(const uint8_t *colour_buffer)
+{
+    ASSERT(colour_buffer);
+    if (!Frame_Stream.open)
+        return false;
+
+    TraceScope_t trace = Trace_Begin("Frame_Stream_Write");
+
+    const uint64_t sequence = ++Frame_Stream.sequence;
+    const bool     written  = (Frame_Stream.ring) ? Write_To_Ring(colour_buffer, sequence) : Write_To_File(colour_buffer, sequence);
+
+    Trace_End(&trace);
+
+    /* Most likely the reader went away, stop rather than fail every frame */
+    if (!written)
+    {
+        fprintf(stderr, "Frame stream write failed at frame %llu, closing it\n", (unsigned long long)sequence);
+        Frame_Stream_Close();
+    }
+    return written;
+}
+
+void Frame_Stream_Close(void)
+{
+    if (Frame_Stream.file)
+        fclose(Frame_Stream.file);
+
+    if (Frame_Stream.ring)
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(Frame_Stream.ring);
+        CloseHandle(Frame_Stream.mapping);
+#else
+        munmap(Frame_Stream.ring, Frame_Stream.ring_size);
+        shm_unlink(Frame_Stream.name); // Readers that have it mapped keep it until they unmap
+#endif
+    }
+
+    if (Frame_Stream.scratch)
+        _mm_free(Frame_Stream.scratch);
+
+    Frame_Stream.file    = NULL;
+    Frame_Stream.ring    = NULL;
+    Frame_Stream.scratch = NULL;
+    Frame_Stream.open    = false;
+}
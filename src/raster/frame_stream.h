@@ -0,0 +1,103 @@
+#ifndef __FRAME_STREAM_H__
+#define __FRAME_STREAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Raw frame streaming, for piping rendered sequences into a video encoder
+    - Every finished frame goes out as raw BGRA or planar YUV 4:2:0 (I420, BT.601 limited range), converted with
+        SIMD on the job system from whatever byte order the colour buffer is in
+    - Targets
+        - stdout, the process' own output is moved to stderr so log lines do not end up in the video
+        - a file path, a FIFO (mkfifo) or a named pipe (\\.\pipe\name) the encoder reads from
+        - shared memory, a ring of frame slots the reader maps by name (shm_open, or a named file mapping on Windows)
+    - Pipes get the bare frames by default, what 'ffmpeg -f rawvideo' expects. With write_headers every frame
+        starts with a FrameStreamHeader_t carrying its sequence number
+    - BGRA to a pipe is written straight from a BGRA colour buffer. For shared memory the conversions write into
+        the slot, and a BGRA colour buffer is copied into it unless the frame was rastered there, see Frame_Stream_Slot
+    - Only from the thread that drives the job system, the main thread. The conversions are jobs and
+        Frame_Stream_Write waits for them with jobs_complete_all_work, which also waits for anything else queued
+
+    ffmpeg -f rawvideo -pix_fmt bgra -s 1024x512 -r 60 -i - out.mp4
+    ffmpeg -f rawvideo -pix_fmt yuv420p -s 1024x512 -r 60 -i - out.mp4
+*/
+
+#define FRAME_STREAM_MAGIC         0x46524453u /* "SDRF" */
+#define FRAME_STREAM_VERSION       1
+#define FRAME_STREAM_DEFAULT_SLOTS 4
+
+typedef enum
+{
+    FRAME_STREAM_BGRA = 0,
+    FRAME_STREAM_YUV420,
+} FrameStreamFormat_t;
+
+typedef enum
+{
+    FRAME_STREAM_STDOUT = 0,
+    FRAME_STREAM_FILE,
+    FRAME_STREAM_SHARED_MEMORY,
+} FrameStreamTarget_t;
+
+typedef struct
+{
+    FrameStreamTarget_t target;
+    FrameStreamFormat_t format;
+    const char         *name;            /* Path of the file or FIFO, name of the shared memory */
+    uint32_t            number_of_slots; /* Shared memory only, 0 for FRAME_STREAM_DEFAULT_SLOTS */
+    bool                write_headers;   /* Pipes only, shared memory slots always have one */
+} FrameStreamDesc_t;
+
+/* In front of each frame, 64 bytes so the pixels that follow stay aligned */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint64_t sequence; /* Starts at 1, a reader that sees a gap has missed frames */
+    uint64_t size;     /* Bytes of pixels after the header */
+    uint8_t  reserved[32];
+} FrameStreamHeader_t;
+
+/*
+Start of the shared memory, followed by the slots, each a FrameStreamHeader_t and then the pixels
+    - Frame 'sequence' goes in slot (sequence - 1) % number_of_slots
+    - The writer zeroes the slot's sequence, writes the pixels and then the sequence, then latest_sequence.
+        A reader copies a slot and checks its sequence is the one it expected before and after the copy,
+        a different value means the writer lapped it and the copy is torn
+*/
+typedef struct
+{
+    uint32_t          magic;
+    uint32_t          version;
+    uint32_t          format;
+    uint32_t          width;
+    uint32_t          height;
+    uint32_t          number_of_slots;
+    uint64_t          slot_size; /* Header and pixels, a multiple of 64 */
+    volatile uint64_t latest_sequence;
+    uint8_t           reserved[24];
+} FrameStreamRing_t;
+
+bool Frame_Stream_Open(const FrameStreamDesc_t *desc);
+void Frame_Stream_Close(void);
+
+/* Sends 'colour_buffer', in RenderState.colour_format, once the raster stage is done with it. Uses the job system for YUV */
+bool Frame_Stream_Write(const uint8_t *colour_buffer);
+
+/*
+The pixels of the shared memory slot the frame will be written into, to rasterize it there so nothing is copied
+    - Call it once for every frame Frame_Stream_Write will send, before the frame is rastered, and write the
+        frames in the same order. Frame_Pipeline_Set_Target fits, frames are presented in the order they begin
+    - Readers skip the slot from here until it is written
+    - NULL when the frame has to be rastered somewhere else and copied: not shared memory, not BGRA on both sides,
+        or the slot is still held by a frame that has not been written, when there are fewer slots than frames in flight
+*/
+uint8_t *Frame_Stream_Slot(void);
+
+/* Bytes of pixels in one frame */
+uint64_t Frame_Stream_Frame_Size(FrameStreamFormat_t format);
+
+#endif // __FRAME_STREAM_H__
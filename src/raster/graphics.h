@@ -8,6 +8,7 @@
 
 #include "SDL2/SDL.h"
 #include "utils/timer.h"
+#include "renderer.h"
 
 typedef struct Renderer_s
 {
@@ -31,6 +32,38 @@ typedef struct Renderer_s
 
 extern Renderer global_renderer;
 
+#ifndef GRAPHICS_USE_SDL_RENDERER
+/*
+Picks up the window surface again, true when it is not the one global_renderer had
+    - SDL frees the window surface and makes a new one when the window changes size or display, anything that
+        still points at the old pixels has to be pointed at the new ones
+    - 'force' takes the surface as new even if SDL handed back the same pointers, for the window events that can
+        change its format or pitch in place
+*/
+static bool Renderer_Update_Surface(const bool force)
+{
+    SDL_Surface *window_surface = SDL_GetWindowSurface(global_renderer.window);
+    if (window_surface == NULL)
+    {
+        fprintf(stderr, "SDL_GetWindowSurface Error: %s\n", SDL_GetError());
+        return false;
+    }
+
+    if (!force && window_surface == global_renderer.surface && window_surface->pixels == global_renderer.pixels)
+        return false;
+
+    global_renderer.surface = window_surface;
+    global_renderer.fmt     = window_surface->format;
+    global_renderer.pixels  = (uint8_t *)window_surface->pixels;
+    global_renderer.height  = window_surface->h;
+    global_renderer.width   = window_surface->w;
+
+    // https://stackoverflow.com/questions/20070155/how-to-set-a-pixel-in-a-sdl-surface
+    global_renderer.screen_num_pixels = window_surface->h * window_surface->w * window_surface->format->BytesPerPixel;
+    return true;
+}
+#endif
+
 static bool Reneder_Startup(const char *title, const int width, const int height)
 {
     memset((void *)&global_renderer, 0, sizeof(Renderer));
@@ -59,26 +92,17 @@ static bool Reneder_Startup(const char *title, const int width, const int height
     SDL_Renderer *renderer   = SDL_CreateRenderer(global_renderer.window, -1, 0);
     global_renderer.renderer = renderer;
 
-    SDL_Texture *texture    = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, width, height);
+    SDL_Texture *texture    = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, width, height); // RENDER_FORMAT_BGRA
     global_renderer.texture = texture;
 #else
-    SDL_Surface     *window_surface = SDL_GetWindowSurface(global_renderer.window);
-    global_renderer.surface         = window_surface;
-
-    global_renderer.fmt = window_surface->format;
+    if (!Renderer_Update_Surface(true))
+        return false;
 
+    SDL_Surface *window_surface = global_renderer.surface;
     printf("Window Surface\n\tPixel format : %s\n", SDL_GetPixelFormatName(global_renderer.surface->format->format));
     printf("\tBytesPP      : %d\n", global_renderer.fmt->BytesPerPixel);
     printf("\tBPP          : %d\n", global_renderer.fmt->BitsPerPixel);
     printf("\tPitch : %d\n", window_surface->pitch);
-
-    // global_renderer.pixels            = (uint8_t *)window_surface->pixels;
-    global_renderer.pixels = (uint8_t *)window_surface->pixels;
-    global_renderer.height = window_surface->h;
-    global_renderer.width  = window_surface->w;
-
-    // https://stackoverflow.com/questions/20070155/how-to-set-a-pixel-in-a-sdl-surface
-    global_renderer.screen_num_pixels = window_surface->h * window_surface->w * window_surface->format->BytesPerPixel;
 #endif
     global_renderer.running = true;
 
@@ -113,6 +137,76 @@ static void Renderer_Destroy(void)
     fprintf(stderr, "Renderer has been destroyed\n");
 }
 
+/*
+The renderer's byte order for a 4 byte SDL format, false when it is not one the raster kernels can write
+    - The packed formats are named high byte first, in memory they are the other way round on x86
+*/
+static bool Renderer_Colour_Format_From_SDL(const Uint32 sdl_format, RenderColourFormat_t *format)
+{
+    switch (sdl_format)
+    {
+    case SDL_PIXELFORMAT_ARGB8888:
+    case SDL_PIXELFORMAT_RGB888:
+        *format = RENDER_FORMAT_BGRA;
+        return true;
+    case SDL_PIXELFORMAT_ABGR8888:
+    case SDL_PIXELFORMAT_BGR888:
+        *format = RENDER_FORMAT_RGBA;
+        return true;
+    case SDL_PIXELFORMAT_BGRA8888:
+    case SDL_PIXELFORMAT_BGRX8888:
+        *format = RENDER_FORMAT_ARGB;
+        return true;
+    case SDL_PIXELFORMAT_RGBA8888:
+    case SDL_PIXELFORMAT_RGBX8888:
+        *format = RENDER_FORMAT_ABGR;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* The other way round, the SDL format a colour buffer of the renderer is in */
+static Uint32 Renderer_SDL_Format_From_Colour_Format(const RenderColourFormat_t format)
+{
+    switch (format)
+    {
+    case RENDER_FORMAT_RGBA:
+        return SDL_PIXELFORMAT_ABGR8888;
+    case RENDER_FORMAT_ARGB:
+        return SDL_PIXELFORMAT_BGRA8888;
+    case RENDER_FORMAT_ABGR:
+        return SDL_PIXELFORMAT_RGBA8888;
+    case RENDER_FORMAT_BGRA:
+    default:
+        return SDL_PIXELFORMAT_ARGB8888;
+    }
+}
+
+#ifndef GRAPHICS_USE_SDL_RENDERER
+/*
+The window surface's pixels, when the raster stage can draw straight into them
+    - The surface has to be width x height, in a byte order the renderer can write, with nothing between the rows
+        (pitch == width * 4) and not need locking
+    - NULL otherwise, the frame is rendered into a colour target and copied into the surface
+    - Only good until the surface changes, ask again whenever Renderer_Update_Surface says it has
+*/
+static uint8_t *Renderer_Direct_Surface(const int width, const int height, RenderColourFormat_t *format)
+{
+    SDL_Surface *surface = global_renderer.surface;
+    if (!surface || surface->w != width || surface->h != height || SDL_MUSTLOCK(surface))
+        return NULL;
+
+    if (surface->format->BytesPerPixel != 4 || surface->pitch != width * 4)
+        return NULL;
+
+    if (!Renderer_Colour_Format_From_SDL(surface->format->format, format))
+        return NULL;
+
+    return (uint8_t *)surface->pixels;
+}
+#endif
+
 static inline void Renderer_Present(void)
 {
     SDL_UpdateWindowSurface(global_renderer.window);
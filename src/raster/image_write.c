@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_write.h"
+#include "utils/utils.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+typedef struct
+{
+    uint8_t *data;
+    size_t   size;
+    size_t   capacity;
+} ImageBuffer_t;
+
+static bool Buffer_Reserve(ImageBuffer_t *buffer, const size_t bytes)
+{
+    if (buffer->size + bytes <= buffer->capacity)
+        return true;
+
+    size_t new_capacity = (buffer->capacity) ? buffer->capacity * 2 : 4096;
+    while (new_capacity < buffer->size + bytes)
+        new_capacity *= 2;
+
+    uint8_t *new_data = realloc(buffer->data, new_capacity);
+    if (new_data == NULL)
+        return false;
+
+    buffer->data     = new_data;
+    buffer->capacity = new_capacity;
+    return true;
+}
+
+static bool Buffer_Put_Bytes(ImageBuffer_t *buffer, const void *bytes, const size_t count)
+{
+    if (!Buffer_Reserve(buffer, count))
+        return false;
+
+    memcpy(buffer->data + buffer->size, bytes, count);
+    buffer->size += count;
+    return true;
+}
+
+bool Image_Write_PNG(const char *file_path, const int width, const int height, const int channels, const uint8_t *pixels)
+{
+    const bool written = stbi_write_png(file_path, width, height, channels, pixels, width * channels) != 0;
+    if (!written)
+        fprintf(stderr, "Cannot write PNG : %s\n", file_path);
+    return written;
+}
+
+bool Image_Write_PPM(const char *file_path, const int width, const int height, const uint8_t *rgb)
+{
+    FILE *fp = fopen(file_path, "wb");
+    if (fp == NULL)
+    {
+        perror(file_path);
+        return false;
+    }
+
+    const size_t size    = (size_t)width * (size_t)height * 3;
+    const bool   written = fprintf(fp, "P6\n%d %d\n255\n", width, height) > 0 && fwrite(rgb, 1, size, fp) == size;
+    fclose(fp);
+
+    if (!written)
+        fprintf(stderr, "Cannot write PPM : %s\n", file_path);
+    return written;
+}
+
+/* EXR is little endian, the same as the machines this runs on, so values are written as they are in memory */
+static void EXR_Put_Attribute(ImageBuffer_t *buffer, const char *name, const char *type, const void *value, const int32_t size)
+{
+    Buffer_Put_Bytes(buffer, name, strlen(name) + 1);
+    Buffer_Put_Bytes(buffer, type, strlen(type) + 1);
+    Buffer_Put_Bytes(buffer, &size, sizeof(size));
+    Buffer_Put_Bytes(buffer, value, (size_t)size);
+}
+
+/*
+Single part scanline file
+    - The header is a list of attributes ended by an empty name
+    - Then an offset from the start of the file to each chunk, one scanline per chunk without compression
+    - Each chunk is its y, its size in bytes, then the channels of the line one after the other
+*/
+bool Image_Write_EXR_Depth(const char *file_path, const int width, const int height, const float *depth)
+{
+    ImageBuffer_t header = {0};
+
+    const uint8_t magic_and_version[8] = {0x76, 0x2F, 0x31, 0x01, 2, 0, 0, 0};
+    Buffer_Put_Bytes(&header, magic_and_version, sizeof(magic_and_version));
+
+    /* "Z", FLOAT, not linear, 3 reserved bytes, x and y sampling of 1, then the end of the list */
+    const uint8_t channels[19] = {'Z', 0, 2, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0};
+    EXR_Put_Attribute(&header, "channels", "chlist", channels, sizeof(channels));
+
+    const uint8_t compression = 0; /* NO_COMPRESSION */
+    EXR_Put_Attribute(&header, "compression", "compression", &compression, 1);
+
+    const int32_t window[4] = {0, 0, width - 1, height - 1};
+    EXR_Put_Attribute(&header, "dataWindow", "box2i", window, sizeof(window));
+    EXR_Put_Attribute(&header, "displayWindow", "box2i", window, sizeof(window));
+
+    const uint8_t line_order = 0; /* INCREASING_Y */
+    EXR_Put_Attribute(&header, "lineOrder", "lineOrder", &line_order, 1);
+
+    const float one       = 1.0f;
+    const float centre[2] = {0.0f, 0.0f};
+    EXR_Put_Attribute(&header, "pixelAspectRatio", "float", &one, sizeof(one));
+    EXR_Put_Attribute(&header, "screenWindowCenter", "v2f", centre, sizeof(centre));
+    EXR_Put_Attribute(&header, "screenWindowWidth", "float", &one, sizeof(one));
+
+    const uint8_t end_of_header = 0;
+    const bool    ok            = Buffer_Put_Bytes(&header, &end_of_header, 1);
+
+    const size_t   line_size   = (size_t)width * sizeof(float);
+    const size_t   chunk_size  = sizeof(int32_t) * 2 + line_size;
+    const uint64_t first_chunk = (uint64_t)header.size + sizeof(uint64_t) * (uint64_t)height;
+
+    FILE *fp = (ok) ? fopen(file_path, "wb") : NULL;
+    if (fp == NULL)
+    {
+        if (ok)
+            perror(file_path);
+        free(header.data);
+        return false;
+    }
+
+    bool written = fwrite(header.data, 1, header.size, fp) == header.size;
+    free(header.data);
+
+    for (int y = 0; y < height && written; y++)
+    {
+        const uint64_t offset = first_chunk + chunk_size * (uint64_t)y;
+        written               = fwrite(&offset, sizeof(offset), 1, fp) == 1;
+    }
+
+    for (int y = 0; y < height && written; y++)
+    {
+        const int32_t line[2] = {y, (int32_t)line_size};
+        written               = fwrite(line, sizeof(line), 1, fp) == 1 &&
+                    fwrite(depth + (size_t)width * (size_t)y, 1, line_size, fp) == line_size;
+    }
+
+    fclose(fp);
+
+    if (!written)
+        fprintf(stderr, "Cannot write EXR : %s\n", file_path);
+    return written;
+}
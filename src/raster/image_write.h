@@ -0,0 +1,33 @@
+#ifndef __IMAGE_WRITE_H__
+#define __IMAGE_WRITE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Writing images out, every image has its rows top to bottom
+    - PNG is 8 bits per channel, 1 to 4 channels (grey, grey alpha, RGB, RGBA), written by stb_image_write
+    - PPM is binary RGB, no compression, about as fast to write as the disk allows
+    - EXR holds a single 32 bit float channel 'Z', uncompressed scanlines, for depth buffers
+*/
+
+bool Image_Write_PNG(const char *file_path, int width, int height, int channels, const uint8_t *pixels);
+bool Image_Write_PPM(const char *file_path, int width, int height, const uint8_t *rgb);
+bool Image_Write_EXR_Depth(const char *file_path, int width, int height, const float *depth);
+
+/*
+4 byte pixels to the RGB image files want, 'offsets' is the byte R, G and B are in, {2, 1, 0} for BGRA.
+Alpha is dropped, nothing is blended with it
+*/
+static inline void Image_Swizzle_To_RGB(const uint8_t *src, uint8_t *dest, const size_t number_of_pixels, const uint8_t offsets[3])
+{
+    for (size_t i = 0; i < number_of_pixels; i++)
+    {
+        dest[i * 3 + 0] = src[i * 4 + offsets[0]];
+        dest[i * 3 + 1] = src[i * 4 + offsets[1]];
+        dest[i * 3 + 2] = src[i * 4 + offsets[2]];
+    }
+}
+
+#endif // __IMAGE_WRITE_H__
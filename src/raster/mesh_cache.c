@@ -0,0 +1,240 @@
+#include "obj.h"
+
+#include <string.h>
+
+#include "utils/utils.h"
+
+/*
+Mesh cache file
+    - Written next to the .obj as "<file_name>.cache" after the first load
+    - On later loads the file is memory mapped and the vertex/index buffers are used
+        directly from the mapping, skipping tinyobj and all the buffer building
+    - The cache is thrown away when the version, or the size or modified time of the .obj changes
+
+Layout
+    MeshCacheHeader_t
+    vertex data   (aligned to MESH_CACHE_ALIGNMENT)
+    index data    (aligned to MESH_CACHE_ALIGNMENT)
+    clusters      (aligned to MESH_CACHE_ALIGNMENT)
+    draw ranges   (aligned to MESH_CACHE_ALIGNMENT)
+    texture names, null terminated one after the other, in the order of the mesh textures
+*/
+
+#define MESH_CACHE_MAGIC     0x43444D53 /* "SMDC" */
+#define MESH_CACHE_VERSION   6
+#define MESH_CACHE_ALIGNMENT 16
+#define MESH_CACHE_EXTENSION ".cache"
+
+/* How the cached buffers were processed, a cache made with different options is rebuilt */
+#define MESH_CACHE_FLAG_VERTEX_CACHE_OPTIMIZED (1u << 0)
+#define MESH_CACHE_FLAG_CLUSTERS               (1u << 1)
+
+#ifdef MESH_OPTIMIZE_VERTEX_CACHE
+    #define MESH_CACHE_FLAG_OPTIMIZE MESH_CACHE_FLAG_VERTEX_CACHE_OPTIMIZED
+#else
+    #define MESH_CACHE_FLAG_OPTIMIZE 0u
+#endif
+
+#ifdef MESH_BUILD_CLUSTERS
+    #define MESH_CACHE_FLAG_BUILD_CLUSTERS MESH_CACHE_FLAG_CLUSTERS
+#else
+    #define MESH_CACHE_FLAG_BUILD_CLUSTERS 0u
+#endif
+
+#define MESH_CACHE_FLAGS (MESH_CACHE_FLAG_OPTIMIZE | MESH_CACHE_FLAG_BUILD_CLUSTERS)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t reserved;
+
+    uint64_t source_size;
+    int64_t  source_modified_time;
+
+    uint32_t vertex_stride;
+    uint32_t number_of_triangles;
+    uint64_t number_of_vertices;
+    uint64_t number_of_indices;
+    uint64_t number_of_clusters;
+    uint64_t number_of_draw_ranges;
+    uint64_t number_of_textures;
+
+    uint64_t vertex_data_offset;
+    uint64_t index_data_offset;
+    uint64_t cluster_data_offset;
+    uint64_t draw_range_data_offset;
+    uint64_t texture_names_offset;
+} MeshCacheHeader_t;
+
+static inline uint64_t Align_Offset(const uint64_t offset)
+{
+    return (offset + (MESH_CACHE_ALIGNMENT - 1)) & ~(uint64_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static bool Make_Cache_File_Name(const char *obj_file_name, char *buffer, const size_t buffer_size)
+{
+    const int written = snprintf(buffer, buffer_size, "%s%s", obj_file_name, MESH_CACHE_EXTENSION);
+    return written > 0 && (size_t)written < buffer_size;
+}
+
+static bool Write_Padding(FILE *fp, const uint64_t from_offset, const uint64_t to_offset)
+{
+    static const uint8_t padding[MESH_CACHE_ALIGNMENT] = {0};
+
+    const size_t padding_size = (size_t)(to_offset - from_offset);
+    ASSERT(padding_size < MESH_CACHE_ALIGNMENT);
+
+    return fwrite(padding, 1, padding_size, fp) == padding_size;
+}
+
+bool Mesh_Cache_Load(const char *obj_file_name, struct Mesh *mesh)
+{
+    char cache_file_name[1024];
+    if (!Make_Cache_File_Name(obj_file_name, cache_file_name, sizeof(cache_file_name)))
+        return false;
+
+    uint64_t source_size          = 0;
+    int64_t  source_modified_time = 0;
+    if (!File_Get_Info(obj_file_name, &source_size, &source_modified_time))
+        return false;
+
+    file_map_t map;
+    if (!File_Map(cache_file_name, &map, FILE_MAP_ACCESS_WILL_NEED))
+        return false;
+
+    const MeshCacheHeader_t *header = (const MeshCacheHeader_t *)map.data;
+
+    const bool valid_header = map.size >= sizeof(MeshCacheHeader_t) &&
+                              header->magic == MESH_CACHE_MAGIC &&
+                              header->version == MESH_CACHE_VERSION &&
+                              header->flags == MESH_CACHE_FLAGS &&
+                              header->source_size == source_size &&
+                              header->source_modified_time == source_modified_time &&
+                              header->vertex_stride == MESH_VERTEX_STRIDE;
+
+    if (!valid_header ||
+        header->vertex_data_offset + header->number_of_vertices * MESH_VERTEX_STRIDE * sizeof(float) > map.size ||
+        header->index_data_offset + header->number_of_indices * sizeof(uint32_t) > map.size ||
+        header->cluster_data_offset + header->number_of_clusters * sizeof(MeshCluster_t) > map.size ||
+        header->draw_range_data_offset + header->number_of_draw_ranges * sizeof(MeshDrawRange_t) > map.size ||
+        header->texture_names_offset > map.size ||
+        (header->number_of_textures != 0 && ((const char *)map.data)[map.size - 1] != '\0'))
+    {
+        printf("Mesh cache is out of date : %s\n", cache_file_name);
+        File_Unmap(&map);
+        return false;
+    }
+
+    uint8_t *base = (uint8_t *)map.data;
+
+    *mesh                     = (struct Mesh){0};
+    mesh->number_of_triangles = header->number_of_triangles;
+    mesh->vertex_data         = (float *)(base + header->vertex_data_offset);
+    mesh->number_of_vertices  = (size_t)header->number_of_vertices;
+    mesh->index_data          = (uint32_t *)(base + header->index_data_offset);
+    mesh->number_of_indices   = (size_t)header->number_of_indices;
+    mesh->clusters            = (header->number_of_clusters) ? (MeshCluster_t *)(base + header->cluster_data_offset) : NULL;
+    mesh->number_of_clusters  = (size_t)header->number_of_clusters;
+
+    mesh->draw_ranges           = (MeshDrawRange_t *)(base + header->draw_range_data_offset);
+    mesh->number_of_draw_ranges = (size_t)header->number_of_draw_ranges;
+
+    /* The textures are not cached, only which files they came from */
+    const size_t number_of_textures = (size_t)header->number_of_textures;
+    const char **texture_names      = malloc(sizeof(const char *) * (number_of_textures + 1));
+    ASSERT(texture_names);
+
+    const char *texture_name = (const char *)(base + header->texture_names_offset);
+    for (size_t i = 0; i < number_of_textures; i++)
+    {
+        texture_names[i] = texture_name;
+        texture_name += strlen(texture_name) + 1;
+    }
+
+    Mesh_Load_Textures(mesh, obj_file_name, texture_names, number_of_textures);
+    free(texture_names);
+
+    mesh->cache_map = map;
+
+    printf("Loaded mesh from cache : %s\n", cache_file_name);
+    return true;
+}
+
+void Mesh_Cache_Write(const char *obj_file_name, const struct Mesh *mesh)
+{
+    ASSERT(mesh->vertex_data);
+    ASSERT(mesh->index_data);
+
+    char cache_file_name[1024];
+    if (!Make_Cache_File_Name(obj_file_name, cache_file_name, sizeof(cache_file_name)))
+        return;
+
+    MeshCacheHeader_t header = {0};
+    if (!File_Get_Info(obj_file_name, &header.source_size, &header.source_modified_time))
+        return;
+
+    const size_t vertex_data_size     = mesh->number_of_vertices * MESH_VERTEX_STRIDE * sizeof(float);
+    const size_t index_data_size      = mesh->number_of_indices * sizeof(uint32_t);
+    const size_t cluster_data_size    = mesh->number_of_clusters * sizeof(MeshCluster_t);
+    const size_t draw_range_data_size = mesh->number_of_draw_ranges * sizeof(MeshDrawRange_t);
+
+    header.magic               = MESH_CACHE_MAGIC;
+    header.version             = MESH_CACHE_VERSION;
+    header.flags               = MESH_CACHE_FLAGS;
+    header.vertex_stride       = MESH_VERTEX_STRIDE;
+    header.number_of_triangles = mesh->number_of_triangles;
+    header.number_of_vertices  = mesh->number_of_vertices;
+    header.number_of_indices   = mesh->number_of_indices;
+    header.number_of_clusters     = mesh->number_of_clusters;
+    header.number_of_draw_ranges  = mesh->number_of_draw_ranges;
+    header.number_of_textures     = mesh->number_of_textures;
+    header.vertex_data_offset     = Align_Offset(sizeof(MeshCacheHeader_t));
+    header.index_data_offset      = Align_Offset(header.vertex_data_offset + vertex_data_size);
+    header.cluster_data_offset    = Align_Offset(header.index_data_offset + index_data_size);
+    header.draw_range_data_offset = Align_Offset(header.cluster_data_offset + cluster_data_size);
+    header.texture_names_offset   = header.draw_range_data_offset + draw_range_data_size;
+
+    FILE *fp = fopen(cache_file_name, "wb");
+    if (!fp)
+    {
+        perror(cache_file_name);
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok      = ok && Write_Padding(fp, sizeof(header), header.vertex_data_offset);
+    ok      = ok && fwrite(mesh->vertex_data, 1, vertex_data_size, fp) == vertex_data_size;
+    ok      = ok && Write_Padding(fp, header.vertex_data_offset + vertex_data_size, header.index_data_offset);
+    ok      = ok && fwrite(mesh->index_data, 1, index_data_size, fp) == index_data_size;
+    ok      = ok && Write_Padding(fp, header.index_data_offset + index_data_size, header.cluster_data_offset);
+    ok      = ok && (cluster_data_size == 0 || fwrite(mesh->clusters, 1, cluster_data_size, fp) == cluster_data_size);
+    ok      = ok && Write_Padding(fp, header.cluster_data_offset + cluster_data_size, header.draw_range_data_offset);
+    ok      = ok && (draw_range_data_size == 0 || fwrite(mesh->draw_ranges, 1, draw_range_data_size, fp) == draw_range_data_size);
+
+    /* Name of each texture, from the material of the first range that uses it */
+    for (int32_t t = 0; t < (int32_t)mesh->number_of_textures; t++)
+    {
+        const char *name = NULL;
+        for (size_t r = 0; r < mesh->number_of_draw_ranges && name == NULL; r++)
+        {
+            if (mesh->draw_ranges[r].diffuse_texture == t)
+                name = mesh->materials[mesh->draw_ranges[r].material_id].diffuse_texname;
+        }
+        ASSERT(name);
+        ok = ok && fwrite(name, 1, strlen(name) + 1, fp) == strlen(name) + 1;
+    }
+
+    if (fclose(fp) != 0)
+        ok = false;
+
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to write mesh cache : %s\n", cache_file_name);
+        remove(cache_file_name);
+        return;
+    }
+
+    printf("Wrote mesh cache : %s\n", cache_file_name);
+}
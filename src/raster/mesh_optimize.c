@@ -0,0 +1,502 @@
+#include "renderer.h"
+#include "vertex_cache.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "utils/utils.h"
+
+/*
+Vertex cache optimisation of the index buffer, done once at load time
+    - Triangles are reordered with Tom Forsyth's "Linear-Speed Vertex Cache Optimisation",
+        each vertex is scored by its position in a simulated LRU cache and by how many triangles
+        still use it, the triangle with the highest score is emitted next
+    - Vertices are then reordered into the order they are first used, so the vertex buffer
+        is read front to back and nearby indices land in different slots of the direct mapped
+        cache in vertex_cache.h
+*/
+
+#define FORSYTH_CACHE_SIZE          32
+#define FORSYTH_CACHE_DECAY_POWER   1.5f
+#define FORSYTH_LAST_TRIANGLE_SCORE 0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE 2.0f
+#define FORSYTH_VALENCE_BOOST_POWER 0.5f
+
+static float Forsyth_Vertex_Score(const int cache_position, const uint32_t remaining_triangles)
+{
+    if (remaining_triangles == 0)
+        return -1.0f; // Not used by any triangle left to emit
+
+    float score = 0.0f;
+    if (cache_position >= 0)
+    {
+        if (cache_position < 3)
+        {
+            // Used by the last triangle, fixed score so the next triangle does not just reuse the same edge
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        }
+        else
+        {
+            const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score              = powf(1.0f - (float)(cache_position - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+
+    // Boost vertices with few triangles left, so they get finished off instead of left behind
+    score += FORSYTH_VALENCE_BOOST_SCALE * powf((float)remaining_triangles, -FORSYTH_VALENCE_BOOST_POWER);
+    return score;
+}
+
+float Mesh_Compute_ACMR(const uint32_t *indices, const size_t number_of_indices)
+{
+    if (number_of_indices < 3)
+        return 0.0f;
+
+    // Same direct mapped cache as VertCache_t in vertex_cache.h
+    uint32_t cache[VERTEX_CACHE_SIZE];
+    memset(cache, 0xFF, sizeof(cache));
+
+    size_t misses = 0;
+    for (size_t i = 0; i < number_of_indices; i++)
+    {
+        const uint32_t slot = indices[i] & (VERTEX_CACHE_SIZE - 1);
+        if (cache[slot] != indices[i])
+        {
+            cache[slot] = indices[i];
+            misses++;
+        }
+    }
+    return (float)misses / (float)(number_of_indices / 3);
+}
+
+void Mesh_Optimize_Vertex_Cache(uint32_t *indices, const size_t number_of_indices, const size_t number_of_vertices)
+{
+    const size_t number_of_triangles = number_of_indices / 3;
+    if (number_of_triangles == 0)
+        return;
+
+    uint32_t *triangle_count   = calloc(number_of_vertices, sizeof(uint32_t)); // remaining triangles per vertex
+    uint32_t *triangle_offset  = malloc(sizeof(uint32_t) * (number_of_vertices + 1));
+    uint32_t *vertex_triangles = malloc(sizeof(uint32_t) * number_of_indices); // triangles using each vertex
+    int      *cache_position   = malloc(sizeof(int) * number_of_vertices);
+    float    *vertex_score     = malloc(sizeof(float) * number_of_vertices);
+    float    *triangle_score   = malloc(sizeof(float) * number_of_triangles);
+    bool     *emitted          = calloc(number_of_triangles, sizeof(bool));
+    uint32_t *output           = malloc(sizeof(uint32_t) * number_of_indices);
+
+    if (!triangle_count || !triangle_offset || !vertex_triangles || !cache_position || !vertex_score || !triangle_score || !emitted || !output)
+    {
+        fprintf(stderr, "Error allocating memory for vertex cache optimisation, skipping it\n");
+        goto cleanup;
+    }
+
+    /* Triangle adjacency for every vertex */
+    for (size_t i = 0; i < number_of_indices; i++)
+        triangle_count[indices[i]]++;
+
+    triangle_offset[0] = 0;
+    for (size_t v = 0; v < number_of_vertices; v++)
+        triangle_offset[v + 1] = triangle_offset[v] + triangle_count[v];
+
+    memset(triangle_count, 0, sizeof(uint32_t) * number_of_vertices);
+    for (size_t t = 0; t < number_of_triangles; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            const uint32_t v                                         = indices[t * 3 + k];
+            vertex_triangles[triangle_offset[v] + triangle_count[v]] = (uint32_t)t;
+            triangle_count[v]++;
+        }
+    }
+
+    for (size_t v = 0; v < number_of_vertices; v++)
+    {
+        cache_position[v] = -1;
+        vertex_score[v]   = Forsyth_Vertex_Score(-1, triangle_count[v]);
+    }
+
+    for (size_t t = 0; t < number_of_triangles; t++)
+    {
+        const uint32_t *tri = &indices[t * 3];
+        triangle_score[t]   = vertex_score[tri[0]] + vertex_score[tri[1]] + vertex_score[tri[2]];
+    }
+
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    size_t   cache_size = 0;
+
+    size_t best_triangle   = SIZE_MAX;
+    size_t next_unemitted  = 0;
+    size_t output_triangle = 0;
+
+    while (output_triangle < number_of_triangles)
+    {
+        if (best_triangle == SIZE_MAX)
+        {
+            // Nothing in the cache is used by a remaining triangle, carry on from the next one in the buffer
+            while (emitted[next_unemitted])
+                next_unemitted++;
+            best_triangle = next_unemitted;
+        }
+
+        const uint32_t *tri = &indices[best_triangle * 3];
+
+        output[output_triangle * 3 + 0] = tri[0];
+        output[output_triangle * 3 + 1] = tri[1];
+        output[output_triangle * 3 + 2] = tri[2];
+        output_triangle++;
+
+        emitted[best_triangle] = true;
+
+        /* Remove the triangle from the adjacency of its vertices */
+        for (int k = 0; k < 3; k++)
+        {
+            const uint32_t v         = tri[k];
+            uint32_t      *adjacency = &vertex_triangles[triangle_offset[v]];
+
+            for (uint32_t i = 0; i < triangle_count[v]; i++)
+            {
+                if (adjacency[i] == best_triangle)
+                {
+                    adjacency[i] = adjacency[triangle_count[v] - 1];
+                    break;
+                }
+            }
+            triangle_count[v]--;
+        }
+
+        /* Move the triangle's vertices to the front of the cache */
+        uint32_t new_cache[FORSYTH_CACHE_SIZE + 3];
+        size_t   new_cache_size = 0;
+
+        new_cache[new_cache_size++] = tri[0];
+        new_cache[new_cache_size++] = tri[1];
+        new_cache[new_cache_size++] = tri[2];
+
+        for (size_t i = 0; i < cache_size; i++)
+        {
+            const uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                new_cache[new_cache_size++] = v;
+        }
+
+        /* Rescore everything that was in the cache, including what just fell out of it */
+        for (size_t i = 0; i < new_cache_size; i++)
+        {
+            const uint32_t v  = new_cache[i];
+            cache_position[v] = (i < FORSYTH_CACHE_SIZE) ? (int)i : -1;
+
+            const float new_score = Forsyth_Vertex_Score(cache_position[v], triangle_count[v]);
+            const float delta     = new_score - vertex_score[v];
+            vertex_score[v]       = new_score;
+
+            const uint32_t *adjacency = &vertex_triangles[triangle_offset[v]];
+            for (uint32_t j = 0; j < triangle_count[v]; j++)
+                triangle_score[adjacency[j]] += delta;
+        }
+
+        cache_size = (new_cache_size < FORSYTH_CACHE_SIZE) ? new_cache_size : FORSYTH_CACHE_SIZE;
+        memcpy(cache, new_cache, sizeof(uint32_t) * cache_size);
+
+        /* Best remaining triangle touching the cache */
+        best_triangle    = SIZE_MAX;
+        float best_score = -FLT_MAX;
+        for (size_t i = 0; i < cache_size; i++)
+        {
+            const uint32_t  v         = cache[i];
+            const uint32_t *adjacency = &vertex_triangles[triangle_offset[v]];
+            for (uint32_t j = 0; j < triangle_count[v]; j++)
+            {
+                if (triangle_score[adjacency[j]] > best_score)
+                {
+                    best_score    = triangle_score[adjacency[j]];
+                    best_triangle = adjacency[j];
+                }
+            }
+        }
+    }
+
+    memcpy(indices, output, sizeof(uint32_t) * number_of_indices);
+
+cleanup:
+    free(triangle_count);
+    free(triangle_offset);
+    free(vertex_triangles);
+    free(cache_position);
+    free(vertex_score);
+    free(triangle_score);
+    free(emitted);
+    free(output);
+}
+
+void Mesh_Optimize_Vertex_Fetch(struct Mesh *mesh)
+{
+    const size_t number_of_vertices = mesh->number_of_vertices;
+
+    uint32_t *remap    = malloc(sizeof(uint32_t) * number_of_vertices);
+    float    *vertices = malloc(sizeof(float) * number_of_vertices * MESH_VERTEX_STRIDE);
+    if (!remap || !vertices)
+    {
+        fprintf(stderr, "Error allocating memory for vertex fetch optimisation, skipping it\n");
+        free(remap);
+        free(vertices);
+        return;
+    }
+    memset(remap, 0xFF, sizeof(uint32_t) * number_of_vertices);
+
+    uint32_t next_vertex = 0;
+    for (size_t i = 0; i < mesh->number_of_indices; i++)
+    {
+        const uint32_t old_index = mesh->index_data[i];
+        if (remap[old_index] == UINT32_MAX)
+        {
+            remap[old_index] = next_vertex;
+            memcpy(&vertices[next_vertex * MESH_VERTEX_STRIDE], &mesh->vertex_data[old_index * MESH_VERTEX_STRIDE], sizeof(float) * MESH_VERTEX_STRIDE);
+            next_vertex++;
+        }
+        mesh->index_data[i] = remap[old_index];
+    }
+
+    free(mesh->vertex_data);
+    free(remap);
+
+    // Vertices no index uses are dropped
+    mesh->vertex_data        = vertices;
+    mesh->number_of_vertices = next_vertex;
+}
+
+/* Used to order the clusters for overdraw, see Mesh_Build_Clusters */
+typedef struct
+{
+    float    score;
+    uint32_t cluster;
+} ClusterScore_t;
+
+static int Compare_Cluster_Score(const void *a, const void *b)
+{
+    const float score_a = ((const ClusterScore_t *)a)->score;
+    const float score_b = ((const ClusterScore_t *)b)->score;
+    return (score_a < score_b) - (score_a > score_b); // Highest score first
+}
+
+static inline float *Mesh_Vertex_Position(const struct Mesh *mesh, const uint32_t index)
+{
+    return &mesh->vertex_data[index * MESH_VERTEX_STRIDE];
+}
+
+/*
+Overdraw ordering from "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al.)
+    - Clusters are consecutive runs of the (vertex cache optimised) index buffer so they keep their cache locality
+    - Each cluster gets a score of dot(cluster centroid - range centroid, cluster normal), clusters on the
+        outside of the mesh facing away from its centre are likely to occlude the others so are drawn first
+    - Writes the clusters of the range into 'sorted_clusters', returns how many or 0 when out of memory
+*/
+static size_t Build_Range_Clusters(struct Mesh *mesh, const uint32_t first_index, const uint32_t number_of_indices, MeshCluster_t *sorted_clusters)
+{
+    const size_t number_of_triangles = number_of_indices / 3;
+    const size_t number_of_clusters  = (number_of_triangles + MESH_CLUSTER_TRIANGLES - 1) / MESH_CLUSTER_TRIANGLES;
+    if (number_of_clusters == 0)
+        return 0;
+
+    MeshCluster_t  *clusters = malloc(sizeof(MeshCluster_t) * number_of_clusters);
+    ClusterScore_t *scores   = malloc(sizeof(ClusterScore_t) * number_of_clusters);
+    vec3           *normals  = malloc(sizeof(vec3) * number_of_clusters);
+    vec3           *centroid = malloc(sizeof(vec3) * number_of_clusters);
+    uint32_t       *indices  = malloc(sizeof(uint32_t) * number_of_indices);
+
+    if (!clusters || !scores || !normals || !centroid || !indices)
+    {
+        free(clusters);
+        free(scores);
+        free(normals);
+        free(centroid);
+        free(indices);
+        return 0;
+    }
+
+    vec3 range_centroid = {0.0f, 0.0f, 0.0f};
+
+    for (size_t c = 0; c < number_of_clusters; c++)
+    {
+        MeshCluster_t *cluster = &clusters[c];
+
+        cluster->first_index       = first_index + (uint32_t)(c * MESH_CLUSTER_TRIANGLES * 3);
+        cluster->number_of_indices = (uint32_t)((c == number_of_clusters - 1) ? first_index + number_of_indices - cluster->first_index : MESH_CLUSTER_TRIANGLES * 3);
+
+        const uint32_t *cluster_indices = &mesh->index_data[cluster->first_index];
+
+        vec3 bmin = {FLT_MAX, FLT_MAX, FLT_MAX};
+        vec3 bmax = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+        glm_vec3_zero(normals[c]);
+        glm_vec3_zero(centroid[c]);
+
+        for (uint32_t i = 0; i < cluster->number_of_indices; i += 3)
+        {
+            float *p0 = Mesh_Vertex_Position(mesh, cluster_indices[i + 0]);
+            float *p1 = Mesh_Vertex_Position(mesh, cluster_indices[i + 1]);
+            float *p2 = Mesh_Vertex_Position(mesh, cluster_indices[i + 2]);
+
+            for (int k = 0; k < 3; k++)
+            {
+                bmin[k] = fminf(bmin[k], fminf(p0[k], fminf(p1[k], p2[k])));
+                bmax[k] = fmaxf(bmax[k], fmaxf(p0[k], fmaxf(p1[k], p2[k])));
+
+                centroid[c][k] += (p0[k] + p1[k] + p2[k]) * (1.0f / 3.0f);
+            }
+
+            // Area weighted face normal
+            vec3 e0, e1, face_normal;
+            glm_vec3_sub(p1, p0, e0);
+            glm_vec3_sub(p2, p0, e1);
+            glm_vec3_cross(e0, e1, face_normal);
+            glm_vec3_add(normals[c], face_normal, normals[c]);
+        }
+
+        /* Normal cone, the axis is the average facing and the angle covers every triangle */
+        glm_vec3_normalize_to(normals[c], cluster->cone_axis);
+
+        float min_dot = 1.0f;
+        for (uint32_t i = 0; i < cluster->number_of_indices; i += 3)
+        {
+            float *p0 = Mesh_Vertex_Position(mesh, cluster_indices[i + 0]);
+            float *p1 = Mesh_Vertex_Position(mesh, cluster_indices[i + 1]);
+            float *p2 = Mesh_Vertex_Position(mesh, cluster_indices[i + 2]);
+
+            vec3 e0, e1, face_normal;
+            glm_vec3_sub(p1, p0, e0);
+            glm_vec3_sub(p2, p0, e1);
+            glm_vec3_cross(e0, e1, face_normal);
+
+            const float length = glm_vec3_norm(face_normal);
+            if (length > FLT_EPSILON) // Skip degenerate triangles
+                min_dot = fminf(min_dot, glm_vec3_dot(face_normal, cluster->cone_axis) / length);
+        }
+
+        // Wider than ~85 degrees can never be fully back facing, also catches a zero axis
+        cluster->cone_cutoff = (min_dot <= 0.1f) ? 1.0f : sqrtf(1.0f - min_dot * min_dot);
+
+        glm_vec3_scale(centroid[c], 1.0f / (float)(cluster->number_of_indices / 3), centroid[c]);
+        glm_vec3_add(range_centroid, centroid[c], range_centroid);
+
+        /* Bounding sphere around the box centre */
+        cluster->centre[0] = 0.5f * (bmin[0] + bmax[0]);
+        cluster->centre[1] = 0.5f * (bmin[1] + bmax[1]);
+        cluster->centre[2] = 0.5f * (bmin[2] + bmax[2]);
+
+        float radius_squared = 0.0f;
+        for (uint32_t i = 0; i < cluster->number_of_indices; i++)
+        {
+            vec3 d;
+            glm_vec3_sub(Mesh_Vertex_Position(mesh, cluster_indices[i]), cluster->centre, d);
+            radius_squared = fmaxf(radius_squared, glm_vec3_dot(d, d));
+        }
+        cluster->radius = sqrtf(radius_squared);
+    }
+
+    glm_vec3_scale(range_centroid, 1.0f / (float)number_of_clusters, range_centroid);
+
+    for (size_t c = 0; c < number_of_clusters; c++)
+    {
+        vec3 to_cluster;
+        glm_vec3_sub(centroid[c], range_centroid, to_cluster);
+
+        scores[c].score   = glm_vec3_dot(to_cluster, normals[c]) / fmaxf(glm_vec3_norm(normals[c]), FLT_EPSILON);
+        scores[c].cluster = (uint32_t)c;
+    }
+
+    qsort(scores, number_of_clusters, sizeof(ClusterScore_t), Compare_Cluster_Score);
+
+    /* Rewrite the range of the index buffer in the new cluster order */
+    uint32_t next_index = 0;
+    for (size_t c = 0; c < number_of_clusters; c++)
+    {
+        const MeshCluster_t cluster = clusters[scores[c].cluster];
+
+        memcpy(&indices[next_index], &mesh->index_data[cluster.first_index], sizeof(uint32_t) * cluster.number_of_indices);
+
+        sorted_clusters[c]             = cluster;
+        sorted_clusters[c].first_index = first_index + next_index;
+        next_index += cluster.number_of_indices;
+    }
+    memcpy(&mesh->index_data[first_index], indices, sizeof(uint32_t) * number_of_indices);
+
+    free(clusters);
+    free(scores);
+    free(normals);
+    free(centroid);
+    free(indices);
+
+    return number_of_clusters;
+}
+
+void Mesh_Build_Clusters(struct Mesh *mesh)
+{
+    size_t max_clusters = 0;
+    for (size_t r = 0; r < mesh->number_of_draw_ranges; r++)
+        max_clusters += (mesh->draw_ranges[r].number_of_indices / 3 + MESH_CLUSTER_TRIANGLES - 1) / MESH_CLUSTER_TRIANGLES;
+    if (max_clusters == 0)
+        return;
+
+    MeshCluster_t *clusters = malloc(sizeof(MeshCluster_t) * max_clusters);
+    if (!clusters)
+    {
+        fprintf(stderr, "Error allocating memory for mesh clusters, skipping them\n");
+        return;
+    }
+
+    size_t number_of_clusters = 0;
+    for (size_t r = 0; r < mesh->number_of_draw_ranges; r++)
+    {
+        MeshDrawRange_t *range = &mesh->draw_ranges[r];
+
+        const size_t built = Build_Range_Clusters(mesh, range->first_index, range->number_of_indices, &clusters[number_of_clusters]);
+        if (built == 0 && range->number_of_indices > 0)
+        {
+            fprintf(stderr, "Error allocating memory for mesh clusters, skipping them\n");
+            free(clusters);
+            for (size_t i = 0; i < mesh->number_of_draw_ranges; i++)
+                mesh->draw_ranges[i].first_cluster = mesh->draw_ranges[i].number_of_clusters = 0;
+            return;
+        }
+
+        range->first_cluster      = (uint32_t)number_of_clusters;
+        range->number_of_clusters = (uint32_t)built;
+        number_of_clusters += built;
+    }
+
+    free(mesh->clusters);
+    mesh->clusters           = clusters;
+    mesh->number_of_clusters = number_of_clusters;
+
+    printf("Mesh clusters : %zu in %zu draw ranges\n", number_of_clusters, mesh->number_of_draw_ranges);
+}
+
+static void Index_Vertex_Range(const uint32_t *indices, const uint32_t number_of_indices, uint32_t *first_vertex, uint32_t *number_of_vertices)
+{
+    uint32_t min_vertex = UINT32_MAX;
+    uint32_t max_vertex = 0;
+    for (uint32_t i = 0; i < number_of_indices; i++)
+    {
+        min_vertex = (indices[i] < min_vertex) ? indices[i] : min_vertex;
+        max_vertex = (indices[i] > max_vertex) ? indices[i] : max_vertex;
+    }
+
+    *first_vertex       = (number_of_indices) ? min_vertex : 0;
+    *number_of_vertices = (number_of_indices) ? max_vertex - min_vertex + 1 : 0;
+}
+
+void Mesh_Compute_Vertex_Ranges(struct Mesh *mesh)
+{
+    for (size_t c = 0; c < mesh->number_of_clusters; c++)
+    {
+        MeshCluster_t *cluster = &mesh->clusters[c];
+        Index_Vertex_Range(&mesh->index_data[cluster->first_index], cluster->number_of_indices, &cluster->first_vertex, &cluster->number_of_vertices);
+    }
+
+    for (size_t r = 0; r < mesh->number_of_draw_ranges; r++)
+    {
+        MeshDrawRange_t *range = &mesh->draw_ranges[r];
+        Index_Vertex_Range(&mesh->index_data[range->first_index], range->number_of_indices, &range->first_vertex, &range->number_of_vertices);
+    }
+}
@@ -1,74 +1,92 @@
 #define TINYOBJ_LOADER_C_IMPLEMENTATION
 #include "obj.h"
 
-#define FILE_CHECK_CLOSE(FILE_POINTER) \
-    if (fclose((FILE_POINTER)))        \
-        perror("fclose error");
+#include <string.h>
+
+#include "utils/utils.h"
+
+#define MAX_LOADED_OBJ_FILES 16 /* The .obj and all of its .mtl files */
+
+/*
+Files handed to tinyobj, we keep track of them here so they can be released once parsing is done
+    - Files are memory mapped and parsed in place, straight from the page cache
+    - tinyobj's number parsing can read one byte past the end of the last line, if the file does not end in
+        a new line and fills its last page exactly, that byte is not mapped so we fall back to a copy
+*/
+typedef struct
+{
+    file_map_t maps[MAX_LOADED_OBJ_FILES];
+    char      *copies[MAX_LOADED_OBJ_FILES];
+    size_t     count;
+} LoadedFiles_t;
 
 static int loadFile(void *ctx, const char *filename, const int is_mtl, const char *obj_filename, char **buffer, size_t *len)
 {
     (void)is_mtl;
-    ctx          = NULL;
-    obj_filename = NULL;
+    (void)obj_filename;
+
+    LoadedFiles_t *files = (LoadedFiles_t *)ctx;
+    ASSERT(files);
 
-    FILE   *fp;
-    errno_t err;
+    *buffer = NULL;
+    *len    = 0;
 
-    // Open file for reading
-    err = fopen_s(&fp, filename, "rb");
-    if (err != 0 || fp == NULL)
+    if (files->count == MAX_LOADED_OBJ_FILES)
     {
-        perror(filename);
-        // fprintf(stderr, "Error opening file %s\n", filename);
+        fprintf(stderr, "Too many files to load for this object : %s\n", filename);
         return TINYOBJ_ERROR_FILE_OPERATION;
     }
 
-    // Get file size
-    if (fseek(fp, 0, SEEK_END) != 0)
+    file_map_t map;
+    if (!File_Map(filename, &map, FILE_MAP_ACCESS_SEQUENTIAL))
     {
-        perror("Error seeking in file");
-        FILE_CHECK_CLOSE(fp);
-        return 1;
+        perror(filename);
+        return TINYOBJ_ERROR_FILE_OPERATION;
     }
 
-    const long file_size = ftell(fp);
-    rewind(fp);
+    const char  *data          = (const char *)map.data;
+    const size_t file_size     = map.size;
+    const bool   safe_in_place = (data[file_size - 1] == '\n') || (file_size % File_Page_Size() != 0);
 
-    // Allocate buffer for file contents
-    *buffer = malloc((sizeof *buffer) * (file_size + 1));
-    if (*buffer == NULL)
+    if (safe_in_place)
     {
-        fprintf(stderr, "Error allocating memory for file contents\n");
-        FILE_CHECK_CLOSE(fp);
-        return 1;
+        files->maps[files->count] = map;
+        *buffer                   = (char *)map.data;
     }
-
-    // Read file into buffer
-    const size_t bytes_read = fread(*buffer, 1, file_size, fp);
-    if (bytes_read != (size_t)file_size)
+    else
     {
-        if (ferror(fp))
-            perror("Error reading from file");
-        else if (feof(fp))
-            printf("End of file reached.\n");
-        clearerr(fp);
-
-        FILE_CHECK_CLOSE(fp);
-        free(*buffer);
-        *buffer = NULL;
-        return 1;
-    }
+        char *copy = malloc(file_size + 1);
+        if (copy == NULL)
+        {
+            fprintf(stderr, "Error allocating memory for file contents\n");
+            File_Unmap(&map);
+            return TINYOBJ_ERROR_FILE_OPERATION;
+        }
+        memcpy(copy, data, file_size);
+        copy[file_size] = '\0';
 
-    // Null-terminate buffer
-    (*buffer)[bytes_read] = '\0';
+        files->copies[files->count] = copy;
+        *buffer                     = copy;
+        File_Unmap(&map);
+    }
 
-    // Set length and clean up
-    *len = bytes_read;
-    FILE_CHECK_CLOSE(fp);
+    *len = file_size;
+    files->count++;
 
     return TINYOBJ_SUCCESS;
 }
 
+static void _Release_Loaded_Files(LoadedFiles_t *files)
+{
+    for (size_t i = 0; i < files->count; i++)
+    {
+        File_Unmap(&files->maps[i]);
+        free(files->copies[i]);
+        files->copies[i] = NULL;
+    }
+    files->count = 0;
+}
+
 static const char *tinyobj_parse_error_str[] =
     {
         "TINYOBJ_SUCCESS",
@@ -96,114 +114,240 @@ static inline const char *tinyobj_parse_error(const int return_value_from_tinyob
 }
 
 /*
-This function takes out data loaded tinyObj and reorganises
-into a format we want to use
+Open addressing hash table from a (v, vt, vn) face corner to its index in the vertex buffer
+    - Linear probing, the table is kept at most half full so probes stay short
 */
-static triang *_Make_Triangles(tinyobj_attrib_t attrib, unsigned int number_of_triangle)
+typedef struct
 {
-    /* Allocate array for triangles */
-    triang *triangles = malloc(sizeof(triang) * number_of_triangle);
-    // TODO: Check this memory
-
-#ifdef OBJ_CENTER
-    vec3 bmin, bmax;
-    bmin[0] = bmin[1] = bmin[2] = FLT_MAX;
-    bmax[0] = bmax[1] = bmax[2] = -FLT_MAX;
-#endif
+    int      v_idx, vt_idx, vn_idx;
+    uint32_t vertex_index; // UINT32_MAX when the slot is empty
+} VertexHashEntry_t;
 
-    // Lets group verts into triangles
-    for (unsigned int i = 0; i < number_of_triangle; i++)
-    {
-        assert(attrib.face_num_verts[i] % 3 == 0); /* assume all triangle faces. */
+static inline uint32_t _Hash_Vertex_Index(const tinyobj_vertex_index_t idx)
+{
+    uint32_t h = (uint32_t)idx.v_idx * 0x9E3779B1u;
+    h ^= (uint32_t)idx.vt_idx * 0x85EBCA77u;
+    h ^= (uint32_t)idx.vn_idx * 0xC2B2AE3Du;
+    return h ^ (h >> 15);
+}
 
-        tinyobj_vertex_index_t idx0 = attrib.faces[3 * i + 0];
-        tinyobj_vertex_index_t idx1 = attrib.faces[3 * i + 1];
-        tinyobj_vertex_index_t idx2 = attrib.faces[3 * i + 2];
+/*
+Build buffers we can bind for rendering
+    - vertex data is {posX, posY, posZ}{texU, texV}
+    - Face corners that share the same (v, vt, vn) share one vertex, so each unique vertex
+        only goes through the vertex shader once per triangle that is set up with it
+*/
+static void _Make_Vertex_Buffers(struct Mesh *mesh)
+{
+    const tinyobj_attrib_t *attrib = &mesh->attribute;
 
-        /* Get vertex data */
-        triangles[i].v0[0] = attrib.vertices[idx0.v_idx * 3 + 0]; // X
-        triangles[i].v0[1] = attrib.vertices[idx0.v_idx * 3 + 1]; // Y
-        triangles[i].v0[2] = attrib.vertices[idx0.v_idx * 3 + 2]; // Z
+    size_t table_size = 1024;
+    while (table_size < (size_t)attrib->num_faces * 2)
+        table_size *= 2;
 
-        triangles[i].v1[0] = attrib.vertices[idx1.v_idx * 3 + 0]; // X
-        triangles[i].v1[1] = attrib.vertices[idx1.v_idx * 3 + 1]; // Y
-        triangles[i].v1[2] = attrib.vertices[idx1.v_idx * 3 + 2]; // Z
+    VertexHashEntry_t *table = malloc(sizeof(VertexHashEntry_t) * table_size);
+    assert(table);
+    memset(table, 0xFF, sizeof(VertexHashEntry_t) * table_size);
 
-        triangles[i].v2[0] = attrib.vertices[idx2.v_idx * 3 + 0]; // X
-        triangles[i].v2[1] = attrib.vertices[idx2.v_idx * 3 + 1]; // Y
-        triangles[i].v2[2] = attrib.vertices[idx2.v_idx * 3 + 2]; // Z
+    // Worst case every corner is unique, shrunk once we know the real count
+    mesh->vertex_data = malloc(sizeof(float) * attrib->num_faces * MESH_VERTEX_STRIDE);
+    mesh->index_data  = malloc(sizeof(uint32_t) * attrib->num_faces);
+    assert(mesh->vertex_data && mesh->index_data);
 
-        /* Get normal data */
-        triangles[i].n0[0] = attrib.normals[idx0.vn_idx * 3 + 0]; // X
-        triangles[i].n0[1] = attrib.normals[idx0.vn_idx * 3 + 1]; // Y
-        triangles[i].n0[2] = attrib.normals[idx0.vn_idx * 3 + 2]; // Z
+    uint32_t number_of_vertices = 0;
+    for (size_t i = 0; i < attrib->num_faces; i++)
+    {
+        const tinyobj_vertex_index_t face = attrib->faces[i];
 
-        triangles[i].n1[0] = attrib.normals[idx1.vn_idx * 3 + 0]; // X
-        triangles[i].n1[1] = attrib.normals[idx1.vn_idx * 3 + 1]; // Y
-        triangles[i].n1[2] = attrib.normals[idx1.vn_idx * 3 + 2]; // Z
+        size_t slot = _Hash_Vertex_Index(face) & (table_size - 1);
+        while (table[slot].vertex_index != UINT32_MAX &&
+               (table[slot].v_idx != face.v_idx || table[slot].vt_idx != face.vt_idx || table[slot].vn_idx != face.vn_idx))
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
 
-        triangles[i].n2[0] = attrib.normals[idx2.vn_idx * 3 + 0]; // X
-        triangles[i].n2[1] = attrib.normals[idx2.vn_idx * 3 + 1]; // Y
-        triangles[i].n2[2] = attrib.normals[idx2.vn_idx * 3 + 2]; // Z
+        if (table[slot].vertex_index == UINT32_MAX)
+        {
+            table[slot] = (VertexHashEntry_t){face.v_idx, face.vt_idx, face.vn_idx, number_of_vertices};
 
-        /* Get texture data */
-        triangles[i].u[0] = attrib.texcoords[idx0.vt_idx * 2 + 0];
-        triangles[i].u[1] = attrib.texcoords[idx1.vt_idx * 2 + 0];
-        triangles[i].u[2] = attrib.texcoords[idx2.vt_idx * 2 + 0];
+            const bool has_texcoord = face.vt_idx >= 0 && (unsigned int)face.vt_idx < attrib->num_texcoords;
 
-        triangles[i].v[0] = attrib.texcoords[idx0.vt_idx * 2 + 1];
-        triangles[i].v[1] = attrib.texcoords[idx1.vt_idx * 2 + 1];
-        triangles[i].v[2] = attrib.texcoords[idx2.vt_idx * 2 + 1];
+            float *vertex = &mesh->vertex_data[number_of_vertices * MESH_VERTEX_STRIDE];
+            vertex[0]     = attrib->vertices[face.v_idx * 3 + 0];
+            vertex[1]     = attrib->vertices[face.v_idx * 3 + 1];
+            vertex[2]     = attrib->vertices[face.v_idx * 3 + 2];
+            vertex[3]     = (has_texcoord) ? attrib->texcoords[face.vt_idx * 2 + 0] : 0.0f;
+            vertex[4]     = (has_texcoord) ? attrib->texcoords[face.vt_idx * 2 + 1] : 0.0f;
 
-#if 0 /* Fund the bounding volume*/
-        for (size_t coor = 0; coor < 3 coor++)
-        {
-            /* Find the min of x, y, z */
-            bmin[coor] = (triangles[tri_index].v0[coor] < bmin[coor]) ? triangles[tri_index].v0[coor] : bmin[coor];
-            bmin[coor] = (triangles[tri_index].v1[coor] < bmin[coor]) ? triangles[tri_index].v1[coor] : bmin[coor];
-            bmin[coor] = (triangles[tri_index].v2[coor] < bmin[coor]) ? triangles[tri_index].v2[coor] : bmin[coor];
-
-            /* Find the max of x, y, z */
-            bmax[coor] = (triangles[tri_index].v0[coor] > bmax[coor]) ? triangles[tri_index].v0[coor] : bmax[coor];
-            bmax[coor] = (triangles[tri_index].v1[coor] > bmax[coor]) ? triangles[tri_index].v1[coor] : bmax[coor];
-            bmax[coor] = (triangles[tri_index].v2[coor] > bmax[coor]) ? triangles[tri_index].v2[coor] : bmax[coor];
+            number_of_vertices++;
         }
+
+        mesh->index_data[i] = table[slot].vertex_index;
     }
-    printf("bmin (%f, %f, %f)\n", bmin[0], bmin[1], bmin[2]);
-    printf("bmax (%f, %f, %f)\n", bmax[0], bmax[1], bmax[2]);
+    free(table);
+
+    mesh->number_of_vertices = number_of_vertices;
+    mesh->number_of_indices  = attrib->num_faces;
 
-    float obj_height = bmax[1] - bmin[1]; // calculate the height of the bounding box
-    float obj_depth  = bmax[2] - bmin[2]; // calculate the depth of the bounding box
+    float *shrunk = realloc(mesh->vertex_data, sizeof(float) * number_of_vertices * MESH_VERTEX_STRIDE);
+    if (shrunk)
+        mesh->vertex_data = shrunk;
 
-    printf("Object height: %f\n", obj_height);
-    printf("Object depth : %f\n", obj_depth);
+    printf("Unique vertices : %u of %u face corners\n", number_of_vertices, attrib->num_faces);
+}
 
-    /* Fit to 0, 1 with respect to object height*/
-    float scale_to_height = obj_height;
-    vec3  scale           = {1.0f / scale_to_height, 1.0f / scale_to_height, 1.0f / scale_to_height};
+/*
+Sort the triangles of the index buffer by material, keeping their order within a material, and make a draw range for each material
+    - Faces without a material, or with one that does not exist, are grouped together first with a material id of -1
+*/
+static void _Make_Draw_Ranges(struct Mesh *mesh)
+{
+    const size_t number_of_triangles = mesh->number_of_indices / 3;
+    const size_t number_of_buckets   = mesh->number_of_materials + 1;
+    const int   *material_ids        = mesh->attribute.material_ids;
 
-    // Calculate distance to bounding box
-    // screen_height_amount is the percent of the screen the height of the object will fill
-    float screen_height_amount = 1.0f;
-    float FOVv                 = FOVh * (float)M_PI / 180.0f; // vertical FOV in radians
-    float push_amount          = obj_height / (screen_height_amount * (2.0f * tanf(FOVv / 2.0f)));
-    push_amount += (obj_depth / 2.0f);
+    size_t   *bucket_start = calloc(number_of_buckets + 1, sizeof(size_t));
+    uint32_t *indices      = malloc(sizeof(uint32_t) * mesh->number_of_indices);
+    assert(bucket_start && indices);
 
-    printf("Push amount: %f\n", push_amount);
+#define MATERIAL_BUCKET(TRIANGLE) \
+    ((material_ids && material_ids[(TRIANGLE)] >= 0 && (size_t)material_ids[(TRIANGLE)] < mesh->number_of_materials) ? (size_t)material_ids[(TRIANGLE)] + 1 : 0)
 
-    /* Centerize object. */
-    vec3 position = {-0.5f * (bmax[0] + bmin[0]), // Center on the x axis
-                     -0.5f * (bmax[1] + bmin[1]), // Center on the y axis
-                     -push_amount};
+    /* Counting sort, stable so the triangles of a material stay in file order */
+    for (size_t t = 0; t < number_of_triangles; t++)
+        bucket_start[MATERIAL_BUCKET(t) + 1]++;
 
-    mat4 model;
-    glm_scale_make(model, scale);
-    //  glm_translated(model, position);
-    glm_translate(model, position);
-#endif
+    size_t number_of_ranges = 0;
+    for (size_t b = 0; b < number_of_buckets; b++)
+    {
+        number_of_ranges += (bucket_start[b + 1] > 0);
+        bucket_start[b + 1] += bucket_start[b];
+    }
+
+    mesh->draw_ranges           = calloc(number_of_ranges, sizeof(MeshDrawRange_t));
+    mesh->number_of_draw_ranges = 0;
+    assert(mesh->draw_ranges);
+
+    for (size_t b = 0; b < number_of_buckets; b++)
+    {
+        if (bucket_start[b + 1] == bucket_start[b])
+            continue;
+
+        MeshDrawRange_t *range   = &mesh->draw_ranges[mesh->number_of_draw_ranges++];
+        range->first_index       = (uint32_t)(bucket_start[b] * 3);
+        range->number_of_indices = (uint32_t)((bucket_start[b + 1] - bucket_start[b]) * 3);
+        range->material_id       = (int32_t)b - 1;
+        range->diffuse_texture   = -1;
+    }
+
+    for (size_t t = 0; t < number_of_triangles; t++)
+    {
+        const size_t to = bucket_start[MATERIAL_BUCKET(t)]++;
+        memcpy(&indices[to * 3], &mesh->index_data[t * 3], sizeof(uint32_t) * 3);
+    }
+#undef MATERIAL_BUCKET
+
+    free(mesh->index_data);
+    free(bucket_start);
+    mesh->index_data = indices;
+
+    printf("Draw ranges : %zu for %zu materials\n", mesh->number_of_draw_ranges, mesh->number_of_materials);
+}
+
+/* Material paths are either usable as they are or relative to the .obj */
+static bool _Find_Texture(const char *obj_file_name, const char *texture_name, char *path, const size_t path_size)
+{
+    snprintf(path, path_size, "%s", texture_name);
+    if (File_Get_Info(path, NULL, NULL))
+        return true;
+
+    const char *slash = strrchr(obj_file_name, '/');
+    const char *back  = strrchr(obj_file_name, '\\');
+    if (slash == NULL || (back != NULL && back > slash)) // Only compare them when both are in the string
+        slash = back;
+
+    const int directory_length = (slash) ? (int)(slash - obj_file_name) + 1 : 0;
+    snprintf(path, path_size, "%.*s%s", directory_length, obj_file_name, texture_name);
+    if (File_Get_Info(path, NULL, NULL))
+        return true;
+
+    fprintf(stderr, "Cannot find texture : %s\n", texture_name);
+    return false;
+}
+
+void Mesh_Load_Textures(struct Mesh *mesh, const char *obj_file_name, const char *const *texture_names, const size_t number_of_textures)
+{
+    mesh->textures           = calloc(number_of_textures + 1, sizeof(texture_t *));
+    mesh->number_of_textures = number_of_textures;
+    assert(mesh->textures);
+
+    char        *path_data       = malloc(MESH_TEXTURE_PATH_SIZE * (number_of_textures + 1));
+    const char **paths           = calloc(number_of_textures + 1, sizeof(const char *));
+    size_t      *found           = calloc(number_of_textures + 1, sizeof(size_t)); // Texture each path is for
+    size_t       number_of_found = 0;
+    assert(path_data && paths && found);
+
+    /* Textures that cannot be found keep a NULL handle */
+    for (size_t i = 0; i < number_of_textures; i++)
+    {
+        char *path = path_data + MESH_TEXTURE_PATH_SIZE * i;
+        if (!_Find_Texture(obj_file_name, texture_names[i], path, MESH_TEXTURE_PATH_SIZE))
+            continue;
+
+        paths[number_of_found]   = path;
+        found[number_of_found++] = i;
+    }
+
+    /* One batch so every file is decoded at the same time */
+    if (number_of_found > 0)
+    {
+        texture_t **handles = malloc(sizeof(texture_t *) * number_of_found);
+        assert(handles);
+        Texture_Cache_Acquire_All(paths, number_of_found, handles);
+
+        for (size_t i = 0; i < number_of_found; i++)
+            mesh->textures[found[i]] = handles[i];
+
+        free(handles);
+    }
+
+    free(found);
+    free(paths);
+    free(path_data);
+}
+
+/* Give every draw range the diffuse texture of its material, materials that name the same file share the texture */
+static void _Load_Material_Textures(struct Mesh *mesh, const char *obj_file_name)
+{
+    const char **names              = malloc(sizeof(const char *) * (mesh->number_of_draw_ranges + 1));
+    size_t       number_of_textures = 0;
+    assert(names);
+
+    for (size_t r = 0; r < mesh->number_of_draw_ranges; r++)
+    {
+        MeshDrawRange_t *range = &mesh->draw_ranges[r];
+        if (range->material_id < 0)
+            continue;
+
+        const char *name = mesh->materials[range->material_id].diffuse_texname;
+        if (name == NULL || name[0] == '\0')
+            continue;
+
+        for (size_t t = 0; t < number_of_textures && range->diffuse_texture < 0; t++)
+            if (strcmp(names[t], name) == 0)
+                range->diffuse_texture = (int32_t)t;
+
+        if (range->diffuse_texture < 0)
+        {
+            range->diffuse_texture      = (int32_t)number_of_textures;
+            names[number_of_textures++] = name;
+        }
     }
 
-    return triangles;
+    Mesh_Load_Textures(mesh, obj_file_name, names, number_of_textures);
+    free(names);
+
+    printf("Textures : %zu unique diffuse textures\n", mesh->number_of_textures);
 }
 
 struct Mesh Mesh_Load(const char *file_name)
@@ -212,6 +356,10 @@ struct Mesh Mesh_Load(const char *file_name)
 
     printf("Loading model : %s\n", file_name);
 
+    struct Mesh cached_mesh = {0};
+    if (Mesh_Cache_Load(file_name, &cached_mesh))
+        return cached_mesh;
+
     tinyobj_attrib_t attribute;
 
     tinyobj_shape_t *shapes;
@@ -220,7 +368,28 @@ struct Mesh Mesh_Load(const char *file_name)
     tinyobj_material_t *materials;
     size_t              number_of_materials;
 
-    const int ret = tinyobj_parse_obj(&attribute, &shapes, &number_of_shapes, &materials, &number_of_materials, file_name, loadFile, NULL, TINYOBJ_FLAG_TRIANGULATE);
+    LoadedFiles_t loaded_files = {0};
+
+    uint64_t file_size = 0;
+    File_Get_Info(file_name, &file_size, NULL);
+
+    int ret;
+    if (file_size >= OBJ_PARALLEL_PARSE_MIN_SIZE)
+    {
+        char  *buffer = NULL;
+        size_t length = 0;
+        loadFile((void *)&loaded_files, file_name, 0, file_name, &buffer, &length);
+
+        ret = (buffer) ? Obj_Parse_Parallel(&attribute, &shapes, &number_of_shapes, &materials, &number_of_materials, buffer, length, file_name, loadFile, (void *)&loaded_files)
+                       : TINYOBJ_ERROR_FILE_OPERATION;
+    }
+    else
+    {
+        ret = tinyobj_parse_obj(&attribute, &shapes, &number_of_shapes, &materials, &number_of_materials, file_name, loadFile, (void *)&loaded_files, TINYOBJ_FLAG_TRIANGULATE);
+    }
+
+    _Release_Loaded_Files(&loaded_files);
+
     if (ret != TINYOBJ_SUCCESS)
     {
         fprintf(stderr, "Failed to parse OBJ file : %s : %s\n", tinyobj_parse_error(ret), file_name);
@@ -269,16 +438,6 @@ struct Mesh Mesh_Load(const char *file_name)
         printf("\t map_bump bump_texname               :%s\n", materials->bump_texname);
         printf("\t disp     displacement_texname       :%s\n", materials->displacement_texname);
         printf("\t map_d    alpha_texname              :%s\n", materials->alpha_texname);
-
-        if (materials->diffuse_texname != NULL)
-        {
-            printf("Loading diffuse_texname...\n");
-            mesh.diffuse_tex  = malloc(sizeof(texture_t));
-            *mesh.diffuse_tex = Texture_Load(materials->diffuse_texname, 0);
-            // TODO: This function should return an error so we can exit the program since
-            //  we are missing a file or file path...
-            // TODO: handle file not found, and file not set differences
-        }
     }
 
     /*
@@ -314,10 +473,32 @@ struct Mesh Mesh_Load(const char *file_name)
         printf("\tnum_face_num_verts : %d\n", attribute.num_face_num_verts); // Total number of triangles in this object (length of face_num_verts)
     }
 
-    mesh.triangle = _Make_Triangles(mesh.attribute, mesh.number_of_triangles);
-
     assert(mesh.number_of_triangles != 0);
-    assert(mesh.triangle);
+
+    _Make_Vertex_Buffers(&mesh);
+    _Make_Draw_Ranges(&mesh);
+    _Load_Material_Textures(&mesh, file_name);
+
+#ifdef MESH_OPTIMIZE_VERTEX_CACHE
+    const float acmr_before = Mesh_Compute_ACMR(mesh.index_data, mesh.number_of_indices);
+
+    for (size_t r = 0; r < mesh.number_of_draw_ranges; r++)
+        Mesh_Optimize_Vertex_Cache(&mesh.index_data[mesh.draw_ranges[r].first_index], mesh.draw_ranges[r].number_of_indices, mesh.number_of_vertices);
+#endif
+
+#ifdef MESH_BUILD_CLUSTERS
+    Mesh_Build_Clusters(&mesh);
+#endif
+
+#ifdef MESH_OPTIMIZE_VERTEX_CACHE
+    Mesh_Optimize_Vertex_Fetch(&mesh);
+
+    printf("Vertex cache ACMR : %.3f -> %.3f\n", acmr_before, Mesh_Compute_ACMR(mesh.index_data, mesh.number_of_indices));
+#endif
+
+    Mesh_Compute_Vertex_Ranges(&mesh);
+
+    Mesh_Cache_Write(file_name, &mesh);
 
     return mesh;
 }
@@ -329,6 +510,29 @@ struct Mesh Mesh_Load(const char *file_name)
         (TEX) = NULL;           \
     }
 
+void Mesh_Bounding_Sphere(const struct Mesh *mesh, vec4 sphere)
+{
+    glm_vec4_zero(sphere);
+    if (mesh->number_of_vertices == 0)
+        return;
+
+    /* Centre of the AABB, then the furthest vertex from it */
+    vec3 min, max;
+    glm_vec3_copy(&mesh->vertex_data[0], min);
+    glm_vec3_copy(&mesh->vertex_data[0], max);
+    for (size_t i = 1; i < mesh->number_of_vertices; i++)
+    {
+        glm_vec3_minv(min, &mesh->vertex_data[i * MESH_VERTEX_STRIDE], min);
+        glm_vec3_maxv(max, &mesh->vertex_data[i * MESH_VERTEX_STRIDE], max);
+    }
+    glm_vec3_center(min, max, sphere);
+
+    float radius2 = 0.0f;
+    for (size_t i = 0; i < mesh->number_of_vertices; i++)
+        radius2 = fmaxf(radius2, glm_vec3_distance2(sphere, &mesh->vertex_data[i * MESH_VERTEX_STRIDE]));
+    sphere[3] = sqrtf(radius2);
+}
+
 void Mesh_Destroy(struct Mesh *m)
 {
     tinyobj_attrib_free(&m->attribute);
@@ -347,15 +551,35 @@ void Mesh_Destroy(struct Mesh *m)
         m->number_of_materials = 0;
     }
 
-    if (m->triangle)
+    if (m->cache_map.data)
+    {
+        File_Unmap(&m->cache_map); // vertex and index data live in the mapping
+    }
+    else
     {
-        free(m->triangle);
-        m->triangle            = NULL;
-        m->number_of_triangles = 0;
+        free(m->vertex_data);
+        free(m->index_data);
+        free(m->clusters);
+        free(m->draw_ranges);
     }
+    m->vertex_data           = NULL;
+    m->index_data            = NULL;
+    m->number_of_vertices    = 0;
+    m->number_of_indices     = 0;
+    m->clusters              = NULL;
+    m->number_of_clusters    = 0;
+    m->draw_ranges           = NULL;
+    m->number_of_draw_ranges = 0;
+
+    for (size_t i = 0; i < m->number_of_textures; i++)
+        Texture_Cache_Release(m->textures[i]);
+    free(m->textures);
+    m->textures           = NULL;
+    m->number_of_textures = 0;
+
+    m->number_of_triangles = 0;
 
     DESTROY_TEXTURE(m->ambient_tex);
-    DESTROY_TEXTURE(m->diffuse_tex);
     DESTROY_TEXTURE(m->specular_tex);
     DESTROY_TEXTURE(m->specular_highlight_tex);
     DESTROY_TEXTURE(m->bump_tex);
@@ -5,26 +5,10 @@
 
 #include "cglm/cglm.h"
 #include "tex.h"
+#include "utils/file_map.h"
 
 #include "tinyobj_loader_c.h"
 
-typedef struct
-{
-    /* vertices */
-    vec3 v0;
-    vec3 v1;
-    vec3 v2;
-
-    /* normals */
-    vec3 n0;
-    vec3 n1;
-    vec3 n2;
-
-    /* texture coordinates */
-    vec3 u; /* u0, u1, u2*/
-    vec3 v; /* v0, v1, v2*/
-} triang;
-
 /*
 Here we are converting the data from tinyObj into glm vec3
 instead of
@@ -45,6 +29,39 @@ typedef struct
     vec3 *v; /* v0, v1, v2*/
 } index_triang;
 
+#define MESH_VERTEX_STRIDE 5 /* {posX, posY, posZ}{texU, texV} */
+
+#define MESH_CLUSTER_TRIANGLES 64
+
+/*
+A run of triangles in the index buffer that are close together (a meshlet), drawn, sorted and culled as one
+    - Back facing test : dot(centre - camera, cone_axis) >= cone_cutoff * length(centre - camera) + radius
+*/
+typedef struct
+{
+    uint32_t first_index;
+    uint32_t number_of_indices;
+    uint32_t first_vertex; // Range of the vertex buffer the indices use
+    uint32_t number_of_vertices;
+    vec3     centre; // Bounding sphere, object space
+    float    radius;
+    vec3     cone_axis;   // Normal cone, object space
+    float    cone_cutoff; // Sine of the cone angle, 1 when the triangles face too many ways to be culled
+} MeshCluster_t;
+
+/* A run of the index buffer drawn with one material, the index buffer is grouped by material */
+typedef struct
+{
+    uint32_t first_index;
+    uint32_t number_of_indices;
+    uint32_t first_vertex; // Range of the vertex buffer the indices use
+    uint32_t number_of_vertices;
+    uint32_t first_cluster; // Clusters of this range, they never cross into another range
+    uint32_t number_of_clusters;
+    int32_t  material_id;     // Into materials, -1 for faces without a material
+    int32_t  diffuse_texture; // Into textures, -1 when the material has no diffuse texture
+} MeshDrawRange_t;
+
 struct Mesh
 {
     tinyobj_attrib_t    attribute;
@@ -54,10 +71,26 @@ struct Mesh
     size_t              number_of_materials;
 
     unsigned int number_of_triangles;
-    triang      *triangle;
+
+    /* Ready to bind vertex and index buffers */
+    float    *vertex_data;
+    size_t    number_of_vertices;
+    uint32_t *index_data;
+    size_t    number_of_indices;
+
+    MeshCluster_t *clusters;
+    size_t         number_of_clusters;
+
+    MeshDrawRange_t *draw_ranges;
+    size_t           number_of_draw_ranges;
+
+    file_map_t cache_map; // Set when the buffers above point into a mapped cache file
+
+    /* Diffuse textures of every material, handles from the texture cache, NULL when the file was not found */
+    texture_t **textures;
+    size_t      number_of_textures;
 
     texture_t *ambient_tex;            // map_Ka   ambient_tex
-    texture_t *diffuse_tex;            // map_Kd   diffuse_tex
     texture_t *specular_tex;           // map_Ks   specular_tex
     texture_t *specular_highlight_tex; // map_Ns   specular_highlight_tex
     texture_t *bump_tex;               // map_bump bump_tex
@@ -68,4 +101,52 @@ struct Mesh
 struct Mesh Mesh_Load(const char *file_name);
 void        Mesh_Destroy(struct Mesh *m);
 
+/* Object space bounding sphere of the whole mesh, {centre x, y, z, radius} */
+void Mesh_Bounding_Sphere(const struct Mesh *mesh, vec4 sphere);
+
+/*
+Take the textures named by the materials from the texture cache into mesh->textures,
+relative paths are tried from the working directory then next to the .obj
+*/
+#define MESH_TEXTURE_PATH_SIZE 1024
+void Mesh_Load_Textures(struct Mesh *mesh, const char *obj_file_name, const char *const *texture_names, size_t number_of_textures);
+
+/*
+Files at least this big are parsed across the job system instead of by tinyobj_parse_obj
+    - The job system has to be running before Mesh_Load is called
+    - Call Mesh_Load from the main thread only. The job queue has one producer, and jobs_complete_all_work resets it
+*/
+#define OBJ_PARALLEL_PARSE_MIN_SIZE (4 * 1024 * 1024)
+
+int Obj_Parse_Parallel(tinyobj_attrib_t *attrib, tinyobj_shape_t **shapes, size_t *number_of_shapes,
+                       tinyobj_material_t **materials, size_t *number_of_materials,
+                       const char *buffer, size_t length, const char *file_name,
+                       file_reader_callback file_reader, void *ctx);
+
+/*
+Reorder the index buffer for the post transform vertex cache and the vertex buffer
+for fetch locality at load time, prints the ACMR (average cache miss ratio) before and after
+*/
+#define MESH_OPTIMIZE_VERTEX_CACHE
+
+float Mesh_Compute_ACMR(const uint32_t *indices, size_t number_of_indices);
+void  Mesh_Optimize_Vertex_Cache(uint32_t *indices, size_t number_of_indices, size_t number_of_vertices);
+void  Mesh_Optimize_Vertex_Fetch(struct Mesh *mesh);
+
+/*
+Split each draw range of the index buffer into clusters of MESH_CLUSTER_TRIANGLES triangles and reorder the clusters
+so the ones facing out from the centre of the mesh come first, this lowers overdraw from any view.
+At runtime the clusters are also sorted front to back before setup
+*/
+#define MESH_BUILD_CLUSTERS
+
+void Mesh_Build_Clusters(struct Mesh *mesh);
+
+/* The range of the vertex buffer each cluster and draw range uses, so only the vertices that are drawn get processed */
+void Mesh_Compute_Vertex_Ranges(struct Mesh *mesh);
+
+/* Binary cache of the vertex/index buffers written next to the .obj file */
+bool Mesh_Cache_Load(const char *obj_file_name, struct Mesh *mesh);
+void Mesh_Cache_Write(const char *obj_file_name, const struct Mesh *mesh);
+
 #endif // __OBJ_H__
\ No newline at end of file
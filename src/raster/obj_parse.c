@@ -0,0 +1,651 @@
+#include "obj.h"
+
+#include <string.h>
+
+#include "utils/utils.h"
+#include "job_system/js.h"
+
+#ifndef TINYOBJ_INVALID_INDEX
+    #define TINYOBJ_INVALID_INDEX (0x80000000)
+#endif
+
+/*
+Parallel .obj parsing
+    - The file is split into chunks at line boundaries, each chunk is parsed by a job into its own arrays
+    - Only the records we use are parsed : v, vt, vn, f, o, g, usemtl, mtllib
+    - Once every chunk is done a prefix sum over the chunk counts gives each chunk its offset into
+        the final arrays, a second set of jobs copies the chunks into place
+    - Positive indices are absolute so they can be used as is, negative (relative) indices depend on how many
+        vertices came before the chunk, these are written down and fixed up with the chunk offset when merging
+    - Faces are triangulated as a fan, the same as TINYOBJ_FLAG_TRIANGULATE
+The output is the same tinyobj_attrib_t/shape/material data tinyobj_parse_obj gives us
+*/
+
+#define OBJ_PARSE_NUMBER_OF_CHUNKS ((NUM_OF_THREADS + 1) * 4)
+
+enum
+{
+    INDEX_V = 0,
+    INDEX_VT,
+    INDEX_VN,
+};
+
+typedef struct
+{
+    size_t corner; // index into the chunks faces
+    int    type;   // INDEX_V, INDEX_VT, INDEX_VN
+    int    local;  // number of elements before this line in the chunk + the relative index
+} IndexFixup_t;
+
+typedef struct
+{
+    char  *name;
+    size_t local_face; // first triangle this applies to
+} NamedRange_t;
+
+typedef struct
+{
+    void  *data;
+    size_t count;
+    size_t capacity;
+} Array_t;
+
+typedef struct
+{
+    const char *begin;
+    const char *end;
+
+    Array_t vertices;  // float * 3
+    Array_t normals;   // float * 3
+    Array_t texcoords; // float * 2
+    Array_t faces;     // tinyobj_vertex_index_t, 3 per triangle
+    Array_t fixups;    // IndexFixup_t
+    Array_t shapes;    // NamedRange_t, "o" and "g"
+    Array_t materials; // NamedRange_t, "usemtl"
+    Array_t mtllibs;   // char *
+    Array_t corners;   // tinyobj_vertex_index_t, the corners of the face being parsed, any number of them
+
+    /* Filled in by the prefix sum */
+    size_t vertex_offset, normal_offset, texcoord_offset, face_offset;
+
+    tinyobj_attrib_t *attrib; // Output for the merge job
+
+    bool failed;
+} ObjChunk_t;
+
+static void *Array_Push(Array_t *array, const size_t element_size, const size_t count, bool *failed)
+{
+    if (array->count + count > array->capacity)
+    {
+        size_t new_capacity = array->capacity ? array->capacity * 2 : 1024;
+        while (new_capacity < array->count + count)
+            new_capacity *= 2;
+
+        void *new_data = realloc(array->data, new_capacity * element_size);
+        if (new_data == NULL)
+        {
+            *failed = true;
+            return NULL;
+        }
+        array->data     = new_data;
+        array->capacity = new_capacity;
+    }
+
+    void *element = (uint8_t *)array->data + array->count * element_size;
+    array->count += count;
+    return element;
+}
+
+static inline bool Is_Space(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *Skip_Space(const char *p, const char *end)
+{
+    while (p < end && Is_Space(*p))
+        ++p;
+    return p;
+}
+
+static inline const char *Skip_Line(const char *p, const char *end)
+{
+    while (p < end && *p != '\n')
+        ++p;
+    return (p < end) ? p + 1 : end;
+}
+
+static float Parse_Float(const char **cursor, const char *end)
+{
+    static const double powers_of_10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                          1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                          1e20, 1e21, 1e22};
+
+    const char *p = Skip_Space(*cursor, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+    double   value    = 0.0;
+    int      exponent = 0;
+    uint64_t mantissa = 0;
+    int      digits   = 0;
+
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+        if (digits++ < 19)
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        else
+            ++exponent;
+    }
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+        {
+            if (digits++ < 19)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative_exponent = (*p++ == '-');
+
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+            e = (e < 10000) ? e * 10 + (*p - '0') : e;
+        exponent += negative_exponent ? -e : e;
+    }
+
+    value = (double)mantissa;
+    while (exponent > 22)
+    {
+        value *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22)
+    {
+        value /= 1e22;
+        exponent += 22;
+    }
+    value = (exponent >= 0) ? value * powers_of_10[exponent] : value / powers_of_10[-exponent];
+
+    *cursor = p;
+    return (float)(negative ? -value : value);
+}
+
+static bool Parse_Int(const char **cursor, const char *end, int *out)
+{
+    const char *p = *cursor;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+    if (p >= end || *p < '0' || *p > '9')
+        return false;
+
+    int value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+        value = value * 10 + (*p - '0');
+
+    *out    = negative ? -value : value;
+    *cursor = p;
+    return true;
+}
+
+/* Copy the rest of the line, without trailing white space */
+static char *Parse_Name(const char *p, const char *end)
+{
+    p = Skip_Space(p, end);
+
+    const char *name_end = p;
+    while (name_end < end && *name_end != '\n')
+        ++name_end;
+    while (name_end > p && Is_Space(name_end[-1]))
+        --name_end;
+
+    const size_t length = (size_t)(name_end - p);
+    char        *name   = malloc(length + 1);
+    if (name)
+    {
+        memcpy(name, p, length);
+        name[length] = '\0';
+    }
+    return name;
+}
+
+static int Resolve_Index(ObjChunk_t *chunk, const int index, const size_t local_count, const size_t corner, const int type)
+{
+    if (index > 0)
+        return index - 1;
+
+    // Relative index, we dont know the global offset until all the chunks are done
+    IndexFixup_t *fixup = Array_Push(&chunk->fixups, sizeof(IndexFixup_t), 1, &chunk->failed);
+    if (fixup)
+    {
+        fixup->corner = corner;
+        fixup->type   = type;
+        fixup->local  = (int)local_count + index;
+    }
+    return 0;
+}
+
+static void Parse_Face(ObjChunk_t *chunk, const char *p, const char *end)
+{
+    chunk->corners.count = 0;
+
+    for (;;)
+    {
+        p = Skip_Space(p, end);
+
+        int v = 0, vt = 0, vn = 0;
+        if (!Parse_Int(&p, end, &v))
+            break;
+
+        if (p < end && *p == '/')
+        {
+            ++p;
+            Parse_Int(&p, end, &vt); // v//vn has no texture index
+            if (p < end && *p == '/')
+            {
+                ++p;
+                Parse_Int(&p, end, &vn);
+            }
+        }
+
+        tinyobj_vertex_index_t *corner = Array_Push(&chunk->corners, sizeof(tinyobj_vertex_index_t), 1, &chunk->failed);
+        if (!corner)
+            return;
+
+        corner->v_idx  = v;
+        corner->vt_idx = vt;
+        corner->vn_idx = vn;
+    }
+
+    const tinyobj_vertex_index_t *corners           = (const tinyobj_vertex_index_t *)chunk->corners.data;
+    const size_t                  number_of_corners = chunk->corners.count;
+    if (number_of_corners < 3)
+        return;
+
+    const size_t v_count  = chunk->vertices.count / 3;
+    const size_t vt_count = chunk->texcoords.count / 2;
+    const size_t vn_count = chunk->normals.count / 3;
+
+    // Fan triangulation : (0, i, i + 1)
+    const size_t number_of_triangles = number_of_corners - 2;
+
+    tinyobj_vertex_index_t *out = Array_Push(&chunk->faces, sizeof(tinyobj_vertex_index_t), number_of_triangles * 3, &chunk->failed);
+    if (!out)
+        return;
+
+    const size_t first_corner = chunk->faces.count - number_of_triangles * 3;
+    for (size_t t = 0; t < number_of_triangles; t++)
+    {
+        const int fan[3] = {0, (int)t + 1, (int)t + 2};
+        for (int k = 0; k < 3; k++)
+        {
+            const tinyobj_vertex_index_t in     = corners[fan[k]];
+            const size_t                 corner = first_corner + t * 3 + k;
+
+            tinyobj_vertex_index_t *dest = &out[t * 3 + k];
+            dest->v_idx                  = Resolve_Index(chunk, in.v_idx, v_count, corner, INDEX_V);
+            dest->vt_idx                 = in.vt_idx ? Resolve_Index(chunk, in.vt_idx, vt_count, corner, INDEX_VT) : (int)TINYOBJ_INVALID_INDEX;
+            dest->vn_idx                 = in.vn_idx ? Resolve_Index(chunk, in.vn_idx, vn_count, corner, INDEX_VN) : (int)TINYOBJ_INVALID_INDEX;
+        }
+    }
+}
+
+static void Push_Named_Range(ObjChunk_t *chunk, Array_t *array, const char *p, const char *end)
+{
+    NamedRange_t *range = Array_Push(array, sizeof(NamedRange_t), 1, &chunk->failed);
+    if (range)
+    {
+        range->name       = Parse_Name(p, end);
+        range->local_face = chunk->faces.count / 3;
+    }
+}
+
+static void Obj_Parse_Chunk(void *data)
+{
+    ObjChunk_t *chunk = (ObjChunk_t *)data;
+
+    const char *end = chunk->end;
+    for (const char *line = chunk->begin; line < end && !chunk->failed; line = Skip_Line(line, end))
+    {
+        const char *p = Skip_Space(line, end);
+        if (p >= end)
+            break;
+
+        const size_t remaining = (size_t)(end - p);
+
+        if (p[0] == 'v' && remaining > 1 && Is_Space(p[1]))
+        {
+            float *v = Array_Push(&chunk->vertices, sizeof(float), 3, &chunk->failed);
+            if (!v)
+                break;
+            p += 2;
+            v[0] = Parse_Float(&p, end);
+            v[1] = Parse_Float(&p, end);
+            v[2] = Parse_Float(&p, end);
+        }
+        else if (p[0] == 'v' && remaining > 2 && p[1] == 't' && Is_Space(p[2]))
+        {
+            float *vt = Array_Push(&chunk->texcoords, sizeof(float), 2, &chunk->failed);
+            if (!vt)
+                break;
+            p += 3;
+            vt[0] = Parse_Float(&p, end);
+            vt[1] = Parse_Float(&p, end);
+        }
+        else if (p[0] == 'v' && remaining > 2 && p[1] == 'n' && Is_Space(p[2]))
+        {
+            float *vn = Array_Push(&chunk->normals, sizeof(float), 3, &chunk->failed);
+            if (!vn)
+                break;
+            p += 3;
+            vn[0] = Parse_Float(&p, end);
+            vn[1] = Parse_Float(&p, end);
+            vn[2] = Parse_Float(&p, end);
+        }
+        else if (p[0] == 'f' && remaining > 1 && Is_Space(p[1]))
+        {
+            Parse_Face(chunk, p + 2, end);
+        }
+        else if ((p[0] == 'o' || p[0] == 'g') && remaining > 1 && Is_Space(p[1]))
+        {
+            Push_Named_Range(chunk, &chunk->shapes, p + 2, end);
+        }
+        else if (remaining > 7 && strncmp(p, "usemtl", 6) == 0 && Is_Space(p[6]))
+        {
+            Push_Named_Range(chunk, &chunk->materials, p + 7, end);
+        }
+        else if (remaining > 7 && strncmp(p, "mtllib", 6) == 0 && Is_Space(p[6]))
+        {
+            char **mtllib = Array_Push(&chunk->mtllibs, sizeof(char *), 1, &chunk->failed);
+            if (mtllib)
+                *mtllib = Parse_Name(p + 7, end);
+        }
+        // Everything else (comments, s, l, p...) is skipped
+    }
+}
+
+static void Obj_Merge_Chunk(void *data)
+{
+    ObjChunk_t       *chunk  = (ObjChunk_t *)data;
+    tinyobj_attrib_t *attrib = chunk->attrib;
+
+    memcpy(attrib->vertices + chunk->vertex_offset * 3, chunk->vertices.data, chunk->vertices.count * sizeof(float));
+    memcpy(attrib->normals + chunk->normal_offset * 3, chunk->normals.data, chunk->normals.count * sizeof(float));
+    memcpy(attrib->texcoords + chunk->texcoord_offset * 2, chunk->texcoords.data, chunk->texcoords.count * sizeof(float));
+
+    tinyobj_vertex_index_t *faces = attrib->faces + chunk->face_offset * 3;
+    memcpy(faces, chunk->faces.data, chunk->faces.count * sizeof(tinyobj_vertex_index_t));
+
+    const IndexFixup_t *fixups = (const IndexFixup_t *)chunk->fixups.data;
+    for (size_t i = 0; i < chunk->fixups.count; i++)
+    {
+        const IndexFixup_t fix = fixups[i];
+        switch (fix.type)
+        {
+        case INDEX_V:
+            faces[fix.corner].v_idx = (int)chunk->vertex_offset + fix.local;
+            break;
+        case INDEX_VT:
+            faces[fix.corner].vt_idx = (int)chunk->texcoord_offset + fix.local;
+            break;
+        case INDEX_VN:
+            faces[fix.corner].vn_idx = (int)chunk->normal_offset + fix.local;
+            break;
+        }
+    }
+
+    const size_t number_of_triangles = chunk->faces.count / 3;
+    for (size_t i = 0; i < number_of_triangles; i++)
+        attrib->face_num_verts[chunk->face_offset + i] = 3;
+}
+
+static void Free_Chunk(ObjChunk_t *chunk)
+{
+    NamedRange_t *shapes = (NamedRange_t *)chunk->shapes.data;
+    for (size_t i = 0; i < chunk->shapes.count; i++)
+        free(shapes[i].name);
+
+    NamedRange_t *materials = (NamedRange_t *)chunk->materials.data;
+    for (size_t i = 0; i < chunk->materials.count; i++)
+        free(materials[i].name);
+
+    char **mtllibs = (char **)chunk->mtllibs.data;
+    for (size_t i = 0; i < chunk->mtllibs.count; i++)
+        free(mtllibs[i]);
+
+    free(chunk->vertices.data);
+    free(chunk->normals.data);
+    free(chunk->texcoords.data);
+    free(chunk->faces.data);
+    free(chunk->fixups.data);
+    free(chunk->shapes.data);
+    free(chunk->materials.data);
+    free(chunk->mtllibs.data);
+    free(chunk->corners.data);
+}
+
+static int Load_Materials(ObjChunk_t *chunks, const size_t number_of_chunks,
+                          tinyobj_material_t **materials, size_t *number_of_materials,
+                          const char *file_name, file_reader_callback file_reader, void *ctx)
+{
+    *materials           = NULL;
+    *number_of_materials = 0;
+
+    for (size_t c = 0; c < number_of_chunks; c++)
+    {
+        char **mtllibs = (char **)chunks[c].mtllibs.data;
+        for (size_t i = 0; i < chunks[c].mtllibs.count; i++)
+        {
+            tinyobj_material_t *lib_materials   = NULL;
+            size_t              number_from_lib = 0;
+
+            const int ret = tinyobj_parse_mtl_file(&lib_materials, &number_from_lib, mtllibs[i], file_name, file_reader, ctx);
+            if (ret != TINYOBJ_SUCCESS || number_from_lib == 0)
+            {
+                fprintf(stderr, "Failed to load material library : %s\n", mtllibs[i]);
+                continue;
+            }
+
+            tinyobj_material_t *combined = realloc(*materials, sizeof(tinyobj_material_t) * (*number_of_materials + number_from_lib));
+            if (combined == NULL)
+            {
+                tinyobj_materials_free(lib_materials, number_from_lib);
+                return TINYOBJ_ERROR_FILE_OPERATION;
+            }
+            memcpy(combined + *number_of_materials, lib_materials, sizeof(tinyobj_material_t) * number_from_lib);
+            free(lib_materials); // the strings now belong to the combined array
+
+            *materials = combined;
+            *number_of_materials += number_from_lib;
+        }
+    }
+    return TINYOBJ_SUCCESS;
+}
+
+static int Find_Material(const tinyobj_material_t *materials, const size_t number_of_materials, const char *name)
+{
+    for (size_t i = 0; i < number_of_materials; i++)
+    {
+        if (materials[i].name && name && strcmp(materials[i].name, name) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+int Obj_Parse_Parallel(tinyobj_attrib_t *attrib, tinyobj_shape_t **shapes, size_t *number_of_shapes,
+                       tinyobj_material_t **materials, size_t *number_of_materials,
+                       const char *buffer, const size_t length, const char *file_name,
+                       file_reader_callback file_reader, void *ctx)
+{
+    ASSERT(buffer && length > 0);
+
+    memset(attrib, 0, sizeof(tinyobj_attrib_t));
+    *shapes              = NULL;
+    *number_of_shapes    = 0;
+    *materials           = NULL;
+    *number_of_materials = 0;
+
+    /* Per call rather than static, nothing of one parse is left behind for the next */
+    ObjChunk_t *chunks = calloc(OBJ_PARSE_NUMBER_OF_CHUNKS, sizeof(ObjChunk_t));
+    if (chunks == NULL)
+        return TINYOBJ_ERROR_FILE_OPERATION;
+
+    /* Split at line boundaries */
+    const char *const end              = buffer + length;
+    const char       *chunk_start      = buffer;
+    size_t            number_of_chunks = 0;
+    for (size_t i = 0; i < OBJ_PARSE_NUMBER_OF_CHUNKS && chunk_start < end; i++)
+    {
+        const char *chunk_end = (i == OBJ_PARSE_NUMBER_OF_CHUNKS - 1) ? end : buffer + (length / OBJ_PARSE_NUMBER_OF_CHUNKS) * (i + 1);
+        chunk_end             = (chunk_end < chunk_start) ? chunk_start : chunk_end;
+        chunk_end             = (chunk_end < end) ? Skip_Line(chunk_end, end) : end;
+
+        chunks[number_of_chunks].begin = chunk_start;
+        chunks[number_of_chunks].end   = chunk_end;
+        number_of_chunks++;
+
+        chunk_start = chunk_end;
+    }
+
+    for (size_t i = 0; i < number_of_chunks; i++)
+        job_submit((job_t){Obj_Parse_Chunk, (void *)&chunks[i]});
+    jobs_complete_all_work();
+
+    /* Prefix sum of the chunk counts gives each chunk its place in the final arrays */
+    size_t total_vertices = 0, total_normals = 0, total_texcoords = 0, total_triangles = 0;
+    bool   failed         = false;
+    for (size_t i = 0; i < number_of_chunks; i++)
+    {
+        ObjChunk_t *chunk      = &chunks[i];
+        chunk->vertex_offset   = total_vertices;
+        chunk->normal_offset   = total_normals;
+        chunk->texcoord_offset = total_texcoords;
+        chunk->face_offset     = total_triangles;
+        chunk->attrib          = attrib;
+
+        total_vertices += chunk->vertices.count / 3;
+        total_normals += chunk->normals.count / 3;
+        total_texcoords += chunk->texcoords.count / 2;
+        total_triangles += chunk->faces.count / 3;
+
+        failed |= chunk->failed;
+    }
+
+    int ret = failed ? TINYOBJ_ERROR_FILE_OPERATION : TINYOBJ_SUCCESS;
+    if (ret == TINYOBJ_SUCCESS && total_triangles == 0)
+        ret = TINYOBJ_ERROR_EMPTY;
+
+    if (ret == TINYOBJ_SUCCESS)
+    {
+        attrib->num_vertices       = (unsigned int)total_vertices;
+        attrib->num_normals        = (unsigned int)total_normals;
+        attrib->num_texcoords      = (unsigned int)total_texcoords;
+        attrib->num_faces          = (unsigned int)(total_triangles * 3);
+        attrib->num_face_num_verts = (unsigned int)total_triangles;
+
+        attrib->vertices       = malloc(sizeof(float) * total_vertices * 3 + 1);
+        attrib->normals        = malloc(sizeof(float) * total_normals * 3 + 1);
+        attrib->texcoords      = malloc(sizeof(float) * total_texcoords * 2 + 1);
+        attrib->faces          = malloc(sizeof(tinyobj_vertex_index_t) * total_triangles * 3);
+        attrib->face_num_verts = malloc(sizeof(int) * total_triangles);
+        attrib->material_ids   = malloc(sizeof(int) * total_triangles);
+
+        if (!attrib->vertices || !attrib->normals || !attrib->texcoords || !attrib->faces || !attrib->face_num_verts || !attrib->material_ids)
+            ret = TINYOBJ_ERROR_FILE_OPERATION;
+    }
+
+    if (ret == TINYOBJ_SUCCESS)
+    {
+        for (size_t i = 0; i < number_of_chunks; i++)
+            job_submit((job_t){Obj_Merge_Chunk, (void *)&chunks[i]});
+        jobs_complete_all_work();
+
+        ret = Load_Materials(chunks, number_of_chunks, materials, number_of_materials, file_name, file_reader, ctx);
+    }
+
+    if (ret == TINYOBJ_SUCCESS)
+    {
+        /* Material ids, every triangle after a "usemtl" uses that material */
+        int    current_material = -1;
+        size_t next_face        = 0;
+        for (size_t c = 0; c < number_of_chunks; c++)
+        {
+            const NamedRange_t *ranges = (const NamedRange_t *)chunks[c].materials.data;
+            for (size_t i = 0; i < chunks[c].materials.count; i++)
+            {
+                const size_t start = chunks[c].face_offset + ranges[i].local_face;
+                for (; next_face < start; next_face++)
+                    attrib->material_ids[next_face] = current_material;
+                current_material = Find_Material(*materials, *number_of_materials, ranges[i].name);
+            }
+        }
+        for (; next_face < total_triangles; next_face++)
+            attrib->material_ids[next_face] = current_material;
+
+        /* Shapes, faces before the first "o"/"g" go into an unnamed shape */
+        size_t total_shapes = 0;
+        for (size_t c = 0; c < number_of_chunks; c++)
+            total_shapes += chunks[c].shapes.count;
+
+        *shapes = malloc(sizeof(tinyobj_shape_t) * (total_shapes + 1));
+        if (*shapes == NULL)
+            ret = TINYOBJ_ERROR_FILE_OPERATION;
+
+        size_t shape_count = 0;
+        for (size_t c = 0; c < number_of_chunks && ret == TINYOBJ_SUCCESS; c++)
+        {
+            NamedRange_t *ranges = (NamedRange_t *)chunks[c].shapes.data;
+            for (size_t i = 0; i < chunks[c].shapes.count; i++)
+            {
+                const size_t start = chunks[c].face_offset + ranges[i].local_face;
+                if (shape_count == 0 && start > 0)
+                {
+                    (*shapes)[shape_count++] = (tinyobj_shape_t){.name = NULL, .face_offset = 0};
+                }
+                if (shape_count > 0)
+                    (*shapes)[shape_count - 1].length = (unsigned int)(start - (*shapes)[shape_count - 1].face_offset);
+
+                (*shapes)[shape_count++] = (tinyobj_shape_t){.name = ranges[i].name, .face_offset = (unsigned int)start};
+                ranges[i].name           = NULL; // now owned by the shape
+            }
+        }
+        if (ret == TINYOBJ_SUCCESS)
+        {
+            if (shape_count == 0)
+                (*shapes)[shape_count++] = (tinyobj_shape_t){.name = NULL, .face_offset = 0};
+            (*shapes)[shape_count - 1].length = (unsigned int)(total_triangles - (*shapes)[shape_count - 1].face_offset);
+
+            *number_of_shapes = shape_count;
+        }
+    }
+
+    for (size_t i = 0; i < number_of_chunks; i++)
+        Free_Chunk(&chunks[i]);
+    free(chunks);
+
+    if (ret != TINYOBJ_SUCCESS)
+    {
+        tinyobj_attrib_free(attrib);
+        if (*shapes)
+            tinyobj_shapes_free(*shapes, *number_of_shapes);
+        if (*materials)
+            tinyobj_materials_free(*materials, *number_of_materials);
+        *shapes           = NULL;
+        *number_of_shapes = 0;
+        *materials        = NULL;
+    }
+
+    return ret;
+}
@@ -1,13 +1,15 @@
+#include <float.h>
+
 #include "renderer.h"
 #include "utils/utils.h"
-#include "graphics.h"
 
 #include "job_system/js.h"
+#include "utils/trace.h"
 
 typedef struct TriangleRasterData
 {
-    size_t stride;
-    size_t number_of_triangles;
+    int32_t stride;
+    size_t  number_of_batches; // 4 triangles to a batch
 } TriangleRasterData_t;
 
 static inline void Inpterpolate_Attribute(VaryingAttributes_t *varying, InterpolatedPixel_t *res, const __m128 W_vals[3], const __m128 w0, const __m128 w1, const __m128 w2, const __m128 interFactor)
@@ -16,24 +18,24 @@ static inline void Inpterpolate_Attribute(VaryingAttributes_t *varying, Interpol
     {
         // TODO : Better naming here plz
         __m128 X[3];
-        X[0] = _mm_set1_ps(varying[0].vec4_attribute[i].vec.m128_f32[0]);
-        X[1] = _mm_set1_ps(varying[1].vec4_attribute[i].vec.m128_f32[0]);
-        X[2] = _mm_set1_ps(varying[2].vec4_attribute[i].vec.m128_f32[0]);
+        X[0] = _mm_set1_ps(Lane_F32(varying[0].vec4_attribute[i].vec, 0));
+        X[1] = _mm_set1_ps(Lane_F32(varying[1].vec4_attribute[i].vec, 0));
+        X[2] = _mm_set1_ps(Lane_F32(varying[2].vec4_attribute[i].vec, 0));
 
         __m128 Y[3];
-        Y[0] = _mm_set1_ps(varying[0].vec4_attribute[i].vec.m128_f32[1]);
-        Y[1] = _mm_set1_ps(varying[1].vec4_attribute[i].vec.m128_f32[1]);
-        Y[2] = _mm_set1_ps(varying[2].vec4_attribute[i].vec.m128_f32[1]);
+        Y[0] = _mm_set1_ps(Lane_F32(varying[0].vec4_attribute[i].vec, 1));
+        Y[1] = _mm_set1_ps(Lane_F32(varying[1].vec4_attribute[i].vec, 1));
+        Y[2] = _mm_set1_ps(Lane_F32(varying[2].vec4_attribute[i].vec, 1));
 
         __m128 Z[3];
-        Z[0] = _mm_set1_ps(varying[0].vec4_attribute[i].vec.m128_f32[2]);
-        Z[1] = _mm_set1_ps(varying[1].vec4_attribute[i].vec.m128_f32[2]);
-        Z[2] = _mm_set1_ps(varying[2].vec4_attribute[i].vec.m128_f32[2]);
+        Z[0] = _mm_set1_ps(Lane_F32(varying[0].vec4_attribute[i].vec, 2));
+        Z[1] = _mm_set1_ps(Lane_F32(varying[1].vec4_attribute[i].vec, 2));
+        Z[2] = _mm_set1_ps(Lane_F32(varying[2].vec4_attribute[i].vec, 2));
 
         __m128 W[3];
-        W[0] = _mm_set1_ps(varying[0].vec4_attribute[i].vec.m128_f32[3]);
-        W[1] = _mm_set1_ps(varying[1].vec4_attribute[i].vec.m128_f32[3]);
-        W[2] = _mm_set1_ps(varying[2].vec4_attribute[i].vec.m128_f32[3]);
+        W[0] = _mm_set1_ps(Lane_F32(varying[0].vec4_attribute[i].vec, 3));
+        W[1] = _mm_set1_ps(Lane_F32(varying[1].vec4_attribute[i].vec, 3));
+        W[2] = _mm_set1_ps(Lane_F32(varying[2].vec4_attribute[i].vec, 3));
 
         res->vec4_attribute[i].mX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(X[0], w0), _mm_mul_ps(X[1], w1)), _mm_mul_ps(X[2], w2));
         res->vec4_attribute[i].mY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Y[0], w0), _mm_mul_ps(Y[1], w1)), _mm_mul_ps(Y[2], w2));
@@ -50,19 +52,19 @@ static inline void Inpterpolate_Attribute(VaryingAttributes_t *varying, Interpol
     {
         // NOTE: Could we transpose this?
         __m128 X[3];
-        X[0] = _mm_set1_ps(varying[0].vec3_attribute[i].vec.m128_f32[0]);
-        X[1] = _mm_set1_ps(varying[1].vec3_attribute[i].vec.m128_f32[0]);
-        X[2] = _mm_set1_ps(varying[2].vec3_attribute[i].vec.m128_f32[0]);
+        X[0] = _mm_set1_ps(Lane_F32(varying[0].vec3_attribute[i].vec, 0));
+        X[1] = _mm_set1_ps(Lane_F32(varying[1].vec3_attribute[i].vec, 0));
+        X[2] = _mm_set1_ps(Lane_F32(varying[2].vec3_attribute[i].vec, 0));
 
         __m128 Y[3];
-        Y[0] = _mm_set1_ps(varying[0].vec3_attribute[i].vec.m128_f32[1]);
-        Y[1] = _mm_set1_ps(varying[1].vec3_attribute[i].vec.m128_f32[1]);
-        Y[2] = _mm_set1_ps(varying[2].vec3_attribute[i].vec.m128_f32[1]);
+        Y[0] = _mm_set1_ps(Lane_F32(varying[0].vec3_attribute[i].vec, 1));
+        Y[1] = _mm_set1_ps(Lane_F32(varying[1].vec3_attribute[i].vec, 1));
+        Y[2] = _mm_set1_ps(Lane_F32(varying[2].vec3_attribute[i].vec, 1));
 
         __m128 Z[3];
-        Z[0] = _mm_set1_ps(varying[0].vec3_attribute[i].vec.m128_f32[2]);
-        Z[1] = _mm_set1_ps(varying[1].vec3_attribute[i].vec.m128_f32[2]);
-        Z[2] = _mm_set1_ps(varying[2].vec3_attribute[i].vec.m128_f32[2]);
+        Z[0] = _mm_set1_ps(Lane_F32(varying[0].vec3_attribute[i].vec, 2));
+        Z[1] = _mm_set1_ps(Lane_F32(varying[1].vec3_attribute[i].vec, 2));
+        Z[2] = _mm_set1_ps(Lane_F32(varying[2].vec3_attribute[i].vec, 2));
 
         res->vec3_attribute[i].mX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(X[0], w0), _mm_mul_ps(X[1], w1)), _mm_mul_ps(X[2], w2));
         res->vec3_attribute[i].mY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Y[0], w0), _mm_mul_ps(Y[1], w1)), _mm_mul_ps(Y[2], w2));
@@ -76,14 +78,14 @@ static inline void Inpterpolate_Attribute(VaryingAttributes_t *varying, Interpol
     for (size_t i = 0; i < NUMBER_OF_VARYING_VE2_ATTRIBUTES; i++)
     {
         __m128 U[3];
-        U[0] = _mm_set1_ps(varying[0].vec2_attribute[i].vec.m128_f32[0]);
-        U[1] = _mm_set1_ps(varying[1].vec2_attribute[i].vec.m128_f32[0]);
-        U[2] = _mm_set1_ps(varying[2].vec2_attribute[i].vec.m128_f32[0]);
+        U[0] = _mm_set1_ps(Lane_F32(varying[0].vec2_attribute[i].vec, 0));
+        U[1] = _mm_set1_ps(Lane_F32(varying[1].vec2_attribute[i].vec, 0));
+        U[2] = _mm_set1_ps(Lane_F32(varying[2].vec2_attribute[i].vec, 0));
 
         __m128 V[3];
-        V[0] = _mm_set1_ps(varying[0].vec2_attribute[i].vec.m128_f32[1]);
-        V[1] = _mm_set1_ps(varying[1].vec2_attribute[i].vec.m128_f32[1]);
-        V[2] = _mm_set1_ps(varying[2].vec2_attribute[i].vec.m128_f32[1]);
+        V[0] = _mm_set1_ps(Lane_F32(varying[0].vec2_attribute[i].vec, 1));
+        V[1] = _mm_set1_ps(Lane_F32(varying[1].vec2_attribute[i].vec, 1));
+        V[2] = _mm_set1_ps(Lane_F32(varying[2].vec2_attribute[i].vec, 1));
 
         U[0] = _mm_mul_ps(U[0], W_vals[0]);
         U[1] = _mm_mul_ps(U[1], W_vals[1]);
@@ -101,15 +103,12 @@ static inline void Inpterpolate_Attribute(VaryingAttributes_t *varying, Interpol
     }
 }
 
-static void Raster_Triangles(void *data)
+/* Integer edge function version of Raster_Triangle_Batchf, Raster_Triangles_MT does not use it */
+void Raster_Triangle_Batch(size_t current_triangle_index)
 {
-    TriangleRasterData_t *rd = (TriangleRasterData_t *)data;
-
-    // const size_t max_index              = rd->number_of_triangles;
-    size_t current_triangle_index = (Platform_InterlockedIncrement((int32_t *)&rd->stride) - 1) * 4;
-
     const __m128i x_pixel_offset = _mm_setr_epi32(0, 1, 2, 3); // X value offsets
     const __m128i y_pixel_offset = _mm_setr_epi32(0, 0, 0, 0); // Y value offsets
+    const __m128i colour_swizzle = _mm_loadu_si128((const __m128i *)RenderState.colour_swizzle);
 
     /* 4 Triangles, with 3 vertices */
     __m128       collected_vertices[4][3] = {0};
@@ -121,10 +120,10 @@ static void Raster_Triangles(void *data)
     size_t number_of_collected_triangles = 0;
     for (size_t i = 0; i < 4; i++)
     {
-        if (current_triangle_index > Trianges_To_Be_Rastered_Counter)
+        if (current_triangle_index >= Trianges_To_Be_Rastered_Counter)
             break;
 
-        CHECK_ARRAY_BOUNDS(current_triangle_index, MAX_NUMBER_OF_TRIANGLES_TO_RASTER);
+        CHECK_ARRAY_BOUNDS(current_triangle_index, Trianges_To_Be_Rastered_Capacity);
         collected_raster_data[i] = Trianges_To_Be_Rastered[current_triangle_index++];
 
         collected_vertices[i][0] = collected_raster_data[i].ss_v0;
@@ -200,16 +199,16 @@ static void Raster_Triangles(void *data)
     */
     for (int lane = 0; lane < number_of_collected_triangles; lane++) // Now we have 4 triangles set up.  Rasterize them each individually.
     {
-        const float area_value = oneOverTriArea.m128_f32[lane];
+        const float area_value = Lane_F32(oneOverTriArea, lane);
         if (area_value < 0.0f)
             continue;
 
         const __m128 inv_area = _mm_set1_ps(area_value);
 
-        const int startXx = startX.m128i_i32[lane];
-        const int endXx   = endX.m128i_i32[lane];
-        const int startYy = startY.m128i_i32[lane];
-        const int endYy   = endY.m128i_i32[lane];
+        const int startXx = Lane_I32(startX, lane);
+        const int endXx   = Lane_I32(endX, lane);
+        const int startYy = Lane_I32(startY, lane);
+        const int endYy   = Lane_I32(endY, lane);
 
         ASSERT(startXx >= 0 && startXx < IMAGE_W);
         ASSERT(endXx >= 0 && endXx < IMAGE_W);
@@ -218,22 +217,22 @@ static void Raster_Triangles(void *data)
         ASSERT(endYy >= 0 && endYy < IMAGE_H);
 
         __m128 Z[3];
-        Z[0] = _mm_set1_ps(Z_values[0].m128_f32[lane]);
-        Z[1] = _mm_set1_ps(Z_values[1].m128_f32[lane]);
-        Z[2] = _mm_set1_ps(Z_values[2].m128_f32[lane]);
+        Z[0] = _mm_set1_ps(Lane_F32(Z_values[0], lane));
+        Z[1] = _mm_set1_ps(Lane_F32(Z_values[1], lane));
+        Z[2] = _mm_set1_ps(Lane_F32(Z_values[2], lane));
 
         __m128 W[3];
-        W[0] = _mm_set1_ps(W_values[0].m128_f32[lane]);
-        W[1] = _mm_set1_ps(W_values[1].m128_f32[lane]);
-        W[2] = _mm_set1_ps(W_values[2].m128_f32[lane]);
+        W[0] = _mm_set1_ps(Lane_F32(W_values[0], lane));
+        W[1] = _mm_set1_ps(Lane_F32(W_values[1], lane));
+        W[2] = _mm_set1_ps(Lane_F32(W_values[2], lane));
 
-        const __m128i a0 = _mm_set1_epi32(A0.m128i_i32[lane]);
-        const __m128i a1 = _mm_set1_epi32(A1.m128i_i32[lane]);
-        const __m128i a2 = _mm_set1_epi32(A2.m128i_i32[lane]);
+        const __m128i a0 = _mm_set1_epi32(Lane_I32(A0, lane));
+        const __m128i a1 = _mm_set1_epi32(Lane_I32(A1, lane));
+        const __m128i a2 = _mm_set1_epi32(Lane_I32(A2, lane));
 
-        const __m128i b0 = _mm_set1_epi32(B0.m128i_i32[lane]);
-        const __m128i b1 = _mm_set1_epi32(B1.m128i_i32[lane]);
-        const __m128i b2 = _mm_set1_epi32(B2.m128i_i32[lane]);
+        const __m128i b0 = _mm_set1_epi32(Lane_I32(B0, lane));
+        const __m128i b1 = _mm_set1_epi32(Lane_I32(B1, lane));
+        const __m128i b2 = _mm_set1_epi32(Lane_I32(B2, lane));
 
         // Add our SIMD pixel offset to our starting pixel location, so we are doing 4 pixels in the x axis
         // so we add 0, 1, 2, 3, to the starting x value, y isnt changing
@@ -255,9 +254,9 @@ static void Raster_Triangles(void *data)
         // Order of triangle sides *IMPORTANT*
         // E(x, y) = a*x + b*y + c;
         // v1, v2 :  w0_row = (A12 * p.x) + (B12 * p.y) + C12;
-        __m128i E0 = _mm_add_epi32(_mm_add_epi32(A0_start, B0_start), _mm_set1_epi32(C0.m128i_i32[lane]));
-        __m128i E1 = _mm_add_epi32(_mm_add_epi32(A1_start, B1_start), _mm_set1_epi32(C1.m128i_i32[lane]));
-        __m128i E2 = _mm_add_epi32(_mm_add_epi32(A2_start, B2_start), _mm_set1_epi32(C2.m128i_i32[lane]));
+        __m128i E0 = _mm_add_epi32(_mm_add_epi32(A0_start, B0_start), _mm_set1_epi32(Lane_I32(C0, lane)));
+        __m128i E1 = _mm_add_epi32(_mm_add_epi32(A1_start, B1_start), _mm_set1_epi32(Lane_I32(C1, lane)));
+        __m128i E2 = _mm_add_epi32(_mm_add_epi32(A2_start, B2_start), _mm_set1_epi32(Lane_I32(C2, lane)));
 
         // Since we are doing SIMD, we need to calcaulte our step amount
         // E(x+L, y) = E(x) + L dy (where dy is out a0 values)
@@ -275,14 +274,14 @@ static void Raster_Triangles(void *data)
         // Generate masks used for tie-breaking rules (not to double-shade along shared edges)
         // there is no _mm_cmpge_epi32, so use lt and swap operands
         // _mm_cmplt_epi32(bb0Inc, _mm_setzero_si128()) - becomes - _mm_cmplt_epi32(_mm_setzero_si128(), bb0Inc)
-        const __m128i Edge0TieBreak = _mm_or_epi32(_mm_cmpgt_epi32(A0_inc, _mm_setzero_si128()),
-                                                   _mm_and_epi32(_mm_cmplt_epi32(_mm_setzero_si128(), B0_inc), _mm_cmpeq_epi32(A0_inc, _mm_setzero_si128())));
+        const __m128i Edge0TieBreak = _mm_or_si128(_mm_cmpgt_epi32(A0_inc, _mm_setzero_si128()),
+                                                   _mm_and_si128(_mm_cmplt_epi32(_mm_setzero_si128(), B0_inc), _mm_cmpeq_epi32(A0_inc, _mm_setzero_si128())));
 
-        const __m128i Edge1TieBreak = _mm_or_epi32(_mm_cmpgt_epi32(A1_inc, _mm_setzero_si128()),
-                                                   _mm_and_epi32(_mm_cmplt_epi32(_mm_setzero_si128(), B1_inc), _mm_cmpeq_epi32(A1_inc, _mm_setzero_si128())));
+        const __m128i Edge1TieBreak = _mm_or_si128(_mm_cmpgt_epi32(A1_inc, _mm_setzero_si128()),
+                                                   _mm_and_si128(_mm_cmplt_epi32(_mm_setzero_si128(), B1_inc), _mm_cmpeq_epi32(A1_inc, _mm_setzero_si128())));
 
-        const __m128i Edge2TieBreak = _mm_or_epi32(_mm_cmpgt_epi32(A2_inc, _mm_setzero_si128()),
-                                                   _mm_and_epi32(_mm_cmplt_epi32(_mm_setzero_si128(), B2_inc), _mm_cmpeq_epi32(A2_inc, _mm_setzero_si128())));
+        const __m128i Edge2TieBreak = _mm_or_si128(_mm_cmpgt_epi32(A2_inc, _mm_setzero_si128()),
+                                                   _mm_and_si128(_mm_cmplt_epi32(_mm_setzero_si128(), B2_inc), _mm_cmpeq_epi32(A2_inc, _mm_setzero_si128())));
 
         __m128 Zstep = _mm_mul_ps(_mm_cvtepi32_ps(A1_inc), Z[1]);
         Zstep        = _mm_add_ps(Zstep, _mm_mul_ps(_mm_cvtepi32_ps(A2_inc), Z[2]));
@@ -311,23 +310,23 @@ static void Raster_Triangles(void *data)
                 // Test Pixel inside triangle
                 const __m128i Edge0Positive = _mm_cmpgt_epi32(alpha, _mm_setzero_si128());
                 const __m128i Edge0Negative = _mm_cmplt_epi32(alpha, _mm_setzero_si128());
-                const __m128i Edge0FuncMask = _mm_or_epi32(Edge0Positive,
-                                                           _mm_andnot_epi32(Edge0Negative, Edge0TieBreak));
+                const __m128i Edge0FuncMask = _mm_or_si128(Edge0Positive,
+                                                           _mm_andnot_si128(Edge0Negative, Edge0TieBreak));
 
                 // Edge 1 test
                 const __m128i Edge1Positive = _mm_cmpgt_epi32(beta, _mm_setzero_si128());
                 const __m128i Edge1Negative = _mm_cmplt_epi32(beta, _mm_setzero_si128());
-                const __m128i Edge1FuncMask = _mm_or_epi32(Edge1Positive,
-                                                           _mm_andnot_epi32(Edge1Negative, Edge1TieBreak));
+                const __m128i Edge1FuncMask = _mm_or_si128(Edge1Positive,
+                                                           _mm_andnot_si128(Edge1Negative, Edge1TieBreak));
 
                 // Edge 2 test
                 const __m128i Edge2Positive = _mm_cmpgt_epi32(gama, _mm_setzero_si128());
                 const __m128i Edge2Negative = _mm_cmplt_epi32(gama, _mm_setzero_si128());
-                const __m128i Edge2FuncMask = _mm_or_epi32(Edge2Positive,
-                                                           _mm_andnot_epi32(Edge2Negative, Edge2TieBreak));
+                const __m128i Edge2FuncMask = _mm_or_si128(Edge2Positive,
+                                                           _mm_andnot_si128(Edge2Negative, Edge2TieBreak));
 
                 // Combine resulting masks of all three edges
-                __m128i mask = _mm_and_epi32(Edge0FuncMask, _mm_and_epi32(Edge1FuncMask, Edge2FuncMask));
+                __m128i mask = _mm_and_si128(Edge0FuncMask, _mm_and_si128(Edge1FuncMask, Edge2FuncMask));
 
                 /* Check if pixel is inside the triangle */
                 // const __m128i or_mask = _mm_or_si128(_mm_or_si128(alpha, beta), gama);
@@ -372,13 +371,10 @@ static void Raster_Triangles(void *data)
 
                 uint8_t frag_colour[4][4] = {0};
                 for (int i = 0; i < 4; i++)
-                    FRAGMENT_SHADER(&res, i, &RenderState.data_from_vertex_shader, frag_colour[i]);
+                    FRAGMENT_SHADER(&res, i, collected_raster_data[lane].data_from_vertex_shader, frag_colour[i]);
 
-                // Dont even ask about this pixel format
-                const __m128i combined_colours = _mm_set_epi8(frag_colour[3][3], frag_colour[3][0], frag_colour[3][1], frag_colour[3][2],
-                                                              frag_colour[2][3], frag_colour[2][0], frag_colour[2][1], frag_colour[2][2],
-                                                              frag_colour[1][3], frag_colour[1][0], frag_colour[1][1], frag_colour[1][2],
-                                                              frag_colour[0][3], frag_colour[0][0], frag_colour[0][1], frag_colour[0][2]);
+                // RGBA fragments into the colour buffer's byte order
+                const __m128i combined_colours = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)frag_colour), colour_swizzle);
 
                 uint8_t *const pixel_location = &RenderState.colour_buffer[index * IMAGE_BPP];
 
@@ -402,14 +398,15 @@ static void Raster_Triangles(void *data)
     }
 }
 
-static void Raster_Trianglesf(void *data)
-{
-    TriangleRasterData_t *rd = (TriangleRasterData_t *)data;
-
-    size_t current_triangle_index = (Platform_InterlockedIncrement((int32_t *)&rd->stride) - 1) * 4;
+/* Pixels set in each 4 bit movemask */
+static const uint8_t Raster_Bits_Set[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
 
+void Raster_Triangle_Batchf(size_t current_triangle_index, PipelineStatistics_t *stats)
+{
     const __m128 x_pixel_offset = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); // X value offsets
     const __m128 y_pixel_offset = _mm_setr_ps(0.0f, 0.0f, 0.0f, 0.0f); // Y value offsets
+
+    const __m128i colour_swizzle = _mm_loadu_si128((const __m128i *)RenderState.colour_swizzle);
     // const __m128 x_pixel_offset = _mm_setr_ps(0.0f, 1.5f, 2.5f, 3.5f); // X value offsets
     // const __m128 y_pixel_offset = _mm_setr_ps(0.5f, 0.5f, 0.5f, 0.5f); // Y value offsets
 
@@ -423,10 +420,10 @@ static void Raster_Trianglesf(void *data)
     size_t number_of_collected_triangles = 0;
     for (size_t i = 0; i < 4; i++)
     {
-        if (current_triangle_index > Trianges_To_Be_Rastered_Counter)
+        if (current_triangle_index >= Trianges_To_Be_Rastered_Counter)
             break;
 
-        CHECK_ARRAY_BOUNDS(current_triangle_index, MAX_NUMBER_OF_TRIANGLES_TO_RASTER);
+        CHECK_ARRAY_BOUNDS(current_triangle_index, Trianges_To_Be_Rastered_Capacity);
         collected_raster_data[i] = Trianges_To_Be_Rastered[current_triangle_index++];
 
         collected_vertices[i][0] = collected_raster_data[i].ss_v0;
@@ -457,11 +454,20 @@ static void Raster_Trianglesf(void *data)
     }
 
     // Use bounding box traversal strategy to determine which pixels to rasterize
-    const __m128 startX = _mm_max_ps(_mm_min_ps(_mm_min_ps(X_values[0], X_values[1]), X_values[2]), _mm_set1_ps(0.0f));
-    const __m128 endX   = _mm_min_ps(_mm_max_ps(_mm_max_ps(X_values[0], X_values[1]), X_values[2]), _mm_set1_ps(IMAGE_W));
+    const __m128 minX = _mm_min_ps(_mm_min_ps(X_values[0], X_values[1]), X_values[2]);
+    const __m128 maxX = _mm_max_ps(_mm_max_ps(X_values[0], X_values[1]), X_values[2]);
+    const __m128 minY = _mm_min_ps(_mm_min_ps(Y_values[0], Y_values[1]), Y_values[2]);
+    const __m128 maxY = _mm_max_ps(_mm_max_ps(Y_values[0], Y_values[1]), Y_values[2]);
+
+    const __m128 startX = _mm_max_ps(minX, _mm_set1_ps(0.0f));
+    const __m128 endX   = _mm_min_ps(maxX, _mm_set1_ps(IMAGE_W));
+
+    const __m128 startY = _mm_max_ps(minY, _mm_set1_ps(0.0f));
+    const __m128 endY   = _mm_min_ps(maxY, _mm_set1_ps(IMAGE_H));
 
-    const __m128 startY = _mm_max_ps(_mm_min_ps(_mm_min_ps(Y_values[0], Y_values[1]), Y_values[2]), _mm_set1_ps(0.0f));
-    const __m128 endY   = _mm_min_ps(_mm_max_ps(_mm_max_ps(Y_values[0], Y_values[1]), Y_values[2]), _mm_set1_ps(IMAGE_H));
+    // Triangles crossing the edge of the screen, the clamping above is all the clipping they get
+    const int clipped_mask = _mm_movemask_ps(_mm_or_ps(_mm_or_ps(_mm_cmplt_ps(minX, _mm_setzero_ps()), _mm_cmpgt_ps(maxX, _mm_set1_ps(IMAGE_W))),
+                                                       _mm_or_ps(_mm_cmplt_ps(minY, _mm_setzero_ps()), _mm_cmpgt_ps(maxY, _mm_set1_ps(IMAGE_H)))));
 
     // Counter clockwise triangles
     const __m128 A0 = _mm_sub_ps(Y_values[2], Y_values[1]); // 0 - 1
@@ -489,21 +495,35 @@ static void Raster_Trianglesf(void *data)
     Z_values[1] = _mm_mul_ps(_mm_sub_ps(Z_values[1], Z_values[0]), oneOverTriArea);
     Z_values[2] = _mm_mul_ps(_mm_sub_ps(Z_values[2], Z_values[0]), oneOverTriArea);
 
+    const int zero_area_lanes = _mm_movemask_ps(_mm_cmpeq_ps(triArea, _mm_setzero_ps()));
+
     /* lane is the counter for how many triangles were loaded, if only 3 were loaded, it
         should only be 3, etc...
     */
     for (int lane = 0; lane < number_of_collected_triangles; lane++) // Now we have 4 triangles set up.  Rasterize them each individually.
     {
-        const float area_value = oneOverTriArea.m128_f32[lane];
+        if (zero_area_lanes & (1 << lane))
+        {
+            PIPELINE_STATISTICS_ADD(stats, triangles_culled_zero_area, 1);
+            continue;
+        }
+
+        const float area_value = Lane_F32(oneOverTriArea, lane);
         if (area_value < 0.0f)
+        {
+            PIPELINE_STATISTICS_ADD(stats, triangles_culled_back_face, 1);
             continue;
+        }
+
+        PIPELINE_STATISTICS_ADD(stats, triangles_rasterized, 1);
+        PIPELINE_STATISTICS_ADD(stats, triangles_clipped, (clipped_mask >> lane) & 1);
 
         const __m128 inv_area = _mm_set1_ps(area_value);
 
-        const int startXx = (const int)startX.m128_f32[lane];
-        const int endXx   = (const int)endX.m128_f32[lane];
-        const int startYy = (const int)startY.m128_f32[lane];
-        const int endYy   = (const int)endY.m128_f32[lane];
+        const int startXx = (const int)Lane_F32(startX, lane);
+        const int endXx   = (const int)Lane_F32(endX, lane);
+        const int startYy = (const int)Lane_F32(startY, lane);
+        const int endYy   = (const int)Lane_F32(endY, lane);
 
         ASSERT(startXx >= 0 && startXx < IMAGE_W);
         ASSERT(endXx >= 0 && endXx < IMAGE_W);
@@ -512,22 +532,22 @@ static void Raster_Trianglesf(void *data)
         ASSERT(endYy >= 0 && endYy < IMAGE_H);
 
         __m128 Z[3];
-        Z[0] = _mm_set1_ps(Z_values[0].m128_f32[lane]);
-        Z[1] = _mm_set1_ps(Z_values[1].m128_f32[lane]);
-        Z[2] = _mm_set1_ps(Z_values[2].m128_f32[lane]);
+        Z[0] = _mm_set1_ps(Lane_F32(Z_values[0], lane));
+        Z[1] = _mm_set1_ps(Lane_F32(Z_values[1], lane));
+        Z[2] = _mm_set1_ps(Lane_F32(Z_values[2], lane));
 
         __m128 W[3];
-        W[0] = _mm_set1_ps(W_values[0].m128_f32[lane]);
-        W[1] = _mm_set1_ps(W_values[1].m128_f32[lane]);
-        W[2] = _mm_set1_ps(W_values[2].m128_f32[lane]);
+        W[0] = _mm_set1_ps(Lane_F32(W_values[0], lane));
+        W[1] = _mm_set1_ps(Lane_F32(W_values[1], lane));
+        W[2] = _mm_set1_ps(Lane_F32(W_values[2], lane));
 
-        const __m128 a0 = _mm_set1_ps(A0.m128_f32[lane]);
-        const __m128 a1 = _mm_set1_ps(A1.m128_f32[lane]);
-        const __m128 a2 = _mm_set1_ps(A2.m128_f32[lane]);
+        const __m128 a0 = _mm_set1_ps(Lane_F32(A0, lane));
+        const __m128 a1 = _mm_set1_ps(Lane_F32(A1, lane));
+        const __m128 a2 = _mm_set1_ps(Lane_F32(A2, lane));
 
-        const __m128 b0 = _mm_set1_ps(B0.m128_f32[lane]);
-        const __m128 b1 = _mm_set1_ps(B1.m128_f32[lane]);
-        const __m128 b2 = _mm_set1_ps(B2.m128_f32[lane]);
+        const __m128 b0 = _mm_set1_ps(Lane_F32(B0, lane));
+        const __m128 b1 = _mm_set1_ps(Lane_F32(B1, lane));
+        const __m128 b2 = _mm_set1_ps(Lane_F32(B2, lane));
 
         // Add our SIMD pixel offset to our starting pixel location, so we are doing 4 pixels in the x axis
         // so we add 0, 1, 2, 3, to the starting x value, y isnt changing
@@ -549,9 +569,9 @@ static void Raster_Trianglesf(void *data)
         // Order of triangle sides *IMPORTANT*
         // E(x, y) = a*x + b*y + c;
         // v1, v2 :  w0_row = (A12 * p.x) + (B12 * p.y) + C12;
-        __m128 E0 = _mm_add_ps(_mm_add_ps(A0_start, B0_start), _mm_set1_ps(C0.m128_f32[lane]));
-        __m128 E1 = _mm_add_ps(_mm_add_ps(A1_start, B1_start), _mm_set1_ps(C1.m128_f32[lane]));
-        __m128 E2 = _mm_add_ps(_mm_add_ps(A2_start, B2_start), _mm_set1_ps(C2.m128_f32[lane]));
+        __m128 E0 = _mm_add_ps(_mm_add_ps(A0_start, B0_start), _mm_set1_ps(Lane_F32(C0, lane)));
+        __m128 E1 = _mm_add_ps(_mm_add_ps(A1_start, B1_start), _mm_set1_ps(Lane_F32(C1, lane)));
+        __m128 E2 = _mm_add_ps(_mm_add_ps(A2_start, B2_start), _mm_set1_ps(Lane_F32(C2, lane)));
 
         // Since we are doing SIMD, we need to calcaulte our step amount
         // E(x+L, y) = E(x) + L dy (where dy is out a0 values)
@@ -623,6 +643,8 @@ static void Raster_Trianglesf(void *data)
                 // Combine resulting masks of all three edges
                 __m128 mask = _mm_and_ps(Edge0FuncMask, _mm_and_ps(Edge1FuncMask, Edge2FuncMask));
 
+                PIPELINE_STATISTICS_ADD(stats, spans_tested, 1);
+
                 /* Check if pixel is inside the triangle */
                 // const __m128i or_mask = _mm_or_si128(_mm_or_si128(alpha, betaa), gamaa);
                 //__m128i       mask    = _mm_cmpgt_epi32(or_mask, _mm_setzero_si128());
@@ -630,7 +652,10 @@ static void Raster_Trianglesf(void *data)
 #if 1
                 const uint16_t maskInt = (uint16_t)_mm_movemask_ps(mask);
                 if (maskInt == 0x0)
+                {
+                    PIPELINE_STATISTICS_ADD(stats, spans_rejected_coverage, 1);
                     continue;
+                }
 #else
                 if (_mm_test_all_zeros(mask, mask))
                     continue;
@@ -643,10 +668,16 @@ static void Raster_Trianglesf(void *data)
                 const __m128 sseDepthRes        = _mm_cmplt_ps(depth, previousDepthValue);
 
                 if ((uint16_t)_mm_movemask_ps(sseDepthRes) == 0x0)
+                {
+                    PIPELINE_STATISTICS_ADD(stats, spans_rejected_depth, 1);
                     continue;
+                }
 
                 const __m128 sseWriteMask = _mm_and_ps(sseDepthRes, mask);
 
+                PIPELINE_STATISTICS_ADD(stats, fragments_shaded, 4);
+                PIPELINE_STATISTICS_ADD(stats, fragments_written, Raster_Bits_Set[_mm_movemask_ps(sseWriteMask)]);
+
                 const __m128 finaldepth = _mm_blendv_ps(previousDepthValue, depth, sseWriteMask);
                 _mm_store_ps(pDepthBuffer, finaldepth);
 
@@ -667,13 +698,10 @@ static void Raster_Trianglesf(void *data)
 
                 uint8_t frag_colour[4][4] = {0};
                 for (int i = 0; i < 4; i++)
-                    FRAGMENT_SHADER(&res, i, &RenderState.data_from_vertex_shader, frag_colour[i]);
+                    FRAGMENT_SHADER(&res, i, collected_raster_data[lane].data_from_vertex_shader, frag_colour[i]);
 
-                // Dont even ask about this pixel format
-                const __m128i combined_colours = _mm_set_epi8(frag_colour[3][3], frag_colour[3][0], frag_colour[3][1], frag_colour[3][2],
-                                                              frag_colour[2][3], frag_colour[2][0], frag_colour[2][1], frag_colour[2][2],
-                                                              frag_colour[1][3], frag_colour[1][0], frag_colour[1][1], frag_colour[1][2],
-                                                              frag_colour[0][3], frag_colour[0][0], frag_colour[0][1], frag_colour[0][2]);
+                // RGBA fragments into the colour buffer's byte order
+                const __m128i combined_colours = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)frag_colour), colour_swizzle);
 
                 uint8_t *const pixel_location = &RenderState.colour_buffer[index * IMAGE_BPP];
 
@@ -697,17 +725,39 @@ static void Raster_Trianglesf(void *data)
     }
 }
 
-void Raster_Triangles_MT(void)
+static void Raster_Trianglesf(void *data)
+{
+    TriangleRasterData_t *rd = (TriangleRasterData_t *)data;
+
+    TraceScope_t         trace = Trace_Begin("Raster_Trianglesf");
+    PipelineStatistics_t stats = {0};
+
+    size_t batch;
+    while (Render_Next_Work_Item(&rd->stride, rd->number_of_batches, &batch))
+        Raster_Triangle_Batchf(batch * 4, &stats);
+
+    Pipeline_Statistics_Add(&stats);
+    Trace_End(&trace);
+}
+
+void Raster_Triangles_Submit(void)
 {
     static TriangleRasterData_t rd = {0};
     rd.stride                      = 0;
-    // rd.number_of_triangles         = Trianges_To_Be_Rastered_Counter;
+    rd.number_of_batches           = (Trianges_To_Be_Rastered_Counter + 3) / 4;
 
-    const size_t tmp = Trianges_To_Be_Rastered_Counter / 4;
+    const size_t tmp = (rd.number_of_batches < RENDER_JOBS_PER_STAGE) ? rd.number_of_batches : RENDER_JOBS_PER_STAGE;
     job_t        job = {Raster_Trianglesf, (void *)&rd};
 
     for (size_t i = 0; i < tmp; i++)
         job_submit(job);
+}
+
+void Raster_Triangles_MT(void)
+{
+    Raster_Triangles_Submit();
 
+    TraceScope_t trace = Trace_Begin("Wait Raster_Trianglesf");
     jobs_complete_all_work();
+    Trace_End(&trace);
 }
\ No newline at end of file
@@ -1,6 +1,201 @@
 #include "renderer.h"
 
-RendererState_t RenderState = {0};
+#define TRACE_IMPLEMENTATION
+#include "utils/trace.h"
 
-RasterData_t Trianges_To_Be_Rastered[MAX_NUMBER_OF_TRIANGLES_TO_RASTER] = {0};
-size_t       Trianges_To_Be_Rastered_Counter                            = 0;
\ No newline at end of file
+/* 64 byte aligned for the SIMD loads and stores, and so no two targets share a cache line */
+static ALIGNED(64) uint8_t Render_Colour_Targets[RENDER_TARGET_COUNT][IMAGE_W * IMAGE_H * IMAGE_BPP];
+static ALIGNED(64) float   Render_Depth_Buffer[IMAGE_W * IMAGE_H];
+
+const uint8_t Render_Colour_Format_Offsets[RENDER_FORMAT_COUNT][4] = {
+    [RENDER_FORMAT_BGRA] = {2, 1, 0, 3},
+    [RENDER_FORMAT_RGBA] = {0, 1, 2, 3},
+    [RENDER_FORMAT_ARGB] = {1, 2, 3, 0},
+    [RENDER_FORMAT_ABGR] = {3, 2, 1, 0},
+};
+
+RendererState_t RenderState = {
+    .colour_buffer  = Render_Colour_Targets[0],
+    .depth_buffer   = Render_Depth_Buffer,
+    .colour_format  = RENDER_FORMAT_BGRA,
+    .colour_swizzle = {2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15},
+};
+
+RasterData_t *Trianges_To_Be_Rastered          = NULL;
+size_t        Trianges_To_Be_Rastered_Capacity = 0;
+size_t        Trianges_To_Be_Rastered_Counter  = 0;
+
+void Render_Set_Colour_Target(const size_t index)
+{
+    ASSERT(index < RENDER_TARGET_COUNT);
+    RenderState.colour_buffer = Render_Colour_Targets[index];
+}
+
+uint8_t *Render_Get_Colour_Target(const size_t index)
+{
+    ASSERT(index < RENDER_TARGET_COUNT);
+    return Render_Colour_Targets[index];
+}
+
+void Render_Set_Colour_Buffer(uint8_t *colour_buffer)
+{
+    ASSERT(colour_buffer);
+    RenderState.colour_buffer = colour_buffer;
+}
+
+void Render_Set_Colour_Format(const RenderColourFormat_t format)
+{
+    ASSERT(format < RENDER_FORMAT_COUNT);
+    RenderState.colour_format = format;
+
+    /* Byte 'offset' of every output pixel takes channel 'c' of the same fragment */
+    for (int pixel = 0; pixel < 4; pixel++)
+        for (int c = 0; c < 4; c++)
+            RenderState.colour_swizzle[pixel * 4 + Render_Colour_Format_Offsets[format][c]] = (uint8_t)(pixel * 4 + c);
+}
+
+void Render_Draw(const DrawCommand_t *draw)
+{
+    ASSERT(draw->vertex_buffer && draw->index_buffer);
+    ASSERT(draw->vertex_stride > 0);
+    ASSERT(draw->number_of_indices % 3 == 0);
+    ASSERT(draw->first_vertex + draw->number_of_vertices <= draw->vertex_buffer_length / draw->vertex_stride);
+    ASSERT(draw->instance_models == NULL || draw->instance_count > 0);
+
+    if (RenderState.number_of_draws == RenderState.draw_capacity)
+    {
+        RenderState.draw_capacity = (RenderState.draw_capacity) ? RenderState.draw_capacity * 2 : 64;
+        RenderState.draws         = realloc(RenderState.draws, sizeof(DrawCommand_t) * RenderState.draw_capacity);
+        ASSERT(RenderState.draws);
+    }
+    RenderState.draws[RenderState.number_of_draws++] = *draw;
+}
+
+void Convert_Depth_Buffer_For_Drawing(void)
+{
+    // Define the minimum and maximum depth values in your depth buffer
+    const float minDepth = 0.0f /* Set the minimum depth value */;
+    const float maxDepth = 10.0f /* Set the maximum depth value */;
+
+#if 0
+    // Iterate over each depth value in the depth buffer
+     for (size_t i = 0; i < IMAGE_W * IMAGE_H; ++i)
+    {
+         const float depthValue = RenderState.depth_buffer[i];
+
+        if (depthValue == FLT_MAX)
+            continue;
+
+        // Normalize the depth value between 0 and 1
+        const float normalizedDepth = ((depthValue - minDepth) / (maxDepth - minDepth));
+
+        // Map the normalized depth value to the range of 0 to 255
+        const uint8_t colorValue = (uint8_t)(normalizedDepth * 255.0f);
+
+        // Assign the color value to the RGBA color buffer
+        RenderState.colour_buffer[i * 4 + 0] = colorValue; // Red component
+        RenderState.colour_buffer[i * 4 + 1] = colorValue; // Green component
+        RenderState.colour_buffer[i * 4 + 2] = colorValue; // Blue component
+        RenderState.colour_buffer[i * 4 + 3] = 255;        // Alpha component (fully opaque)
+    }
+#else
+    // Load the minimum and maximum depth values into SIMD registers
+    __m128 minDepthVec = _mm_set1_ps(minDepth);
+    __m128 maxDepthVec = _mm_set1_ps(maxDepth);
+
+    // Iterate over each depth value in the depth buffer (processing 4 values at a time)
+    for (size_t i = 0; i < IMAGE_W * IMAGE_H; i += 4)
+    {
+        // Load 4 depth values from the depth buffer into a SIMD register
+        __m128 depthVec = _mm_load_ps(&RenderState.depth_buffer[i]);
+
+        __m128 cmp = _mm_cmpeq_ps(depthVec, _mm_set1_ps(FLT_MAX));
+
+        if (_mm_testz_si128(_mm_cvtps_epi32(cmp), _mm_cvtps_epi32(cmp)) == 0)
+            continue;
+
+        // Normalize the depth values between 0 and 1
+        __m128 normalizedDepthVec = _mm_div_ps(_mm_sub_ps(depthVec, minDepthVec), _mm_sub_ps(maxDepthVec, minDepthVec));
+
+        // Map the normalized depth values to the range of 0 to 255
+        __m128i colorValueVec = _mm_cvtps_epi32(_mm_mul_ps(normalizedDepthVec, _mm_set1_ps(255.0f)));
+
+        // Convert the packed integer values to 8-bit unsigned integers
+        __m128i colorValueU8Vec = _mm_packus_epi32(colorValueVec, colorValueVec);
+        colorValueU8Vec         = _mm_packus_epi16(colorValueU8Vec, colorValueU8Vec);
+
+        // Store the color values into the RGBA color buffer
+        _mm_storeu_si128((__m128i *)&RenderState.colour_buffer[i], colorValueU8Vec);
+    }
+#endif
+}
+
+/* Padded out to whole cache lines so no two threads write to the same line */
+typedef union
+{
+    PipelineStatistics_t stats;
+    uint8_t              padding[(sizeof(PipelineStatistics_t) + 63) & ~(size_t)63];
+} PipelineStatisticsSlot_t;
+
+static PipelineStatisticsSlot_t *Pipeline_Statistics_Slots[PIPELINE_STATISTICS_MAX_THREADS];
+static int32_t                   Pipeline_Statistics_Number_Of_Slots = 0;
+
+static THREAD_LOCAL PipelineStatisticsSlot_t *Pipeline_Statistics_This_Thread = NULL;
+
+void Pipeline_Statistics_Add(const PipelineStatistics_t *stats)
+{
+#ifdef PIPELINE_STATISTICS
+    PipelineStatisticsSlot_t *slot = Pipeline_Statistics_This_Thread;
+    if (slot == NULL)
+    {
+        const int32_t index = Platform_InterlockedIncrement(&Pipeline_Statistics_Number_Of_Slots) - 1;
+        ASSERT(index < PIPELINE_STATISTICS_MAX_THREADS);
+        if (index >= PIPELINE_STATISTICS_MAX_THREADS)
+            return;
+
+        slot = _mm_malloc(sizeof(PipelineStatisticsSlot_t), 64);
+        ASSERT(slot);
+        memset(slot, 0, sizeof(PipelineStatisticsSlot_t));
+
+        Pipeline_Statistics_Slots[index] = slot;
+        Pipeline_Statistics_This_Thread  = slot;
+    }
+
+    Pipeline_Statistics_Sum(&slot->stats, stats);
+#else
+    (void)stats;
+#endif
+}
+
+void Pipeline_Statistics_Collect(PipelineStatistics_t *frame)
+{
+    memset(frame, 0, sizeof(PipelineStatistics_t));
+
+    const int32_t number_of_slots = (Pipeline_Statistics_Number_Of_Slots < PIPELINE_STATISTICS_MAX_THREADS) ? Pipeline_Statistics_Number_Of_Slots : PIPELINE_STATISTICS_MAX_THREADS;
+    for (int32_t s = 0; s < number_of_slots; s++)
+    {
+        PipelineStatisticsSlot_t *slot = Pipeline_Statistics_Slots[s];
+        if (slot == NULL)
+            continue;
+
+        Pipeline_Statistics_Sum(frame, &slot->stats);
+        memset(&slot->stats, 0, sizeof(PipelineStatistics_t));
+    }
+}
+
+void Pipeline_Statistics_Print(const PipelineStatistics_t *stats)
+{
+    printf("Pipeline statistics\n");
+    printf("\tVertices shaded            : %llu\n", (unsigned long long)stats->vertices_shaded);
+    printf("\tTriangles submitted        : %llu\n", (unsigned long long)stats->triangles_submitted);
+    printf("\tTriangles culled frustum   : %llu\n", (unsigned long long)stats->triangles_culled_frustum);
+    printf("\tTriangles culled back face : %llu\n", (unsigned long long)stats->triangles_culled_back_face);
+    printf("\tTriangles culled zero area : %llu\n", (unsigned long long)stats->triangles_culled_zero_area);
+    printf("\tTriangles clipped          : %llu\n", (unsigned long long)stats->triangles_clipped);
+    printf("\tTriangles rasterized       : %llu\n", (unsigned long long)stats->triangles_rasterized);
+    printf("\tSpans tested               : %llu\n", (unsigned long long)stats->spans_tested);
+    printf("\tSpans rejected coverage    : %llu\n", (unsigned long long)stats->spans_rejected_coverage);
+    printf("\tSpans rejected depth       : %llu\n", (unsigned long long)stats->spans_rejected_depth);
+    printf("\tFragments shaded           : %llu\n", (unsigned long long)stats->fragments_shaded);
+    printf("\tFragments written          : %llu\n", (unsigned long long)stats->fragments_written);
+}
@@ -7,50 +7,242 @@
 #include "obj.h"
 #include "utils/mat4x4.h"
 #include "shaders.h"
+#include "job_system/js.h"
 
 #define IMAGE_W   1024
 #define IMAGE_H   512
 #define IMAGE_BPP 4
 
+/*
+Byte order of a colour buffer pixel in memory
+    - RENDER_FORMAT_BGRA is the default, SDL_PIXELFORMAT_ARGB8888 and RGB888 on little endian, what window surfaces
+        usually are. The others are the rest of the 4 byte SDL formats
+    - Every format costs the same to raster, the fragments are put in order with one shuffle
+*/
+typedef enum
+{
+    RENDER_FORMAT_BGRA = 0,
+    RENDER_FORMAT_RGBA,
+    RENDER_FORMAT_ARGB,
+    RENDER_FORMAT_ABGR,
+    RENDER_FORMAT_COUNT,
+} RenderColourFormat_t;
+
+/* The byte R, G, B and A are in, for each format */
+extern const uint8_t Render_Colour_Format_Offsets[RENDER_FORMAT_COUNT][4];
+
+/*
+One recorded draw
+    - The index range points into the index buffer, the vertex range is the part of the vertex buffer
+        those indices use, so only those vertices are shaded
+    - The texture is passed through the uniforms, the vertex shader hands it on to the fragment shader
+    - Instanced draws give a model matrix per instance, the vertex shader puts it on the right of the MVP
+        and the setup stage expands the instances itself, culling each against the view frustum first
+*/
 typedef struct
 {
-    mat4x4 view_port_matrix;
+    const float *vertex_buffer;
+    size_t       vertex_stride;
+    size_t       vertex_buffer_length;
+
+    const uint32_t *index_buffer;
+    size_t          first_index;
+    size_t          number_of_indices;
+
+    size_t first_vertex;
+    size_t number_of_vertices;
 
     void *vertex_shader_uniforms;
+    uint32_t sort_key; // Draws with the same key are set up together, e.g. the material, so they share a texture working set
+
+    /* Optional, without instance_models the draw is a single instance */
+    const mat4x4 *instance_models;
+    size_t        instance_count;
+    vec4          bounding_sphere; // Object space {centre, radius} for culling instances, a radius of 0 is never culled
 
-    int   *index_buffer; // void?
-    size_t index_buffer_length;
+    /* Optional, when set the setup stage works through the clusters front to back */
+    const MeshCluster_t *clusters;
+    size_t               number_of_clusters;
+    mat4x4               object_to_clip_matrix; // Used to sort and cull, the MVP of the mesh (without the instance model)
+    vec3                 camera_position;       // Object space before the instance model, for culling back facing clusters
 
-    void  *vertex_buffer;
-    size_t vertex_stride;
-    size_t vertex_buffer_length;
+    VSOutputForFS_t data_from_vertex_shader; // Written by the vertex stage, to pass onto the FS
+} DrawCommand_t;
 
-    VSOutputForFS_t data_from_vertex_shader; // To pass onto the FS
+typedef struct
+{
+    mat4x4 view_port_matrix;
+
+    /* Draws recorded for this frame, all of them are set up in one pass */
+    DrawCommand_t *draws;
+    size_t         number_of_draws;
+    size_t         draw_capacity;
 
-    uint8_t colour_buffer[IMAGE_W * IMAGE_H * IMAGE_BPP];
-    float   depth_buffer[IMAGE_W * IMAGE_H];
+    /* Where the raster stage draws, one of the RENDER_TARGET_COUNT colour targets and the one depth buffer */
+    uint8_t *colour_buffer;
+    float   *depth_buffer;
+
+    /* Byte order of colour_buffer, colour_swizzle shuffles 4 RGBA fragments into it */
+    RenderColourFormat_t colour_format;
+    uint8_t              colour_swizzle[16];
 
 } RendererState_t;
 
 extern RendererState_t RenderState;
 
+/*
+Colour targets, so a finished frame can be presented or written out while the next one is rastered
+    - Frame_Pipeline moves RenderState.colour_buffer from one to the next every frame, without it target 0 is always used
+    - Depth is only needed while rasterizing, there is a single depth buffer
+    - Render_Set_Colour_Buffer points the raster stage at memory the renderer does not own, e.g. the window
+        surface, IMAGE_W * IMAGE_H pixels of IMAGE_BPP bytes with nothing between the rows
+*/
+#define RENDER_TARGET_COUNT 3
+
+void     Render_Set_Colour_Target(size_t index);
+uint8_t *Render_Get_Colour_Target(size_t index);
+void     Render_Set_Colour_Buffer(uint8_t *colour_buffer);
+
+/* The raster kernels write the colour buffer in this byte order, so it can be whatever it is presented into */
+void Render_Set_Colour_Format(RenderColourFormat_t format);
+
 static inline void Render_Set_Viewport(int width, int height)
 {
     Raster_View_Port_Matrix(RenderState.view_port_matrix, (float)width, (float)height);
 }
 
+/* Move a position into the space the model matrix transforms from */
+static inline void Render_Object_Space_Position(const mat4x4 model, const vec3 position, vec3 object_space_position)
+{
+    mat4 inverse_model;
+    for (int i = 0; i < 4; i++)
+        _mm_store_ps(inverse_model[i], model[i]);
+    glm_mat4_inv(inverse_model, inverse_model);
+
+    vec4 result = {position[0], position[1], position[2], 1.0f};
+    glm_mat4_mulv(inverse_model, result, result);
+    glm_vec3_copy(result, object_space_position);
+}
+
+/* Move the world space camera position into the space of the mesh being drawn */
+static inline void Render_Set_Camera_Position(DrawCommand_t *draw, const mat4x4 model, const vec3 eye)
+{
+    Render_Object_Space_Position(model, eye, draw->camera_position);
+}
+
+/* Start recording the draws for a new frame */
+static inline void Render_Begin_Draws(void)
+{
+    RenderState.number_of_draws = 0;
+}
+
+/* Copies the draw into the command list, the buffers and uniforms it points to must live until the frame is rastered */
+void Render_Draw(const DrawCommand_t *draw);
+
+/*
+The job queue only holds MAX_NUMBER_OF_JOBS, a frame can have far more work items than that
+    - Each stage submits one job per thread and the jobs keep taking the next work item until there are none left
+    - The shared counter is an int32_t because that is what the interlocked increment takes, stages stay far below 2^31 items
+*/
+#define RENDER_JOBS_PER_STAGE (NUM_OF_THREADS + 1)
+
+static inline bool Render_Next_Work_Item(int32_t *next_item, const size_t number_of_items, size_t *item)
+{
+    *item = (size_t)(Platform_InterlockedIncrement(next_item) - 1);
+    return *item < number_of_items;
+}
+
+/* One lane of a vector, .m128_f32 and .m128i_i32 are MSVC only. The compiler keeps the spill in registers when 'lane' is a constant */
+static inline float Lane_F32(const __m128 v, const int lane)
+{
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return lanes[lane];
+}
+
+static inline int32_t Lane_I32(const __m128i v, const int lane)
+{
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return lanes[lane];
+}
+
 typedef struct
 {
     __m128 ss_v0, ss_v1, ss_v2; /* Screen Space */
     // float               area;
     VaryingAttributes_t varying[3];
+
+    VSOutputForFS_t *data_from_vertex_shader; // From the draw the triangle belongs to
 } RasterData_t;
 
-#define MAX_NUMBER_OF_TRIANGLES_TO_RASTER 4096
-extern RasterData_t Trianges_To_Be_Rastered[MAX_NUMBER_OF_TRIANGLES_TO_RASTER];
-extern size_t       Trianges_To_Be_Rastered_Counter;
+/* Grown by the setup stage to fit every triangle of the frame's draws */
+extern RasterData_t *Trianges_To_Be_Rastered;
+extern size_t        Trianges_To_Be_Rastered_Capacity;
+extern size_t        Trianges_To_Be_Rastered_Counter;
 
+/*
+The raster stage on the job system
+    - Raster_Triangles_MT returns once the frame is rastered
+    - Raster_Triangles_Submit only queues the jobs, the frame is rastered once jobs_complete_all_work returns.
+        The calling thread is free in between, Frame_Pipeline presents the previous frame there
+*/
 void Raster_Triangles_MT(void);
+void Raster_Triangles_Submit(void);
+
+/*
+Pipeline statistics, the same idea as the GL pipeline statistics queries
+    - Every thread adds to its own copy, on its own cache line, so counting needs no atomics
+    - The stages count into a local copy and add it to their thread's copy when the job is done
+    - Pipeline_Statistics_Collect adds up every thread's copy and clears them, call it once a frame
+        after the raster stage, when no jobs are running
+*/
+#define PIPELINE_STATISTICS
+#define PIPELINE_STATISTICS_MAX_THREADS 32
+
+typedef struct
+{
+    uint64_t vertices_shaded;
+    uint64_t triangles_submitted;        // Every triangle of every recorded instance
+    uint64_t triangles_culled_frustum;   // In instances or clusters outside the view frustum
+    uint64_t triangles_culled_back_face; // In clusters facing away from the camera, or on their own in the raster stage
+    uint64_t triangles_culled_zero_area;
+    uint64_t triangles_clipped; // Crossing the edge of the screen, there is no clipper so this is their bounding box being clamped
+    uint64_t triangles_rasterized;
+    uint64_t spans_tested; // 4 pixels side by side
+    uint64_t spans_rejected_coverage;
+    uint64_t spans_rejected_depth;
+    uint64_t fragments_shaded;  // Fragment shader calls, every pixel of a span that gets this far is shaded
+    uint64_t fragments_written; // Inside the triangle and passed the depth test
+} PipelineStatistics_t;
+
+#ifdef PIPELINE_STATISTICS
+    #define PIPELINE_STATISTICS_ADD(stats, counter, value) ((stats)->counter += (value))
+#else
+    #define PIPELINE_STATISTICS_ADD(stats, counter, value) ((void)0)
+#endif
+
+/* Every counter is a uint64_t, so they can be added up as an array */
+static inline void Pipeline_Statistics_Sum(PipelineStatistics_t *total, const PipelineStatistics_t *stats)
+{
+    const uint64_t *source = (const uint64_t *)stats;
+    uint64_t       *dest   = (uint64_t *)total;
+    for (size_t i = 0; i < sizeof(PipelineStatistics_t) / sizeof(uint64_t); i++)
+        dest[i] += source[i];
+}
+
+void Pipeline_Statistics_Add(const PipelineStatistics_t *stats); // To the calling thread's copy
+void Pipeline_Statistics_Collect(PipelineStatistics_t *frame);
+void Pipeline_Statistics_Print(const PipelineStatistics_t *stats);
+
+/*
+Raster kernels, exposed for the kernel microbenchmarks
+    - Each rasterizes the 4 triangles of Trianges_To_Be_Rastered from current_triangle_index, or as many as are left
+    - Raster_Triangle_Batchf uses float edge functions, it is what Raster_Triangles_MT runs
+    - Raster_Triangle_Batch is the integer edge function version, it does not count statistics
+*/
+void Raster_Triangle_Batch(size_t current_triangle_index);
+void Raster_Triangle_Batchf(size_t current_triangle_index, PipelineStatistics_t *stats);
 
 typedef struct
 {
@@ -65,23 +257,34 @@ typedef struct
 } SetupData_t;
 
 void Setup_Triangles_For_MT(void);
+void Setup_Triangles_Single_Thread(void); // The same work on the calling thread, without clearing the frame buffer
+
+/* Write the depth buffer into the colour buffer as grey scale, for looking at */
+void Convert_Depth_Buffer_For_Drawing(void);
 
-inline void Framebuffer_Clear_Depth()
+static inline void Framebuffer_Clear_Depth(void)
 {
-#if 1 /* Clear the Depth Buffer with set value */
+#if defined(_MSC_VER) || defined(__AVX__) /* Clear the Depth Buffer with set value, MSVC takes AVX without /arch */
     const __m256 max_depth    = _mm256_set1_ps(FLT_MAX);
     const int    num_pixels   = IMAGE_W * IMAGE_H;
     float       *depth_buffer = RenderState.depth_buffer;
 
     for (int i = 0; i < num_pixels; i += 8)
         _mm256_store_ps(&depth_buffer[i], max_depth);
+#elif 1
+    const __m128 max_depth    = _mm_set1_ps(FLT_MAX);
+    const int    num_pixels   = IMAGE_W * IMAGE_H;
+    float       *depth_buffer = RenderState.depth_buffer;
+
+    for (int i = 0; i < num_pixels; i += 4)
+        _mm_store_ps(&depth_buffer[i], max_depth);
 #else
     /* kinda a cheese, setting the depth to a large value */
     memset((void *)RenderState.depth_buffer, 0x7777, sizeof(float) * IMAGE_W * IMAGE_H);
 #endif
 }
 
-inline void Framebuffer_Clear_Both()
+static inline void Framebuffer_Clear_Both(void)
 {
     // Clear the Colour buffer
     memset((void *)RenderState.colour_buffer, 0, sizeof(uint8_t) * IMAGE_W * IMAGE_H * IMAGE_BPP);
@@ -1,19 +1,108 @@
-#include "renderer.h"
-#include "utils/utils.h"
-
+/* First, renderer.h includes js.h too and the include guard would leave the bodies out */
 #define JOB_SYHSTEM_IMPLEMENTATION
 #include "job_system/js.h"
 
+#include "renderer.h"
+#include "vertex_cache.h"
+#include "utils/utils.h"
+#include "utils/trace.h"
+
 #define TRIANGLE_SETUP_TRIANGLES_PER_THREAD 64 * 3 /* 3 incides per triangle */
 #define COMPUTE_AREA_IN_RASTER
 
+/*
+Two phase vertex processing
+    - Every vertex in the vertex buffer is put through the vertex shader and view port transform
+        exactly once by the vertex jobs, into the transformed vertex buffers below
+    - Triangle setup then only gathers the transformed vertices by index
+Without this the setup jobs shade the vertices themselves, with a small vertex cache per job
+    - Define SETUP_VERTEX_CACHE to build that way, simderella_bench_vertex_cache does so the two can be compared
+*/
+#ifndef SETUP_VERTEX_CACHE
+    #define TWO_PHASE_VERTEX_PROCESSING
+#endif
+#define VERTEX_PROCESSING_VERTICES_PER_THREAD 1024
+
+/*
+Cull clusters outside the view frustum, or with every triangle facing away from the camera,
+before any of their vertices are shaded
+*/
+#define SETUP_CULL_CLUSTERS
+
+/*
+Set up the draws grouped by their sort key (material) and front to back within each group,
+keeps the texture working set of the raster stage small. Without it everything is front to back
+*/
+#define SETUP_SORT_BY_MATERIAL
+
+/* A visible instance of a draw, instanced draws are expanded into one of these per instance */
+typedef struct
+{
+    mat4x4        object_to_clip_matrix;
+    const __m128 *model; // NULL when the draw is not instanced
+    vec3          camera_position;
+    uint32_t      draw;
+    size_t        vertex_offset; // Where the vertex range of the instance starts in the transformed vertices
+} DrawInstance_t;
+
+static struct
+{
+    DrawInstance_t *instances;
+    size_t          capacity;
+} Draw_Instances;
+
+/* A run of vertices of one instance, for one vertex job */
+typedef struct
+{
+    uint32_t instance;
+    uint32_t first_vertex;
+    uint32_t number_of_vertices;
+} VertexRange_t;
+
+static struct
+{
+    VertexRange_t *ranges;
+    size_t         capacity;
+} Vertex_Ranges;
+
+/* Data given to each thread for Vertex Processing */
+typedef struct VertexProcessingData
+{
+    int32_t              stride;
+    size_t               number_of_ranges;
+    const VertexRange_t *ranges;
+} VertexProcessingData_t;
+
+/* Output of the vertex jobs, grown when the frame's instances need more vertices. The instances are packed one after the other */
+static struct
+{
+    __m128              *position; // After the view port transform
+    VaryingAttributes_t *varying;
+    size_t               capacity;
+} Transformed_Vertices;
+
+/* Triangles of one instance for a setup job, a visible cluster or an even chunk of the index range */
+typedef struct
+{
+    uint32_t sort_key;
+    float    depth; // Distance to the nearest point of the cluster, FLT_MAX for the even chunks
+    uint32_t instance;
+    uint32_t first_index;
+    uint32_t number_of_indices;
+} SetupWork_t;
+
+static struct
+{
+    SetupWork_t *work;
+    size_t       capacity;
+} Setup_Work;
+
 /* Data given to each thread for Triangles Setup*/
 typedef struct TriangleSetupData
 {
-    size_t stride;
-    size_t number_of_indices;
-    size_t starting_index;
-    size_t ending_index;
+    int32_t            stride;
+    size_t             number_of_work_items;
+    const SetupWork_t *work;
 } TriangleSetupData_t;
 
 static inline void Compute_Bounding_Box_Screen_Space(vec4 ss_v0, vec4 ss_v1, vec4 ss_v2, ivec4 AABB)
@@ -38,56 +127,197 @@ static inline void Perspective_Divide_Vertex(vec4 vert)
     vert[2] *= vert[3];
 }
 
-static void Setup_Triangles(void *data)
+static void Process_Vertices(void *data)
+{
+    VertexProcessingData_t *const vd = (VertexProcessingData_t *)data;
+
+    TraceScope_t         trace = Trace_Begin("Process_Vertices");
+    PipelineStatistics_t stats = {0};
+
+    size_t stride;
+    while (Render_Next_Work_Item(&vd->stride, vd->number_of_ranges, &stride))
+    {
+        const VertexRange_t         range    = vd->ranges[stride];
+        const DrawInstance_t *const instance = &Draw_Instances.instances[range.instance];
+        DrawCommand_t *const        draw     = &RenderState.draws[instance->draw];
+        const size_t                offset   = instance->vertex_offset + (range.first_vertex - draw->first_vertex);
+
+        VERTEX_SHADER_BATCH(&draw->vertex_buffer[draw->vertex_stride * range.first_vertex], draw->vertex_stride, range.number_of_vertices,
+                            &Transformed_Vertices.varying[offset],
+                            draw->vertex_shader_uniforms,
+                            instance->model,
+                            RenderState.view_port_matrix,
+                            &draw->data_from_vertex_shader,
+                            &Transformed_Vertices.position[offset]);
+
+        PIPELINE_STATISTICS_ADD(&stats, vertices_shaded, range.number_of_vertices);
+    }
+
+    Pipeline_Statistics_Add(&stats);
+    Trace_End(&trace);
+}
+
+static void Push_Vertex_Range(size_t *count, const uint32_t instance, const uint32_t first_vertex, const uint32_t number_of_vertices)
 {
-    const TriangleSetupData_t *const td = (TriangleSetupData_t *)data;
+    if (*count == Vertex_Ranges.capacity)
+    {
+        Vertex_Ranges.capacity = (Vertex_Ranges.capacity) ? Vertex_Ranges.capacity * 2 : 256;
+        Vertex_Ranges.ranges   = realloc(Vertex_Ranges.ranges, sizeof(VertexRange_t) * Vertex_Ranges.capacity);
+        ASSERT(Vertex_Ranges.ranges);
+    }
+    Vertex_Ranges.ranges[(*count)++] = (VertexRange_t){instance, first_vertex, number_of_vertices};
+}
 
-    const size_t stride            = Platform_InterlockedIncrement((int32_t *)&td->stride) - 1;
-    const size_t max_num_triangles = td->number_of_indices;
+/* Split a span of vertices up into jobs */
+static void Push_Vertex_Span(size_t *count, const uint32_t instance, uint32_t first_vertex, const uint32_t end_vertex)
+{
+    while (first_vertex < end_vertex)
+    {
+        const uint32_t number_of_vertices = (end_vertex - first_vertex < VERTEX_PROCESSING_VERTICES_PER_THREAD) ? end_vertex - first_vertex : VERTEX_PROCESSING_VERTICES_PER_THREAD;
+        Push_Vertex_Range(count, instance, first_vertex, number_of_vertices);
+        first_vertex += number_of_vertices;
+    }
+}
+
+static int Compare_Vertex_Range(const void *a, const void *b)
+{
+    const VertexRange_t *range_a = (const VertexRange_t *)a;
+    const VertexRange_t *range_b = (const VertexRange_t *)b;
+
+    if (range_a->instance != range_b->instance)
+        return (range_a->instance > range_b->instance) - (range_a->instance < range_b->instance);
+    return (range_a->first_vertex > range_b->first_vertex) - (range_a->first_vertex < range_b->first_vertex);
+}
+
+/*
+Shade the vertex spans gathered for this frame, the whole vertex range of an instance or the vertices of its visible clusters
+    - The cluster vertex ranges overlap, they are sorted and merged first so each vertex is only shaded once
+    - Without use_jobs the calling thread shades them all itself
+*/
+static void Process_Vertices_For_MT(size_t number_of_spans, const bool use_jobs)
+{
+    if (number_of_spans == 0)
+        return;
+
+    qsort(Vertex_Ranges.ranges, number_of_spans, sizeof(VertexRange_t), Compare_Vertex_Range);
 
-    // Split the traingles up into even chuncks of triangles
-    const size_t starting_index = stride * TRIANGLE_SETUP_TRIANGLES_PER_THREAD;
-    size_t       ending_index   = starting_index + TRIANGLE_SETUP_TRIANGLES_PER_THREAD;
-    ending_index                = ending_index > max_num_triangles ? max_num_triangles : ending_index;
-    const size_t vertex_stride  = RenderState.vertex_stride;
+    /* Merge in place, the merged spans never overtake the ones still to be read */
+    size_t merged = 0;
+    for (size_t i = 1; i < number_of_spans; i++)
+    {
+        VertexRange_t *current = &Vertex_Ranges.ranges[merged];
+        const uint32_t end     = current->first_vertex + current->number_of_vertices;
+        const uint32_t next    = Vertex_Ranges.ranges[i].first_vertex + Vertex_Ranges.ranges[i].number_of_vertices;
+
+        if (Vertex_Ranges.ranges[i].instance == current->instance && Vertex_Ranges.ranges[i].first_vertex <= end)
+            current->number_of_vertices = ((next > end) ? next : end) - current->first_vertex;
+        else
+            Vertex_Ranges.ranges[++merged] = Vertex_Ranges.ranges[i];
+    }
+    number_of_spans = merged + 1;
+
+    /* Split the spans up into jobs, appended after the spans then moved to the front */
+    size_t number_of_ranges = number_of_spans;
+    for (size_t i = 0; i < number_of_spans; i++)
+    {
+        const VertexRange_t span = Vertex_Ranges.ranges[i];
+        Push_Vertex_Span(&number_of_ranges, span.instance, span.first_vertex, span.first_vertex + span.number_of_vertices);
+    }
+    memmove(Vertex_Ranges.ranges, Vertex_Ranges.ranges + number_of_spans, sizeof(VertexRange_t) * (number_of_ranges - number_of_spans));
+    number_of_ranges -= number_of_spans;
+
+    static VertexProcessingData_t vd = {0};
+    vd.stride                        = 0;
+    vd.number_of_ranges              = number_of_ranges;
+    vd.ranges                        = Vertex_Ranges.ranges;
+
+    if (!use_jobs)
+    {
+        Process_Vertices((void *)&vd);
+        return;
+    }
+
+    job_t job = {Process_Vertices, (void *)&vd};
+
+    const size_t number_of_jobs = (number_of_ranges < RENDER_JOBS_PER_STAGE) ? number_of_ranges : RENDER_JOBS_PER_STAGE;
+    for (size_t i = 0; i < number_of_jobs; i++)
+        job_submit(job);
+
+    TraceScope_t trace = Trace_Begin("Wait Process_Vertices");
+    jobs_complete_all_work();
+    Trace_End(&trace);
+}
+
+/*
+Get a vertex after the vertex shader and view port transform, from the vertex jobs output or the vertex cache
+    - vertex_base is the instance's offset into the transformed vertices minus its first vertex, so the index can be added straight on
+*/
+static inline void Transform_Vertex(VertCache_t *cache, const DrawInstance_t *instance, DrawCommand_t *draw, const size_t vertex_base, const uint32_t index,
+                                    __m128 *out_position, VaryingAttributes_t *out_varying, PipelineStatistics_t *stats)
+{
+#ifdef TWO_PHASE_VERTEX_PROCESSING
+    (void)cache;
+    (void)instance;
+    (void)draw;
+    (void)stats;
+
+    CHECK_ARRAY_BOUNDS(vertex_base + index, Transformed_Vertices.capacity);
+
+    *out_position = Transformed_Vertices.position[vertex_base + index];
+    *out_varying  = Transformed_Vertices.varying[vertex_base + index];
+#else
+    (void)vertex_base;
+
+    if (VertCache_Lookup(cache, index, out_position, out_varying))
+        return;
+
+    CHECK_ARRAY_BOUNDS(draw->vertex_stride * index, draw->vertex_buffer_length);
+
+    __m128 out_vertex = {0};
+    VERTEX_SHADER((void *)&draw->vertex_buffer[draw->vertex_stride * index], out_varying, draw->vertex_shader_uniforms, instance->model, &draw->data_from_vertex_shader, &out_vertex);
+
+    *out_position = mat4x4_mul_m128(RenderState.view_port_matrix, out_vertex);
+
+    VertCache_Add(cache, index, *out_position, out_varying);
+    PIPELINE_STATISTICS_ADD(stats, vertices_shaded, 1);
+#endif
+}
+
+static void Setup_Triangle_Range(const SetupWork_t *work)
+{
+    const DrawInstance_t *const instance = &Draw_Instances.instances[work->instance];
+    DrawCommand_t *const        draw     = &RenderState.draws[instance->draw];
+
+    const size_t starting_index = work->first_index;
+    const size_t ending_index   = starting_index + work->number_of_indices;
+    const size_t vertex_base    = instance->vertex_offset - draw->first_vertex;
 
     __m128              collected_vertices[4][3] = {0};
     VaryingAttributes_t collected_varying[4][3]  = {0};
 
-    ASSERT(RenderState.index_buffer_length > 0);
-    ASSERT(vertex_stride > 0);
+    ASSERT(draw->number_of_indices > 0);
+    ASSERT(draw->vertex_stride > 0);
+
+    const uint32_t *const index_buffer = draw->index_buffer;
+
+    VertCache_t vertex_cache;
+    VertCache_Reset(&vertex_cache);
 
-    const int *const index_buffer  = RenderState.index_buffer;
-    uint32_t        *vertex_buffer = (uint32_t *)RenderState.vertex_buffer;
+    PipelineStatistics_t stats = {0};
 
     size_t number_of_collected_triangles = 0;
     for (size_t vert_idx = starting_index; vert_idx < ending_index; /* blank */)
     {
-        CHECK_ARRAY_BOUNDS(vert_idx, RenderState.index_buffer_length);
+        CHECK_ARRAY_BOUNDS(vert_idx, draw->first_index + draw->number_of_indices);
 
         /* Get 3 indices from the index buffer */
-        const int vert0_index = (const int)index_buffer[vert_idx + 0];
-        const int vert1_index = (const int)index_buffer[vert_idx + 1];
-        const int vert2_index = (const int)index_buffer[vert_idx + 2];
-
-        uint32_t *pVertIn0 = (uint32_t *)&vertex_buffer[vertex_stride * vert0_index];
-        uint32_t *pVertIn1 = (uint32_t *)&vertex_buffer[vertex_stride * vert1_index];
-        uint32_t *pVertIn2 = (uint32_t *)&vertex_buffer[vertex_stride * vert2_index];
-
-        CHECK_ARRAY_BOUNDS(vertex_stride * vert0_index, RenderState.vertex_buffer_length);
-        CHECK_ARRAY_BOUNDS(vertex_stride * vert1_index, RenderState.vertex_buffer_length);
-        CHECK_ARRAY_BOUNDS(vertex_stride * vert2_index, RenderState.vertex_buffer_length);
-
-        __m128 out_vertex0 = {0};
-        __m128 out_vertex1 = {0};
-        __m128 out_vertex2 = {0};
-        VERTEX_SHADER((void *)pVertIn0, &collected_varying[number_of_collected_triangles][0], RenderState.vertex_shader_uniforms, &RenderState.data_from_vertex_shader, &out_vertex0);
-        VERTEX_SHADER((void *)pVertIn1, &collected_varying[number_of_collected_triangles][1], RenderState.vertex_shader_uniforms, &RenderState.data_from_vertex_shader, &out_vertex1);
-        VERTEX_SHADER((void *)pVertIn2, &collected_varying[number_of_collected_triangles][2], RenderState.vertex_shader_uniforms, &RenderState.data_from_vertex_shader, &out_vertex2);
+        const uint32_t vert0_index = index_buffer[vert_idx + 0];
+        const uint32_t vert1_index = index_buffer[vert_idx + 1];
+        const uint32_t vert2_index = index_buffer[vert_idx + 2];
 
-        collected_vertices[number_of_collected_triangles][0] = mat4x4_mul_m128(RenderState.view_port_matrix, out_vertex0);
-        collected_vertices[number_of_collected_triangles][1] = mat4x4_mul_m128(RenderState.view_port_matrix, out_vertex1);
-        collected_vertices[number_of_collected_triangles][2] = mat4x4_mul_m128(RenderState.view_port_matrix, out_vertex2);
+        Transform_Vertex(&vertex_cache, instance, draw, vertex_base, vert0_index, &collected_vertices[number_of_collected_triangles][0], &collected_varying[number_of_collected_triangles][0], &stats);
+        Transform_Vertex(&vertex_cache, instance, draw, vertex_base, vert1_index, &collected_vertices[number_of_collected_triangles][1], &collected_varying[number_of_collected_triangles][1], &stats);
+        Transform_Vertex(&vertex_cache, instance, draw, vertex_base, vert2_index, &collected_vertices[number_of_collected_triangles][2], &collected_varying[number_of_collected_triangles][2], &stats);
 
         ++number_of_collected_triangles;
         vert_idx += 3;
@@ -155,47 +385,339 @@ static void Setup_Triangles(void *data)
 #endif
                 const size_t raster_triangle_store_idx = Platform_InterlockedIncrement((int32_t *)&Trianges_To_Be_Rastered_Counter) - 1;
 
-                CHECK_ARRAY_BOUNDS(raster_triangle_store_idx, MAX_NUMBER_OF_TRIANGLES_TO_RASTER);
+                CHECK_ARRAY_BOUNDS(raster_triangle_store_idx, Trianges_To_Be_Rastered_Capacity);
 
                 RasterData_t *tri = &Trianges_To_Be_Rastered[raster_triangle_store_idx];
 
                 /* Projection division... */
-                tri->ss_v0 = _mm_setr_ps(X[0].m128_f32[mask_idx], Y[0].m128_f32[mask_idx], Z[0].m128_f32[mask_idx], W[0].m128_f32[mask_idx]);
-                tri->ss_v1 = _mm_setr_ps(X[1].m128_f32[mask_idx], Y[1].m128_f32[mask_idx], Z[1].m128_f32[mask_idx], W[1].m128_f32[mask_idx]);
-                tri->ss_v2 = _mm_setr_ps(X[2].m128_f32[mask_idx], Y[2].m128_f32[mask_idx], Z[2].m128_f32[mask_idx], W[2].m128_f32[mask_idx]);
+                tri->ss_v0 = _mm_setr_ps(Lane_F32(X[0], mask_idx), Lane_F32(Y[0], mask_idx), Lane_F32(Z[0], mask_idx), Lane_F32(W[0], mask_idx));
+                tri->ss_v1 = _mm_setr_ps(Lane_F32(X[1], mask_idx), Lane_F32(Y[1], mask_idx), Lane_F32(Z[1], mask_idx), Lane_F32(W[1], mask_idx));
+                tri->ss_v2 = _mm_setr_ps(Lane_F32(X[2], mask_idx), Lane_F32(Y[2], mask_idx), Lane_F32(Z[2], mask_idx), Lane_F32(W[2], mask_idx));
 
                 tri->varying[0] = collected_varying[mask_idx][0];
                 tri->varying[1] = collected_varying[mask_idx][1];
                 tri->varying[2] = collected_varying[mask_idx][2];
 
+                tri->data_from_vertex_shader = &draw->data_from_vertex_shader;
+
 #ifndef COMPUTE_AREA_IN_RASTER
-                tri->area = invTriArea.m128_f32[mask_idx];
+                tri->area = Lane_F32(invTriArea, mask_idx);
             }
 #endif
         }
         number_of_collected_triangles = 0;
     }
+
+    Pipeline_Statistics_Add(&stats);
 }
 
-void Setup_Triangles_For_MT(void)
+static void Setup_Triangles(void *data)
 {
-    Framebuffer_Clear_Both();
+    TriangleSetupData_t *const td = (TriangleSetupData_t *)data;
+
+    TraceScope_t trace = Trace_Begin("Setup_Triangles");
+
+    size_t stride;
+    while (Render_Next_Work_Item(&td->stride, td->number_of_work_items, &stride))
+        Setup_Triangle_Range(&td->work[stride]);
+
+    Trace_End(&trace);
+}
+
+static int Compare_Setup_Work(const void *a, const void *b)
+{
+    const SetupWork_t *work_a = (const SetupWork_t *)a;
+    const SetupWork_t *work_b = (const SetupWork_t *)b;
+
+#ifdef SETUP_SORT_BY_MATERIAL
+    if (work_a->sort_key != work_b->sort_key)
+        return (work_a->sort_key > work_b->sort_key) - (work_a->sort_key < work_b->sort_key);
+#endif
+    if (work_a->depth != work_b->depth)
+        return (work_a->depth > work_b->depth) - (work_a->depth < work_b->depth);
+
+    // Keeps the chunks of a draw in order
+    if (work_a->instance != work_b->instance)
+        return (work_a->instance > work_b->instance) - (work_a->instance < work_b->instance);
+    return (work_a->first_index > work_b->first_index) - (work_a->first_index < work_b->first_index);
+}
+
+/* Sphere against the view frustum planes */
+static inline bool Sphere_In_Frustum(const float centre_xyz[3], const float radius, const __m128 planes[6])
+{
+    const __m128 centre = _mm_setr_ps(centre_xyz[0], centre_xyz[1], centre_xyz[2], 1.0f);
 
+    for (int i = 0; i < 6; i++)
+    {
+        const __m128 d        = _mm_mul_ps(planes[i], centre);
+        const float  distance = _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1))),
+                                                         _mm_add_ss(_mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 3)))));
+        if (distance < -radius)
+            return false;
+    }
+    return true;
+}
+
+/* True when every triangle in the cluster faces away from the camera */
+static inline bool Cluster_Is_Back_Facing(const MeshCluster_t *cluster, const vec3 camera_position)
+{
+    vec3 to_centre;
+    glm_vec3_sub((float *)cluster->centre, (float *)camera_position, to_centre);
+
+    return glm_vec3_dot(to_centre, (float *)cluster->cone_axis) >= cluster->cone_cutoff * glm_vec3_norm(to_centre) + cluster->radius;
+}
+
+/* View frustum planes in object space, taken from the rows of the object to clip matrix (Gribb & Hartmann) */
+static void Frustum_Planes(const mat4x4 object_to_clip_matrix, __m128 planes[6])
+{
+    __m128 rows[4] = {object_to_clip_matrix[0], object_to_clip_matrix[1], object_to_clip_matrix[2], object_to_clip_matrix[3]};
+    _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+
+    planes[0] = _mm_add_ps(rows[3], rows[0]); // Left
+    planes[1] = _mm_sub_ps(rows[3], rows[0]); // Right
+    planes[2] = _mm_add_ps(rows[3], rows[1]); // Bottom
+    planes[3] = _mm_sub_ps(rows[3], rows[1]); // Top
+    planes[4] = _mm_add_ps(rows[3], rows[2]); // Near
+    planes[5] = _mm_sub_ps(rows[3], rows[2]); // Far
+
+    for (int i = 0; i < 6; i++)
+    {
+        // Normalise so the distance can be compared against the radius
+        const __m128 xyz    = _mm_mul_ps(planes[i], _mm_setr_ps(1.0f, 1.0f, 1.0f, 0.0f));
+        const __m128 length = _mm_sqrt_ps(_mm_dp_ps(xyz, xyz, 0x7F));
+        planes[i]           = _mm_div_ps(planes[i], length);
+    }
+}
+
+static void Push_Setup_Work(size_t *count, const uint32_t sort_key, const float depth, const uint32_t instance, const uint32_t first_index, const uint32_t number_of_indices)
+{
+    if (*count == Setup_Work.capacity)
+    {
+        Setup_Work.capacity = (Setup_Work.capacity) ? Setup_Work.capacity * 2 : 256;
+        Setup_Work.work     = realloc(Setup_Work.work, sizeof(SetupWork_t) * Setup_Work.capacity);
+        ASSERT(Setup_Work.work);
+    }
+    Setup_Work.work[(*count)++] = (SetupWork_t){sort_key, depth, instance, first_index, number_of_indices};
+}
+
+static DrawInstance_t *Push_Draw_Instance(size_t *count)
+{
+    if (*count == Draw_Instances.capacity)
+    {
+        Draw_Instances.capacity  = (Draw_Instances.capacity) ? Draw_Instances.capacity * 2 : 256;
+        Draw_Instances.instances = realloc(Draw_Instances.instances, sizeof(DrawInstance_t) * Draw_Instances.capacity);
+        ASSERT(Draw_Instances.instances);
+    }
+    return &Draw_Instances.instances[(*count)++];
+}
+
+/*
+Cull the clusters of an instance and add the visible ones to the setup work, with the distance to the nearest point
+of their bounding sphere, and their vertices to the vertex spans
+*/
+static void Cull_Instance_Clusters(const uint32_t instance_index, const __m128 planes[6], size_t *number_of_work_items, size_t *number_of_spans, PipelineStatistics_t *stats)
+{
+    const DrawInstance_t *instance = &Draw_Instances.instances[instance_index];
+    const DrawCommand_t  *draw     = &RenderState.draws[instance->draw];
+
+    for (size_t i = 0; i < draw->number_of_clusters; i++)
+    {
+        const MeshCluster_t *cluster = &draw->clusters[i];
+
+#ifdef SETUP_CULL_CLUSTERS
+        if (!Sphere_In_Frustum(cluster->centre, cluster->radius, planes))
+        {
+            PIPELINE_STATISTICS_ADD(stats, triangles_culled_frustum, cluster->number_of_indices / 3);
+            continue;
+        }
+        if (Cluster_Is_Back_Facing(cluster, instance->camera_position))
+        {
+            PIPELINE_STATISTICS_ADD(stats, triangles_culled_back_face, cluster->number_of_indices / 3);
+            continue;
+        }
+#else
+        (void)planes;
+        (void)stats;
+#endif
+
+        const __m128 centre      = _mm_setr_ps(cluster->centre[0], cluster->centre[1], cluster->centre[2], 1.0f);
+        const __m128 clip_centre = mat4x4_mul_m128(instance->object_to_clip_matrix, centre);
+
+        // Clip space W is the view space depth, the same for every draw so the clusters of all draws can be sorted together
+        const float depth = _mm_cvtss_f32(_mm_shuffle_ps(clip_centre, clip_centre, _MM_SHUFFLE(3, 3, 3, 3))) - cluster->radius;
+
+        Push_Setup_Work(number_of_work_items, draw->sort_key, depth, instance_index, cluster->first_index, cluster->number_of_indices);
+        Push_Vertex_Range(number_of_spans, instance_index, cluster->first_vertex, cluster->number_of_vertices);
+    }
+}
+
+/*
+Expand the instances of every draw, skipping the ones outside the view frustum, then cull the clusters of the rest
+    - Returns the number of visible instances, their vertices and setup work are pushed as they are found
+*/
+static size_t Cull_Instances(size_t *number_of_work_items, size_t *number_of_spans)
+{
+    size_t number_of_instances = 0;
+    size_t number_of_vertices  = 0;
+
+    PipelineStatistics_t stats = {0};
+
+    for (uint32_t i = 0; i < RenderState.number_of_draws; i++)
+    {
+        const DrawCommand_t *draw = &RenderState.draws[i];
+
+        const size_t instance_count = (draw->instance_models) ? draw->instance_count : 1;
+        for (size_t j = 0; j < instance_count; j++)
+        {
+            mat4x4 object_to_clip_matrix;
+            if (draw->instance_models)
+                dash_mat_mul_mat(draw->object_to_clip_matrix, draw->instance_models[j], object_to_clip_matrix);
+            else
+                dash_mat_copy(draw->object_to_clip_matrix, object_to_clip_matrix);
+
+            __m128 planes[6];
+            Frustum_Planes(object_to_clip_matrix, planes);
+
+            PIPELINE_STATISTICS_ADD(&stats, triangles_submitted, draw->number_of_indices / 3);
+
+            if (draw->bounding_sphere[3] > 0.0f && !Sphere_In_Frustum(draw->bounding_sphere, draw->bounding_sphere[3], planes))
+            {
+                PIPELINE_STATISTICS_ADD(&stats, triangles_culled_frustum, draw->number_of_indices / 3);
+                continue;
+            }
+
+            const uint32_t  instance_index = (uint32_t)number_of_instances;
+            DrawInstance_t *instance       = Push_Draw_Instance(&number_of_instances);
+
+            dash_mat_copy(object_to_clip_matrix, instance->object_to_clip_matrix);
+            instance->model         = (draw->instance_models) ? draw->instance_models[j] : NULL;
+            instance->draw          = i;
+            instance->vertex_offset = number_of_vertices;
+            number_of_vertices += draw->number_of_vertices;
+
+            if (draw->number_of_clusters == 0)
+            {
+                Push_Vertex_Range(number_of_spans, instance_index, (uint32_t)draw->first_vertex, (uint32_t)draw->number_of_vertices);
+
+                // Split the traingles up into even chuncks of triangles
+                const size_t ending_index = draw->first_index + draw->number_of_indices;
+                for (size_t index = draw->first_index; index < ending_index; index += TRIANGLE_SETUP_TRIANGLES_PER_THREAD)
+                {
+                    const size_t number_of_indices = (ending_index - index < TRIANGLE_SETUP_TRIANGLES_PER_THREAD) ? ending_index - index : TRIANGLE_SETUP_TRIANGLES_PER_THREAD;
+                    Push_Setup_Work(number_of_work_items, draw->sort_key, FLT_MAX, instance_index, (uint32_t)index, (uint32_t)number_of_indices);
+                }
+                continue;
+            }
+
+            if (draw->instance_models)
+                Render_Object_Space_Position(draw->instance_models[j], draw->camera_position, instance->camera_position);
+            else
+                glm_vec3_copy((float *)draw->camera_position, instance->camera_position);
+
+            Cull_Instance_Clusters(instance_index, planes, number_of_work_items, number_of_spans, &stats);
+        }
+    }
+
+    /* Make room for the transformed vertices of every visible instance */
+    if (number_of_vertices > Transformed_Vertices.capacity)
+    {
+        _mm_free(Transformed_Vertices.position);
+        _mm_free(Transformed_Vertices.varying);
+
+        Transformed_Vertices.position = _mm_malloc(sizeof(__m128) * number_of_vertices, 32);
+        Transformed_Vertices.varying  = _mm_malloc(sizeof(VaryingAttributes_t) * number_of_vertices, 32);
+        Transformed_Vertices.capacity = number_of_vertices;
+        ASSERT(Transformed_Vertices.position && Transformed_Vertices.varying);
+    }
+
+    Pipeline_Statistics_Add(&stats);
+    return number_of_instances;
+}
+
+/* Make room for every triangle the setup work could output */
+static void Reserve_Triangles_To_Be_Rastered(const SetupWork_t *work, const size_t number_of_work_items)
+{
+    size_t number_of_triangles = 0;
+    for (size_t i = 0; i < number_of_work_items; i++)
+        number_of_triangles += work[i].number_of_indices / 3;
+
+    if (number_of_triangles > Trianges_To_Be_Rastered_Capacity)
+    {
+        _mm_free(Trianges_To_Be_Rastered);
+        Trianges_To_Be_Rastered          = _mm_malloc(sizeof(RasterData_t) * number_of_triangles, 32);
+        Trianges_To_Be_Rastered_Capacity = number_of_triangles;
+        ASSERT(Trianges_To_Be_Rastered);
+    }
+}
+
+/*
+Set up the triangles of every recorded draw in one pass
+    - Instances are expanded and culled here, before any vertex is shaded
+    - The clusters of all instances are culled and sorted front to back together, by material first with
+        SETUP_SORT_BY_MATERIAL. The instances without clusters are split into even chunks after them
+    - One vertex dispatch and one setup dispatch for the whole frame, each triangle keeps a pointer to its draw
+    - Without use_jobs the calling thread runs both dispatches itself
+*/
+static void Setup_Draws(const bool use_jobs)
+{
     // TODO: Wrap operations with this with function calls
     Trianges_To_Be_Rastered_Counter = 0;
 
+    TraceScope_t trace = Trace_Begin("Cull_Instances");
+
+    size_t       number_of_work_items = 0;
+    size_t       number_of_spans      = 0;
+    const size_t number_of_instances  = Cull_Instances(&number_of_work_items, &number_of_spans);
+
+    Trace_End(&trace);
+
+    if (number_of_instances == 0)
+        return;
+
+    trace = Trace_Begin("Sort Setup Work");
+    qsort(Setup_Work.work, number_of_work_items, sizeof(SetupWork_t), Compare_Setup_Work);
+    Trace_End(&trace);
+
+    Reserve_Triangles_To_Be_Rastered(Setup_Work.work, number_of_work_items);
+
+#ifdef TWO_PHASE_VERTEX_PROCESSING
+    Process_Vertices_For_MT(number_of_spans, use_jobs);
+#else
+    (void)number_of_spans;
+#endif
+
     static TriangleSetupData_t sd = {0};
     sd.stride                     = 0;
-    sd.starting_index             = 0;
-    sd.ending_index               = 0;
-    sd.number_of_indices          = RenderState.index_buffer_length;
+    sd.number_of_work_items       = number_of_work_items;
+    sd.work                       = Setup_Work.work;
 
-    const size_t tmp = sd.number_of_indices / TRIANGLE_SETUP_TRIANGLES_PER_THREAD;
+    if (!use_jobs)
+    {
+        Setup_Triangles((void *)&sd);
+        return;
+    }
 
     job_t job = {Setup_Triangles, (void *)&sd};
 
-    for (size_t i = 0; i < tmp; i++)
+    const size_t number_of_jobs = (number_of_work_items < RENDER_JOBS_PER_STAGE) ? number_of_work_items : RENDER_JOBS_PER_STAGE;
+    for (size_t i = 0; i < number_of_jobs; i++)
         job_submit(job);
 
+    trace = Trace_Begin("Wait Setup_Triangles");
     jobs_complete_all_work();
-}
\ No newline at end of file
+    Trace_End(&trace);
+}
+
+void Setup_Triangles_For_MT(void)
+{
+    TraceScope_t trace = Trace_Begin("Clear");
+    Framebuffer_Clear_Both();
+    Trace_End(&trace);
+
+    Setup_Draws(true);
+}
+
+void Setup_Triangles_Single_Thread(void)
+{
+    Setup_Draws(false);
+}
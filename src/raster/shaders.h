@@ -25,9 +25,11 @@ typedef struct
     texture_t *diffuse;
 } VSOutputForFS_t;
 
+/* 'instance_model' is the per instance attribute of an instanced draw, NULL otherwise. It goes on the right of the MVP */
 static inline void VERTEX_SHADER(void                *attributes,
                                  VaryingAttributes_t *varying,
                                  void                *uniforms,
+                                 const __m128        *instance_model,
                                  VSOutputForFS_t     *output_to_fragment_shader,
                                  __m128              *out_vertex)
 {
@@ -37,12 +39,91 @@ static inline void VERTEX_SHADER(void                *attributes,
     output_to_fragment_shader->diffuse = uni->diffuse;
 
     __m128 position = _mm_setr_ps(att_pos->position[0], att_pos->position[1], att_pos->position[2], 1.0f);
-    *out_vertex     = mat4x4_mul_m128(uni->MVP, position);
+    if (instance_model)
+        position = mat4x4_mul_m128(instance_model, position);
+    *out_vertex = mat4x4_mul_m128(uni->MVP, position);
 
     varying->vec2_attribute[0].raw[0] = att_pos->tex[0];
     varying->vec2_attribute[0].raw[1] = att_pos->tex[1];
 }
 
+#if defined(__AVX2__)
+    #define VERTEX_SHADER_BATCH_SIZE 8
+#else
+    #define VERTEX_SHADER_BATCH_SIZE 4
+#endif
+
+/*
+Batched VERTEX_SHADER for a run of 'count' vertices
+    - Positions are gathered VERTEX_SHADER_BATCH_SIZE at a time into SoA form (X[], Y[], Z[])
+        and transformed together, 4 wide with SSE or 8 wide with AVX2
+    - 'post_transform' is folded into the MVP once per call, pass the view port matrix to
+        get the vertices out ready for triangle setup
+    - 'attribute_stride' is the size of a vertex in floats
+    - 'instance_model' is the same as for VERTEX_SHADER, folded in with the rest
+*/
+static inline void VERTEX_SHADER_BATCH(const float         *attributes,
+                                       const size_t         attribute_stride,
+                                       const size_t         count,
+                                       VaryingAttributes_t *varying,
+                                       void                *uniforms,
+                                       const __m128        *instance_model,
+                                       const mat4x4         post_transform,
+                                       VSOutputForFS_t     *output_to_fragment_shader,
+                                       __m128              *out_vertex)
+{
+    UniformData_t *uni = (UniformData_t *)uniforms;
+
+    output_to_fragment_shader->diffuse = uni->diffuse;
+
+    mat4x4 transform;
+    dash_mat_mul_mat(post_transform, uni->MVP, transform);
+    if (instance_model)
+        dash_mat_mul_mat(transform, instance_model, transform);
+
+    for (size_t first = 0; first < count; first += VERTEX_SHADER_BATCH_SIZE)
+    {
+        const size_t batch_size = (count - first < VERTEX_SHADER_BATCH_SIZE) ? count - first : VERTEX_SHADER_BATCH_SIZE;
+
+        CGLM_ALIGN(32) float X[VERTEX_SHADER_BATCH_SIZE] = {0};
+        CGLM_ALIGN(32) float Y[VERTEX_SHADER_BATCH_SIZE] = {0};
+        CGLM_ALIGN(32) float Z[VERTEX_SHADER_BATCH_SIZE] = {0};
+
+        for (size_t i = 0; i < batch_size; i++)
+        {
+            const VertexShaderAttributes_t *att = (const VertexShaderAttributes_t *)&attributes[(first + i) * attribute_stride];
+
+            X[i] = att->position[0];
+            Y[i] = att->position[1];
+            Z[i] = att->position[2];
+
+            varying[first + i].vec2_attribute[0].raw[0] = att->tex[0];
+            varying[first + i].vec2_attribute[0].raw[1] = att->tex[1];
+        }
+
+        /* out[0..3] are X, Y, Z, W of 4 vertices each */
+        __m128 out[VERTEX_SHADER_BATCH_SIZE];
+#if defined(__AVX2__)
+        __m256 soa[4];
+        mat4x4_mul_soa8(transform, _mm256_load_ps(X), _mm256_load_ps(Y), _mm256_load_ps(Z), soa);
+
+        for (int i = 0; i < 4; i++)
+        {
+            out[i]     = _mm256_castps256_ps128(soa[i]);
+            out[i + 4] = _mm256_extractf128_ps(soa[i], 1);
+        }
+        _MM_TRANSPOSE4_PS(out[4], out[5], out[6], out[7]);
+#else
+        mat4x4_mul_soa4(transform, _mm_load_ps(X), _mm_load_ps(Y), _mm_load_ps(Z), out);
+#endif
+        /* Back to one vertex per register for triangle setup */
+        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+
+        for (size_t i = 0; i < batch_size; i++)
+            out_vertex[first + i] = out[i];
+    }
+}
+
 #define ROUND(X) floorf((X) + 0.5f)
 static inline float lerp(float a, float b, float t)
 {
@@ -82,7 +163,8 @@ static inline void FRAGMENT_SHADER(InterpolatedPixel_t *interpolated_data,
     U *= (float)tex->w;
     V *= (float)tex->h;
 
-    const uint8_t *const final_colour = Texture_Get_Pixel(*tex, (const int)ROUND(U), (const int)ROUND(V));
+    uint8_t final_colour[4];
+    Texture_Fetch(tex, (const int)ROUND(U), (const int)ROUND(V), final_colour);
 #else
     const float u_frac = fractional_part(U * (float)tex->w);
     const float v_frac = fractional_part(V * (float)tex->h);
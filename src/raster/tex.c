@@ -1,24 +1,570 @@
 #include "tex.h"
 
+#include <string.h>
+#include <immintrin.h>
+
+#include "utils/utils.h"
+#include "utils/file_map.h"
+#include "job_system/js.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+static int32_t texture_next_id = 0; // Textures can be made on any thread, 0 marks an empty slot in the block cache so ids start at 1
+
+/*
+BC1 and BC3 (DXT1/DXT5) block decoding
+    - Each 4x4 block stores 2 RGB565 end points and a 2 bit index per texel into
+        a 4 colour palette made from those end points
+    - BC3 adds a block of 2 alpha end points and 3 bit indices into an 8 entry alpha palette
+We build the palette in a register and use pshufb to expand the indices into texels
+*/
+
+static inline uint32_t Read_U32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline int Expand_5_Bits(const uint32_t v)
+{
+    const int c = (int)(v & 0x1F);
+    return (c << 3) | (c >> 2);
+}
+
+static inline int Expand_6_Bits(const uint32_t v)
+{
+    const int c = (int)(v & 0x3F);
+    return (c << 2) | (c >> 4);
+}
+
+/* Returns the 4 RGBA8 palette entries packed into one register */
+static inline __m128i BC1_Decode_Palette(const uint8_t *block, const bool always_four_colours)
+{
+    const uint32_t c0 = (uint32_t)block[0] | ((uint32_t)block[1] << 8);
+    const uint32_t c1 = (uint32_t)block[2] | ((uint32_t)block[3] << 8);
+
+    /* 16bit lanes : r0 g0 b0 a0 | r1 g1 b1 a1 */
+    const __m128i endpoints = _mm_setr_epi16((short)Expand_5_Bits(c0 >> 11), (short)Expand_6_Bits(c0 >> 5), (short)Expand_5_Bits(c0), 255,
+                                             (short)Expand_5_Bits(c1 >> 11), (short)Expand_6_Bits(c1 >> 5), (short)Expand_5_Bits(c1), 255);
+    const __m128i swapped   = _mm_shuffle_epi32(endpoints, _MM_SHUFFLE(1, 0, 3, 2)); // p1 | p0
+
+    __m128i middle; // p2 | p3
+    if (always_four_colours || c0 > c1)
+    {
+        // p2 = (2 * p0 + p1) / 3, p3 = (2 * p1 + p0) / 3
+        const __m128i sum = _mm_add_epi16(_mm_add_epi16(endpoints, endpoints), swapped);
+        middle            = _mm_mulhi_epu16(sum, _mm_set1_epi16(0x5556));
+    }
+    else
+    {
+        // p2 = (p0 + p1) / 2, p3 = transparent black
+        middle = _mm_srli_epi16(_mm_add_epi16(endpoints, swapped), 1);
+        middle = _mm_move_epi64(middle);
+    }
+
+    return _mm_packus_epi16(endpoints, middle);
+}
+
+/* Decode the colour part of a block into 4 rows of 4 RGBA8 texels */
+static inline void BC1_Decode_Colour_Block(const uint8_t *block, const bool always_four_colours, __m128i rows[4])
+{
+    const __m128i palette = BC1_Decode_Palette(block, always_four_colours);
+
+    // Shift each texels 2 bit index up to bits 6 and 7 of its lane
+    const __m128i index_shift = _mm_setr_epi32(1 << 6, 1 << 4, 1 << 2, 1 << 0);
+    const __m128i byte_offset = _mm_set1_epi32(0x03020100);
+
+    for (int row = 0; row < 4; row++)
+    {
+        __m128i idx = _mm_mullo_epi32(_mm_set1_epi32(block[4 + row]), index_shift);
+        idx         = _mm_and_si128(_mm_srli_epi32(idx, 6), _mm_set1_epi32(0x3));
+
+        /* palette index * 4 bytes + {0, 1, 2, 3} */
+        const __m128i shuffle = _mm_add_epi32(_mm_slli_epi32(_mm_mullo_epi32(idx, _mm_set1_epi32(0x01010101)), 2), byte_offset);
+
+        rows[row] = _mm_shuffle_epi8(palette, shuffle);
+    }
+}
+
+static inline void BC3_Decode_Alpha_Palette(const uint8_t *block, uint8_t palette[16])
+{
+    const int a0 = block[0];
+    const int a1 = block[1];
+
+    memset(palette, 0, 16);
+    palette[0] = (uint8_t)a0;
+    palette[1] = (uint8_t)a1;
+
+    if (a0 > a1)
+    {
+        for (int i = 1; i < 7; i++)
+            palette[i + 1] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+    }
+    else
+    {
+        for (int i = 1; i < 5; i++)
+            palette[i + 1] = (uint8_t)(((5 - i) * a0 + i * a1) / 5);
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+/* Replaces the alpha of the 4 decoded rows with the BC3 alpha block */
+static inline void BC3_Decode_Alpha_Block(const uint8_t *block, __m128i rows[4])
+{
+    uint8_t alpha_palette[16];
+    BC3_Decode_Alpha_Palette(block, alpha_palette);
+
+    const __m128i palette = _mm_loadu_si128((const __m128i *)alpha_palette);
+
+    uint64_t bits = 0; // 16 * 3 bit indices
+    for (int i = 0; i < 6; i++)
+        bits |= (uint64_t)block[2 + i] << (8 * i);
+
+    const __m128i index_shift = _mm_setr_epi32(1 << 9, 1 << 6, 1 << 3, 1 << 0);
+    const __m128i rgb_mask    = _mm_set1_epi32(0x00FFFFFF);
+
+    for (int row = 0; row < 4; row++)
+    {
+        const int row_bits = (int)((bits >> (12 * row)) & 0xFFF);
+
+        __m128i idx = _mm_mullo_epi32(_mm_set1_epi32(row_bits), index_shift);
+        idx         = _mm_and_si128(_mm_srli_epi32(idx, 9), _mm_set1_epi32(0x7));
+
+        // Place the index in byte 3 of each lane, 0x80 zeros out the other bytes
+        const __m128i shuffle = _mm_or_si128(_mm_slli_epi32(idx, 24), _mm_set1_epi32(0x00808080));
+        const __m128i alpha   = _mm_shuffle_epi8(palette, shuffle);
+
+        rows[row] = _mm_or_si128(_mm_and_si128(rows[row], rgb_mask), alpha);
+    }
+}
+
+static void Texture_Decode_Block(const texture_t *t, const int block_index, uint32_t texels[16])
+{
+    __m128i rows[4];
+
+    if (t->format == TEXTURE_FORMAT_BC1)
+    {
+        BC1_Decode_Colour_Block(t->data + (size_t)block_index * 8, false, rows);
+    }
+    else
+    {
+        const uint8_t *block = t->data + (size_t)block_index * 16;
+        BC1_Decode_Colour_Block(block + 8, true, rows);
+        BC3_Decode_Alpha_Block(block, rows);
+    }
+
+    for (int row = 0; row < 4; row++)
+        _mm_storeu_si128((__m128i *)&texels[row * 4], rows[row]);
+}
+
+typedef struct
+{
+    uint32_t texture_id;
+    int      block_index;
+    uint32_t texels[16];
+} DecodedBlock_t;
+
+static THREAD_LOCAL DecodedBlock_t decoded_block_cache[TEXTURE_BLOCK_CACHE_SIZE];
+
+void Texture_Fetch_Compressed(const texture_t *t, int x, int y, uint8_t out[4])
+{
+    ASSERT(t->format == TEXTURE_FORMAT_BC1 || t->format == TEXTURE_FORMAT_BC3);
+
+    // The sampler can hand us one past the edge, clamp so we stay inside the block data
+    x = (x < 0) ? 0 : ((x >= t->w) ? t->w - 1 : x);
+    y = (y < 0) ? 0 : ((y >= t->h) ? t->h - 1 : y);
+    y += t->y_offset;
+
+    const int block_index = (y >> 2) * t->blocks_w + (x >> 2);
+    const int slot        = (block_index + (int)t->id * 7) & (TEXTURE_BLOCK_CACHE_SIZE - 1);
+
+    DecodedBlock_t *cached = &decoded_block_cache[slot];
+    if (cached->texture_id != t->id || cached->block_index != block_index)
+    {
+        Texture_Decode_Block(t, block_index, cached->texels);
+        cached->texture_id  = t->id;
+        cached->block_index = block_index;
+    }
+
+    memcpy(out, &cached->texels[(y & 3) * 4 + (x & 3)], 4);
+}
+
+/*
+Block compression, used to compress textures loaded through stb_image
+This is a quick bounding box fit and not a high quality encoder
+*/
+
+static inline uint16_t To_RGB565(const int r, const int g, const int b)
+{
+    return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+static void BC1_Encode_Colour_Block(const uint8_t texels[16][4], uint8_t *block)
+{
+    int min[3] = {255, 255, 255};
+    int max[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            min[c] = texels[i][c] < min[c] ? texels[i][c] : min[c];
+            max[c] = texels[i][c] > max[c] ? texels[i][c] : max[c];
+        }
+    }
+
+    // Inset the bounding box a little, reduces the error for the middle colours
+    for (int c = 0; c < 3; c++)
+    {
+        const int inset = (max[c] - min[c]) >> 4;
+        min[c] += inset;
+        max[c] -= inset;
+    }
+
+    // Pick the box diagonal that follows the colours, flip G and B if they go against R
+    const int center[3] = {(min[0] + max[0]) / 2, (min[1] + max[1]) / 2, (min[2] + max[2]) / 2};
+    for (int c = 1; c < 3; c++)
+    {
+        int covariance = 0;
+        for (int i = 0; i < 16; i++)
+            covariance += (texels[i][0] - center[0]) * (texels[i][c] - center[c]);
+
+        if (covariance < 0)
+        {
+            const int tmp = min[c];
+            min[c]        = max[c];
+            max[c]        = tmp;
+        }
+    }
+
+    uint16_t c0 = To_RGB565(max[0], max[1], max[2]);
+    uint16_t c1 = To_RGB565(min[0], min[1], min[2]);
+    if (c0 < c1)
+    {
+        const uint16_t tmp = c0;
+        c0                 = c1;
+        c1                 = tmp;
+    }
+
+    block[0] = (uint8_t)(c0 & 0xFF);
+    block[1] = (uint8_t)(c0 >> 8);
+    block[2] = (uint8_t)(c1 & 0xFF);
+    block[3] = (uint8_t)(c1 >> 8);
+
+    // Use the decoded palette so the indices match what the sampler will see
+    uint8_t palette[4][4];
+    _mm_storeu_si128((__m128i *)palette, BC1_Decode_Palette(block, true));
+
+    const int number_of_colours = (c0 == c1) ? 1 : 4;
+
+    uint32_t indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best_index = 0, best_error = INT32_MAX;
+        for (int p = 0; p < number_of_colours; p++)
+        {
+            const int dr    = texels[i][0] - palette[p][0];
+            const int dg    = texels[i][1] - palette[p][1];
+            const int db    = texels[i][2] - palette[p][2];
+            const int error = dr * dr + dg * dg + db * db;
+            if (error < best_error)
+            {
+                best_error = error;
+                best_index = p;
+            }
+        }
+        indices |= (uint32_t)best_index << (2 * i);
+    }
+
+    memcpy(block + 4, &indices, sizeof(indices));
+}
+
+static void BC3_Encode_Alpha_Block(const uint8_t texels[16][4], uint8_t *block)
+{
+    int min = 255, max = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        min = texels[i][3] < min ? texels[i][3] : min;
+        max = texels[i][3] > max ? texels[i][3] : max;
+    }
+
+    block[0] = (uint8_t)max;
+    block[1] = (uint8_t)min;
+
+    uint8_t palette[16];
+    BC3_Decode_Alpha_Palette(block, palette);
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best_index = 0, best_error = INT32_MAX;
+        for (int p = 0; p < 8; p++)
+        {
+            const int error = abs(texels[i][3] - palette[p]);
+            if (error < best_error)
+            {
+                best_error = error;
+                best_index = p;
+            }
+        }
+        indices |= (uint64_t)best_index << (3 * i);
+    }
+
+    for (int i = 0; i < 6; i++)
+        block[2 + i] = (uint8_t)(indices >> (8 * i));
+}
+
+texture_t Texture_Compress(const texture_t src, const texture_format_t format)
+{
+    ASSERT(src.data);
+    ASSERT(src.format == TEXTURE_FORMAT_UNCOMPRESSED);
+    ASSERT(format == TEXTURE_FORMAT_BC1 || format == TEXTURE_FORMAT_BC3);
+
+    texture_t t = {0};
+    t.w         = src.w;
+    t.h         = src.h;
+    t.bpp       = 4;
+    t.format    = format;
+    t.blocks_w  = (src.w + 3) / 4;
+    t.id        = (uint32_t)Platform_InterlockedIncrement(&texture_next_id);
+
+    const int    blocks_h   = (src.h + 3) / 4;
+    const size_t block_size = (format == TEXTURE_FORMAT_BC1) ? 8 : 16;
+
+    t.data = malloc(Texture_Size_In_Bytes(t));
+    if (!t.data)
+    {
+        fprintf(stderr, "Error allocating memory for compressed texture\n");
+        return (texture_t){0};
+    }
+
+    for (int by = 0; by < blocks_h; by++)
+    {
+        for (int bx = 0; bx < t.blocks_w; bx++)
+        {
+            /* Gather the 4x4 texels, clamping at the edges for partial blocks */
+            uint8_t texels[16][4];
+            for (int i = 0; i < 16; i++)
+            {
+                int x = bx * 4 + (i & 3);
+                int y = by * 4 + (i >> 2);
+                x     = x < src.w ? x : src.w - 1;
+                y     = y < src.h ? y : src.h - 1;
+
+                const unsigned char *p = Texture_Get_Pixel(src, x, y);
+                if (src.bpp >= 3)
+                {
+                    texels[i][0] = p[0];
+                    texels[i][1] = p[1];
+                    texels[i][2] = p[2];
+                    texels[i][3] = (src.bpp == 4) ? p[3] : 255;
+                }
+                else // grey, grey + alpha
+                {
+                    texels[i][0] = texels[i][1] = texels[i][2] = p[0];
+                    texels[i][3] = (src.bpp == 2) ? p[1] : 255;
+                }
+            }
+
+            uint8_t *block = t.data + ((size_t)by * t.blocks_w + bx) * block_size;
+            if (format == TEXTURE_FORMAT_BC1)
+            {
+                BC1_Encode_Colour_Block(texels, block);
+            }
+            else
+            {
+                BC3_Encode_Alpha_Block(texels, block);
+                BC1_Encode_Colour_Block(texels, block + 8);
+            }
+        }
+    }
+
+    return t;
+}
+
+/*
+DDS files, we only support the top mip of BC1/BC3 data
+    - "DDS " magic, then a 124 byte header, optionally followed by the 20 byte DX10 header
+*/
+#define DDS_HEADER_SIZE      128
+#define DDS_DX10_HEADER_SIZE 20
+#define DDS_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/* The image is stored top down, flip the block rows and the texel rows inside each block
+    to match stbi_set_flip_vertically_on_load
+    - When the height is not a multiple of 4 the last block row is padded at the bottom, after the flip the
+        padding is the first 4 - h % 4 texel rows, y_offset skips them */
+static void DDS_Flip_Blocks(texture_t *t)
+{
+    const int    blocks_h   = (t->h + 3) / 4;
+    const size_t block_size = (t->format == TEXTURE_FORMAT_BC1) ? 8 : 16;
+    const size_t row_size   = block_size * t->blocks_w;
+
+    t->y_offset = blocks_h * 4 - t->h;
+
+    uint8_t *tmp = malloc(row_size);
+    ASSERT(tmp);
+
+    for (int by = 0; by < blocks_h / 2; by++)
+    {
+        uint8_t *top    = t->data + by * row_size;
+        uint8_t *bottom = t->data + (blocks_h - 1 - by) * row_size;
+        memcpy(tmp, top, row_size);
+        memcpy(top, bottom, row_size);
+        memcpy(bottom, tmp, row_size);
+    }
+    free(tmp);
+
+    for (size_t b = 0; b < (size_t)blocks_h * t->blocks_w; b++)
+    {
+        uint8_t *block = t->data + b * block_size;
+        if (t->format == TEXTURE_FORMAT_BC3)
+        {
+            uint64_t bits = 0, flipped = 0;
+            for (int i = 0; i < 6; i++)
+                bits |= (uint64_t)block[2 + i] << (8 * i);
+            for (int row = 0; row < 4; row++)
+                flipped |= ((bits >> (12 * row)) & 0xFFF) << (12 * (3 - row));
+            for (int i = 0; i < 6; i++)
+                block[2 + i] = (uint8_t)(flipped >> (8 * i));
+            block += 8;
+        }
+
+        const uint8_t r0 = block[4], r1 = block[5];
+        block[4]         = block[7];
+        block[5]         = block[6];
+        block[6]         = r1;
+        block[7]         = r0;
+    }
+}
+
+static texture_t Texture_Load_DDS(const uint8_t *file, const size_t file_size, const char *file_path)
+{
+    texture_t t = {0};
+
+    if (file_size < DDS_HEADER_SIZE || Read_U32(file) != DDS_FOURCC('D', 'D', 'S', ' '))
+    {
+        fprintf(stderr, "Not a DDS file : %s\n", file_path);
+        return t;
+    }
+
+    size_t data_offset = DDS_HEADER_SIZE;
+
+    const uint32_t four_cc = Read_U32(file + 84);
+    if (four_cc == DDS_FOURCC('D', 'X', 'T', '1'))
+    {
+        t.format = TEXTURE_FORMAT_BC1;
+    }
+    else if (four_cc == DDS_FOURCC('D', 'X', 'T', '5'))
+    {
+        t.format = TEXTURE_FORMAT_BC3;
+    }
+    else if (four_cc == DDS_FOURCC('D', 'X', '1', '0') && file_size >= DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE)
+    {
+        const uint32_t dxgi_format = Read_U32(file + DDS_HEADER_SIZE);
+        if (dxgi_format == 71 || dxgi_format == 72) // DXGI_FORMAT_BC1_UNORM(_SRGB)
+            t.format = TEXTURE_FORMAT_BC1;
+        else if (dxgi_format == 77 || dxgi_format == 78) // DXGI_FORMAT_BC3_UNORM(_SRGB)
+            t.format = TEXTURE_FORMAT_BC3;
+
+        data_offset += DDS_DX10_HEADER_SIZE;
+    }
+
+    if (t.format == TEXTURE_FORMAT_UNCOMPRESSED)
+    {
+        fprintf(stderr, "Unsupported DDS format (only BC1/BC3 are supported) : %s\n", file_path);
+        return t;
+    }
+
+    t.h        = (int)Read_U32(file + 12);
+    t.w        = (int)Read_U32(file + 16);
+    t.bpp      = 4;
+    t.blocks_w = (t.w + 3) / 4;
+    t.id       = (uint32_t)Platform_InterlockedIncrement(&texture_next_id);
+
+    const size_t size = Texture_Size_In_Bytes(t);
+
+    t.data = (data_offset + size <= file_size) ? malloc(size) : NULL;
+    if (!t.data)
+    {
+        fprintf(stderr, "Error reading DDS data : %s\n", file_path);
+        return (texture_t){0};
+    }
+    memcpy(t.data, file + data_offset, size);
+
+    DDS_Flip_Blocks(&t);
+
+    return t;
+}
+
+static bool Has_Extension(const char *file_path, const char *ext)
+{
+    const size_t path_len = strlen(file_path);
+    const size_t ext_len  = strlen(ext);
+    if (path_len < ext_len)
+        return false;
+
+    for (size_t i = 0; i < ext_len; i++)
+    {
+        char c = file_path[path_len - ext_len + i];
+        c      = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        if (c != ext[i])
+            return false;
+    }
+    return true;
+}
+
 texture_t Texture_Load(const char *file_path, const int bbp)
 {
     texture_t t = {0};
 
-    // textures oriented tha same as you view them in paint
-    stbi_set_flip_vertically_on_load(1);
+    // Decode straight out of the page cache, no need for stbi to fread a copy of the file
+    file_map_t map;
+    if (!File_Map(file_path, &map, FILE_MAP_ACCESS_SEQUENTIAL))
+    {
+        perror(file_path);
+        ASSERT(map.data);
+        return t;
+    }
+
+    if (Has_Extension(file_path, ".dds"))
+    {
+        t = Texture_Load_DDS((const uint8_t *)map.data, map.size, file_path);
+        File_Unmap(&map);
+        ASSERT(t.data);
+        return t;
+    }
+
+    // textures oriented tha same as you view them in paint, per thread as textures are decoded on the job system
+    stbi_set_flip_vertically_on_load_thread(1);
+
+    unsigned char *data = stbi_load_from_memory((const stbi_uc *)map.data, (int)map.size, &t.w, &t.h, &t.bpp, bbp);
+    File_Unmap(&map);
 
-    unsigned char *data = stbi_load(file_path, &t.w, &t.h, &t.bpp, bbp);
     if (!data)
     {
         fprintf(stderr, "Cannot load image : %s : %s\n", stbi_failure_reason(), file_path);
-        assert(data);
+        ASSERT(data);
         return t;
     }
 
+    // stbi returns the channels in the file, not the ones we asked for
+    if (bbp != 0)
+        t.bpp = bbp;
+
     t.data = data;
 
+    if (TEXTURE_COMPRESS_ON_LOAD != TEXTURE_FORMAT_UNCOMPRESSED)
+    {
+        texture_t compressed = Texture_Compress(t, TEXTURE_COMPRESS_ON_LOAD);
+        if (compressed.data)
+        {
+            Texture_Destroy(&t);
+            t = compressed;
+        }
+    }
+
     return t;
-}
\ No newline at end of file
+}
@@ -2,30 +2,104 @@
 #define __TEX_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "stb_image.h"
 
+typedef enum
+{
+    TEXTURE_FORMAT_UNCOMPRESSED = 0, /* 'bpp' bytes per texel, straight from stb_image */
+    TEXTURE_FORMAT_BC1,              /* 8 bytes per 4x4 block, RGB (DXT1) */
+    TEXTURE_FORMAT_BC3,              /* 16 bytes per 4x4 block, RGB + interpolated alpha (DXT5) */
+} texture_format_t;
+
+/*
+Set this to TEXTURE_FORMAT_BC1 or TEXTURE_FORMAT_BC3 to have every texture loaded through
+stb_image block compressed at load time, this cuts the memory used by a texture by 4-8x.
+.dds files containing BC1/BC3 data are always loaded compressed.
+*/
+#define TEXTURE_COMPRESS_ON_LOAD TEXTURE_FORMAT_UNCOMPRESSED
+
+#define TEXTURE_BLOCK_CACHE_SIZE 64 /* Decoded 4x4 blocks kept per thread, must be a power of 2 */
+
 typedef struct
 {
     int            w, h, bpp;
     unsigned char *data;
+
+    texture_format_t format;
+    int              blocks_w; /* number of 4x4 blocks in a row (compressed formats only) */
+    int              y_offset; /* padding texel rows in front of row 0 of the block data, flipped DDS files only */
+    uint32_t         id;       /* key for the decoded block cache (compressed formats only) */
 } texture_t;
 
 texture_t Texture_Load(const char *file_path, int bbp);
+texture_t Texture_Compress(const texture_t src, texture_format_t format);
+void      Texture_Fetch_Compressed(const texture_t *t, int x, int y, uint8_t out[4]);
 
 static inline unsigned char *Texture_Get_Pixel(const texture_t t, const int x, const int y)
 {
     return t.data + ((x + t.w * y) * t.bpp);
 }
 
+/* Get the RGBA value of a texel, works for every texture format */
+static inline void Texture_Fetch(const texture_t *t, const int x, const int y, uint8_t out[4])
+{
+    if (t->format == TEXTURE_FORMAT_UNCOMPRESSED)
+    {
+        const unsigned char *const texel = Texture_Get_Pixel(*t, x, y);
+
+        out[0] = texel[0];
+        out[1] = texel[1];
+        out[2] = texel[2];
+        out[3] = (t->bpp == 4) ? texel[3] : 255;
+    }
+    else
+    {
+        Texture_Fetch_Compressed(t, x, y, out);
+    }
+}
+
+static inline size_t Texture_Size_In_Bytes(const texture_t t)
+{
+    const size_t blocks = (size_t)((t.w + 3) / 4) * (size_t)((t.h + 3) / 4);
+
+    switch (t.format)
+    {
+    case TEXTURE_FORMAT_BC1:
+        return blocks * 8;
+    case TEXTURE_FORMAT_BC3:
+        return blocks * 16;
+    default:
+        return (size_t)t.w * (size_t)t.h * (size_t)t.bpp;
+    }
+}
+
 static inline void Texture_Print_Info(const texture_t t)
 {
+    static const char *format_names[] = {"Uncompressed", "BC1", "BC3"};
+
     fprintf(stderr, "Texture width  : %d\n", t.w);
     fprintf(stderr, "Texture height : %d\n", t.h);
     fprintf(stderr, "Texture bbp    : %d\n", t.bpp);
+    fprintf(stderr, "Texture format : %s\n", format_names[t.format]);
+    fprintf(stderr, "Texture size   : %zu bytes\n", Texture_Size_In_Bytes(t));
 }
 
+/*
+Texture cache, shared by everything that loads textures
+    - Keyed by the file path, a file is decoded once and every user gets a handle to the same texture_t
+    - Handles are ref counted, the texture is freed when the last one is released
+    - Texture_Cache_Acquire_All decodes the files it has not seen before concurrently on the job system,
+        the job system has to be running. Acquire and release from the main thread only
+    - A file that fails to load still gets a handle, with its data left NULL
+*/
+void       Texture_Cache_Acquire_All(const char *const *file_paths, size_t number_of_paths, texture_t **textures);
+texture_t *Texture_Cache_Acquire(const char *file_path);
+void       Texture_Cache_Release(texture_t *texture);
+
 static inline void Texture_Destroy(texture_t *t)
 {
     if (t->data)
@@ -36,4 +110,4 @@ static inline void Texture_Destroy(texture_t *t)
     *t = (texture_t){0};
 }
 
-#endif // __TEX_H__
\ No newline at end of file
+#endif // __TEX_H__
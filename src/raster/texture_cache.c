@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tex.h"
+#include "utils/utils.h"
+#include "job_system/js.h"
+#include "utils/trace.h"
+
+/*
+Texture cache
+    - One entry per file path, the texture is the first member so a handle converts straight back to its entry
+    - Entries are allocated one by one so the handles stay put when the table grows
+    - A scene has tens to hundreds of textures, a linear search by path is cheaper than it sounds next to decoding
+*/
+typedef struct
+{
+    texture_t texture;
+    char     *file_path;
+    int32_t   ref_count;
+} TextureCacheEntry_t;
+
+static struct
+{
+    TextureCacheEntry_t **entries;
+    size_t                count;
+    size_t                capacity;
+} Texture_Cache;
+
+typedef struct
+{
+    TextureCacheEntry_t **entries; /* Entries waiting to be decoded */
+    size_t                number_of_entries;
+    int32_t               next_entry;
+} TextureDecodeWork_t;
+
+static TextureCacheEntry_t *Find_Entry(const char *file_path)
+{
+    for (size_t i = 0; i < Texture_Cache.count; i++)
+        if (strcmp(Texture_Cache.entries[i]->file_path, file_path) == 0)
+            return Texture_Cache.entries[i];
+
+    return NULL;
+}
+
+static TextureCacheEntry_t *Add_Entry(const char *file_path)
+{
+    if (Texture_Cache.count == Texture_Cache.capacity)
+    {
+        const size_t new_capacity = (Texture_Cache.capacity) ? Texture_Cache.capacity * 2 : 64;
+
+        TextureCacheEntry_t **new_entries = realloc(Texture_Cache.entries, sizeof(TextureCacheEntry_t *) * new_capacity);
+        ASSERT(new_entries);
+
+        Texture_Cache.entries  = new_entries;
+        Texture_Cache.capacity = new_capacity;
+    }
+
+    TextureCacheEntry_t *entry = calloc(1, sizeof(TextureCacheEntry_t));
+    ASSERT(entry);
+
+    const size_t path_length = strlen(file_path) + 1;
+    entry->file_path         = malloc(path_length);
+    ASSERT(entry->file_path);
+    memcpy(entry->file_path, file_path, path_length);
+
+    Texture_Cache.entries[Texture_Cache.count++] = entry;
+    return entry;
+}
+
+/* Each job keeps taking the next texture until there are none left, so a few slow files do not hold up the rest */
+static void Decode_Textures(void *arguments)
+{
+    TextureDecodeWork_t *work = (TextureDecodeWork_t *)arguments;
+
+    for (;;)
+    {
+        const size_t i = (size_t)(Platform_InterlockedIncrement(&work->next_entry) - 1);
+        if (i >= work->number_of_entries)
+            break;
+
+        TextureCacheEntry_t *entry = work->entries[i];
+        printf("Loading texture : %s\n", entry->file_path);
+
+        TraceScope_t trace = Trace_Begin("Texture_Load");
+        entry->texture     = Texture_Load(entry->file_path, 0);
+        Trace_End(&trace);
+    }
+}
+
+void Texture_Cache_Acquire_All(const char *const *file_paths, const size_t number_of_paths, texture_t **textures)
+{
+    ASSERT(file_paths && textures);
+
+    TextureDecodeWork_t work = {0};
+    work.entries             = malloc(sizeof(TextureCacheEntry_t *) * (number_of_paths + 1));
+    ASSERT(work.entries);
+
+    /* Files already in the cache, or asked for twice in this batch, only take another reference */
+    for (size_t i = 0; i < number_of_paths; i++)
+    {
+        TextureCacheEntry_t *entry = Find_Entry(file_paths[i]);
+        if (entry == NULL)
+        {
+            entry                                  = Add_Entry(file_paths[i]);
+            work.entries[work.number_of_entries++] = entry;
+        }
+
+        entry->ref_count++;
+        textures[i] = &entry->texture;
+    }
+
+    if (work.number_of_entries > 0)
+    {
+        job_t job = {Decode_Textures, (void *)&work};
+
+        const size_t number_of_jobs = (work.number_of_entries < NUM_OF_THREADS + 1) ? work.number_of_entries : NUM_OF_THREADS + 1;
+        for (size_t j = 0; j < number_of_jobs; j++)
+            job_submit(job);
+
+        jobs_complete_all_work();
+    }
+
+    free(work.entries);
+}
+
+texture_t *Texture_Cache_Acquire(const char *file_path)
+{
+    texture_t *texture;
+    Texture_Cache_Acquire_All(&file_path, 1, &texture);
+    return texture;
+}
+
+void Texture_Cache_Release(texture_t *texture)
+{
+    if (texture == NULL)
+        return;
+
+    TextureCacheEntry_t *entry = (TextureCacheEntry_t *)texture;
+    ASSERT(entry->ref_count > 0);
+
+    if (--entry->ref_count > 0)
+        return;
+
+    for (size_t i = 0; i < Texture_Cache.count; i++)
+    {
+        if (Texture_Cache.entries[i] == entry)
+        {
+            Texture_Cache.entries[i] = Texture_Cache.entries[--Texture_Cache.count];
+            break;
+        }
+    }
+
+    Texture_Destroy(&entry->texture);
+    free(entry->file_path);
+    free(entry);
+
+    if (Texture_Cache.count == 0)
+    {
+        free(Texture_Cache.entries);
+        Texture_Cache.entries  = NULL;
+        Texture_Cache.capacity = 0;
+    }
+}
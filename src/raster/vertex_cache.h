@@ -1,44 +1,57 @@
 #ifndef __VERTEX_CACHE_H__
 #define __VERTEX_CACHE_H__
 
-#include "cglm/cglm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
-#define VERTEX_CACHE_SIZE 16
+#include "shaders.h"
+
+/*
+Post transform vertex cache
+    - Direct mapped, a vertex index always lands in slot (index & (VERTEX_CACHE_SIZE - 1)) so a lookup
+        is one compare instead of a search
+    - Stores the vertex after the vertex shader and the view port transform, ready for triangle setup
+    - One cache per setup job, neighbouring triangles in an indexed mesh share most of their vertices
+*/
+#define VERTEX_CACHE_SIZE 32 /* Must be a power of 2 */
+
+#define VERTEX_CACHE_EMPTY_INDEX UINT32_MAX
 
 typedef struct
 {
-    vec4 clip_values[VERTEX_CACHE_SIZE];
-    int  index_values[VERTEX_CACHE_SIZE];
-    int  front;
+    __m128              position[VERTEX_CACHE_SIZE];
+    VaryingAttributes_t varying[VERTEX_CACHE_SIZE];
+    uint32_t            index_values[VERTEX_CACHE_SIZE];
 } VertCache_t;
 
-#define VertCACHE_CREATE \
-    (VertCache) { 0 }
+#define VertCACHE_CREATE(cache) \
+    memset((cache)->index_values, 0xFF, sizeof((cache)->index_values))
 
-static inline void VertCache_Add(VertCache_t *cache, int index, vec4 vert)
+static inline void VertCache_Reset(VertCache_t *cache)
 {
-    glm_vec4_copy(vert, cache->clip_values[cache->front]);
-    cache->index_values[cache->front] = index;
-    cache->front                      = (cache->front + 1) % VERTEX_CACHE_SIZE;
+    VertCACHE_CREATE(cache);
 }
 
-static inline int VertCache_Lookup(VertCache_t *cache, int index, vec4 dest)
+static inline void VertCache_Add(VertCache_t *cache, const uint32_t index, const __m128 position, const VaryingAttributes_t *varying)
 {
-    for (int i = 0; i < VERTEX_CACHE_SIZE; i++)
-    {
-        if (cache->index_values[i] == index)
-        {
-            glm_vec4_copy(cache->clip_values[i], dest);
-            return 1; // Return true
-        }
-    }
-    return -1; // Return false
+    const uint32_t slot = index & (VERTEX_CACHE_SIZE - 1);
+
+    cache->position[slot]     = position;
+    cache->varying[slot]      = *varying;
+    cache->index_values[slot] = index;
 }
 
-static inline void FIFOCache_Reset_Index_Values(VertCache_t *cache)
+static inline bool VertCache_Lookup(const VertCache_t *cache, const uint32_t index, __m128 *position, VaryingAttributes_t *varying)
 {
-    *cache = (VertCache_t){0};
-    memset(cache->index_values, -1, sizeof(int) * VERTEX_CACHE_SIZE);
+    const uint32_t slot = index & (VERTEX_CACHE_SIZE - 1);
+
+    if (cache->index_values[slot] != index)
+        return false;
+
+    *position = cache->position[slot];
+    *varying  = cache->varying[slot];
+    return true;
 }
 
-#endif // __VERTEX_CACHE_H__
\ No newline at end of file
+#endif // __VERTEX_CACHE_H__
@@ -0,0 +1,146 @@
+#ifndef __FILE_MAP_H__
+#define __FILE_MAP_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+/* How the mapping is going to be read, passed on to the OS as a paging hint */
+typedef enum
+{
+    FILE_MAP_ACCESS_NORMAL = 0,
+    FILE_MAP_ACCESS_SEQUENTIAL, // read front to back once, aggressive read ahead (parsing files)
+    FILE_MAP_ACCESS_WILL_NEED,  // all of it is needed soon, start paging it in now
+} file_map_access_t;
+
+/*
+Read only memory mapped view of a whole file
+    - The pages are loaded straight from the page cache on first touch, there is no copy
+        into a malloc'd buffer like with fread
+*/
+typedef struct
+{
+    void  *data;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} file_map_t;
+
+static inline bool File_Get_Info(const char *path, uint64_t *size, int64_t *modified_time)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0)
+        return false;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+#endif
+    if (size)
+        *size = (uint64_t)st.st_size;
+    if (modified_time)
+        *modified_time = (int64_t)st.st_mtime;
+    return true;
+}
+
+static inline size_t File_Page_Size(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static inline bool File_Map(const char *path, file_map_t *map, const file_map_access_t access)
+{
+    *map = (file_map_t){0};
+
+#if defined(_WIN32)
+    const DWORD flags = (access == FILE_MAP_ACCESS_SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if (map->file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(map->file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(map->file);
+        return false;
+    }
+
+    map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map->mapping == NULL)
+    {
+        CloseHandle(map->file);
+        return false;
+    }
+
+    map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (map->data == NULL)
+    {
+        CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        return false;
+    }
+    map->size = (size_t)file_size.QuadPart;
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if (data == MAP_FAILED)
+        return false;
+
+    if (access == FILE_MAP_ACCESS_SEQUENTIAL)
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    else if (access == FILE_MAP_ACCESS_WILL_NEED)
+        madvise(data, (size_t)st.st_size, MADV_WILLNEED);
+
+    map->data = data;
+    map->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+static inline void File_Unmap(file_map_t *map)
+{
+    if (map->data == NULL)
+        return;
+
+#if defined(_WIN32)
+    UnmapViewOfFile(map->data);
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+#else
+    munmap(map->data, map->size);
+#endif
+    *map = (file_map_t){0};
+}
+
+#endif // __FILE_MAP_H__
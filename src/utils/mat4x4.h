@@ -68,6 +68,44 @@ DASH_INLINE __m128 mat4x4_mul_m128(const mat4x4 mat, const __m128 vec)
 #endif
 }
 
+/*
+Transform 4 points (w = 1) given in SoA form, X, Y and Z each hold one component of all 4 points
+    - Each matrix element is broadcast across the lanes so every lane does useful work,
+        out[0..3] are the X, Y, Z, W of the 4 results
+*/
+#define MAT4X4_SOA_ROW(mat, row, X, Y, Z)                                                                          \
+    _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(mat[0], mat[0], _MM_SHUFFLE(row, row, row, row)), X),       \
+                          _mm_mul_ps(_mm_shuffle_ps(mat[1], mat[1], _MM_SHUFFLE(row, row, row, row)), Y)),      \
+               _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(mat[2], mat[2], _MM_SHUFFLE(row, row, row, row)), Z),       \
+                          _mm_shuffle_ps(mat[3], mat[3], _MM_SHUFFLE(row, row, row, row))))
+
+DASH_INLINE
+void mat4x4_mul_soa4(const mat4x4 mat, const __m128 X, const __m128 Y, const __m128 Z, __m128 out[4])
+{
+    out[0] = MAT4X4_SOA_ROW(mat, 0, X, Y, Z);
+    out[1] = MAT4X4_SOA_ROW(mat, 1, X, Y, Z);
+    out[2] = MAT4X4_SOA_ROW(mat, 2, X, Y, Z);
+    out[3] = MAT4X4_SOA_ROW(mat, 3, X, Y, Z);
+}
+
+#if defined(__AVX2__)
+/* Same as mat4x4_mul_soa4 for 8 points at once */
+    #define MAT4X4_SOA8_ROW(mat, row, X, Y, Z)                                                                            \
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_broadcastss_ps(_mm_shuffle_ps(mat[0], mat[0], _MM_SHUFFLE(row, row, row, row))), X), \
+                                    _mm256_mul_ps(_mm256_broadcastss_ps(_mm_shuffle_ps(mat[1], mat[1], _MM_SHUFFLE(row, row, row, row))), Y)), \
+                      _mm256_add_ps(_mm256_mul_ps(_mm256_broadcastss_ps(_mm_shuffle_ps(mat[2], mat[2], _MM_SHUFFLE(row, row, row, row))), Z), \
+                                    _mm256_broadcastss_ps(_mm_shuffle_ps(mat[3], mat[3], _MM_SHUFFLE(row, row, row, row)))))
+
+DASH_INLINE
+void mat4x4_mul_soa8(const mat4x4 mat, const __m256 X, const __m256 Y, const __m256 Z, __m256 out[4])
+{
+    out[0] = MAT4X4_SOA8_ROW(mat, 0, X, Y, Z);
+    out[1] = MAT4X4_SOA8_ROW(mat, 1, X, Y, Z);
+    out[2] = MAT4X4_SOA8_ROW(mat, 2, X, Y, Z);
+    out[3] = MAT4X4_SOA8_ROW(mat, 3, X, Y, Z);
+}
+#endif
+
 DASH_INLINE
 void dash_make_identity(mat4x4 m)
 {
@@ -0,0 +1,27 @@
+#include <assert.h>
+
+#include "timer.h"
+
+/* One copy for the whole program, written once by Timer_Init before the job threads read it */
+static double Timer_Cycles_Per_Second = 0.0;
+
+void Timer_Init(void)
+{
+    const uint64_t frequency  = Timer_OS_Frequency();
+    const uint64_t os_start   = Timer_OS_Now();
+    const uint64_t tsc_start  = Cycles_Now();
+    const uint64_t os_wait    = frequency / 50;
+    uint64_t       os_elapsed = 0;
+    while ((os_elapsed = Timer_OS_Now() - os_start) < os_wait)
+    {
+    }
+    const uint64_t tsc_elapsed = Cycles_Now() - tsc_start;
+
+    Timer_Cycles_Per_Second = (double)tsc_elapsed * (double)frequency / (double)os_elapsed;
+}
+
+double Cycles_Per_Second(void)
+{
+    assert(Timer_Cycles_Per_Second > 0.0 && "Timer_Init has not been called");
+    return Timer_Cycles_Per_Second;
+}
@@ -1,9 +1,30 @@
 #ifndef __TIMER_H__
 #define __TIMER_H__
 
-#include <windows.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 
+#ifdef _WIN32
+    #include <windows.h>
+    #include <intrin.h>
+#else
+    #include <x86intrin.h>
+#endif
+
+/*
+High resolution timer
+    - hp_timer_t counts in ticks of one of the backends below, Timer_Get_Elapsed_* turn the ticks into time
+        - QueryPerformanceCounter, the default on Windows
+        - clock_gettime(CLOCK_MONOTONIC_RAW), the default everywhere else, ticks are nanoseconds
+        - rdtscp, define TIMER_BACKEND_RDTSCP to use it, the cheapest to read. Ticks are cycles of the
+            time stamp counter, Cycles_Per_Second is measured against the OS clock by Timer_Init
+    - Call Timer_Init once at startup, before any thread uses a timer
+    - Cycles_Now always reads the time stamp counter, for timing hot loops in cycles
+    - TIMER_SCOPE and CYCLES_SCOPE time the block that follows them, leaving the block with break or return skips them
+*/
+// #define TIMER_BACKEND_RDTSCP
+
 #define time_this_funtion(a)                                                                 \
     do                                                                                       \
     {                                                                                        \
@@ -15,49 +36,134 @@
 
 typedef struct
 {
-    LARGE_INTEGER start;
-    LARGE_INTEGER elapsed;
-    LARGE_INTEGER perf_frequency;
+    uint64_t start;
+    uint64_t elapsed;
     // char  *name;
-} timer_t;
+} hp_timer_t;
+
+/* The OS clock, in ticks of Timer_OS_Frequency */
+static inline uint64_t Timer_OS_Now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64_t)now.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static inline uint64_t Timer_OS_Frequency(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)frequency.QuadPart;
+#else
+    return 1000000000ull;
+#endif
+}
+
+/* rdtscp waits for the instructions before it to finish, so the work being timed is not counted short */
+static inline uint64_t Cycles_Now(void)
+{
+    unsigned int processor_id;
+    return (uint64_t)__rdtscp(&processor_id);
+}
+
+/* Measures the rate of the time stamp counter over 20ms against the OS clock, in timer.c */
+void Timer_Init(void);
+
+/* The rate Timer_Init measured */
+double Cycles_Per_Second(void);
 
-inline void Timer_Start(timer_t *const timer)
+/* Ticks of the selected backend */
+static inline uint64_t Timer_Now(void)
 {
-    QueryPerformanceFrequency(&timer->perf_frequency);
-    QueryPerformanceCounter(&timer->start);
-    timer->elapsed.QuadPart = 0;
+#ifdef TIMER_BACKEND_RDTSCP
+    return Cycles_Now();
+#else
+    return Timer_OS_Now();
+#endif
 }
 
-inline timer_t Timer_Init_Start(void)
+static inline double Timer_Frequency(void)
 {
-    timer_t t = {0};
+#ifdef TIMER_BACKEND_RDTSCP
+    return Cycles_Per_Second();
+#else
+    return (double)Timer_OS_Frequency();
+#endif
+}
+
+static inline void Timer_Start(hp_timer_t *const timer)
+{
+    timer->start   = Timer_Now();
+    timer->elapsed = 0;
+}
+
+static inline hp_timer_t Timer_Init_Start(void)
+{
+    hp_timer_t t = {0};
     Timer_Start(&t);
     return t;
 }
 
-inline void Timer_Update(timer_t *const timer)
+/* Time since the last update, and start timing again from now */
+static inline void Timer_Update(hp_timer_t *const timer)
 {
-    LARGE_INTEGER new_time;
-    QueryPerformanceCounter(&new_time);
-    timer->elapsed.QuadPart = new_time.QuadPart - timer->start.QuadPart;
-    timer->start.QuadPart   = new_time.QuadPart;
+    const uint64_t new_time = Timer_Now();
+    timer->elapsed          = new_time - timer->start;
+    timer->start            = new_time;
 }
 
-inline void Timer_Stop(timer_t *const timer)
+static inline void Timer_Stop(hp_timer_t *const timer)
 {
-    LARGE_INTEGER current_time;
-    QueryPerformanceCounter(&current_time);
-    timer->elapsed.QuadPart = current_time.QuadPart - timer->start.QuadPart;
+    timer->elapsed = Timer_Now() - timer->start;
 }
 
-inline double Timer_Get_Elapsed_Seconds(const timer_t *const timer)
+static inline double Timer_Get_Elapsed_Seconds(const hp_timer_t *const timer)
 {
-    return (double)timer->elapsed.QuadPart / (double)timer->perf_frequency.QuadPart;
+    return (double)timer->elapsed / Timer_Frequency();
 }
 
-inline double Timer_Get_Elapsed_MS(const timer_t *const timer)
+static inline double Timer_Get_Elapsed_MS(const hp_timer_t *const timer)
 {
     return Timer_Get_Elapsed_Seconds(timer) * 1000.0;
 }
 
-#endif // __TIMER_H__
\ No newline at end of file
+static inline double Timer_Get_Elapsed_NS(const hp_timer_t *const timer)
+{
+    return Timer_Get_Elapsed_Seconds(timer) * 1000000000.0;
+}
+
+/*
+Print how long the block took
+
+    TIMER_SCOPE("Mesh_Load")
+    {
+        mesh = Mesh_Load(file_name);
+    }
+*/
+#define TIMER_SCOPE(label)                                                                                 \
+    for (hp_timer_t _scope_timer = Timer_Init_Start(), *_scope_once = &_scope_timer; _scope_once != NULL; \
+         Timer_Stop(&_scope_timer),                                                                        \
+                    printf("%s \t> Elapsed: %f ms\n", (label), Timer_Get_Elapsed_MS(&_scope_timer)),      \
+                    _scope_once = NULL)
+
+/*
+Add the cycles the block took to 'total', a uint64_t
+
+    uint64_t raster_cycles = 0;
+    CYCLES_SCOPE(raster_cycles)
+    {
+        Raster_Triangles_MT();
+    }
+*/
+#define CYCLES_SCOPE(total)                                                                   \
+    for (uint64_t _scope_start = Cycles_Now(), _scope_once = 1; _scope_once != 0;            \
+         (total) += Cycles_Now() - _scope_start, _scope_once = 0)
+
+#endif // __TIMER_H__
@@ -0,0 +1,199 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <immintrin.h>
+
+#include "utils/utils.h"
+#include "utils/timer.h"
+#include "job_system/js.h"
+
+/*
+
+Define this before the header to include the function bodies
+
+#define TRACE_IMPLEMENTATION
+
+
+Hot path instrumentation, always compiled in
+    - A scope is a pair of timestamps, Trace_Begin reads the clock and Trace_End writes one event
+    - Every thread records into its own ring buffer, made the first time it records anything,
+        there is one writer per ring so nothing is locked and no atomics are needed to record
+    - A full ring overwrites its oldest events, a dump always holds the last TRACE_EVENTS_PER_THREAD
+        events of each thread
+    - Trace_Write_Chrome_JSON dumps every ring in the Chrome trace event format, open it in
+        chrome://tracing or ui.perfetto.dev. Call it when no jobs are running
+    - Trace_Enabled turns recording off at run time, a scope then only costs a branch
+
+Example:
+
+    TraceScope_t scope = Trace_Begin("Setup_Triangles");
+    ... work ...
+    Trace_End(&scope);
+
+*/
+
+#define TRACE_EVENTS_PER_THREAD 16384 /* Must be a power of 2 */
+#define TRACE_MAX_THREADS       32
+
+typedef struct
+{
+    const char *name; /* Has to outlive the trace, string literals only */
+    uint64_t    start;
+    uint64_t    end;
+} TraceEvent_t;
+
+typedef struct
+{
+    const char *name;
+    uint64_t    start;
+} TraceScope_t;
+
+extern volatile bool Trace_Enabled;
+
+void Trace_Record(const char *name, uint64_t start, uint64_t end);
+void Trace_Set_Thread_Name(const char *name); /* Shown in the trace viewer instead of the thread index */
+bool Trace_Write_Chrome_JSON(const char *file_path);
+
+/* Ticks of the timer backend, see timer.h */
+static inline uint64_t Trace_Now(void)
+{
+    return Timer_Now();
+}
+
+static inline TraceScope_t Trace_Begin(const char *name)
+{
+    TraceScope_t scope = {name, 0};
+    if (Trace_Enabled)
+        scope.start = Trace_Now();
+    return scope;
+}
+
+static inline void Trace_End(const TraceScope_t *scope)
+{
+    if (Trace_Enabled && scope->start != 0)
+        Trace_Record(scope->name, scope->start, Trace_Now());
+}
+
+// Trace implementation
+
+#ifdef TRACE_IMPLEMENTATION
+
+typedef struct
+{
+    TraceEvent_t events[TRACE_EVENTS_PER_THREAD];
+    uint64_t     number_of_events; /* Only ever goes up, the ring index is this modulo the size */
+    const char  *name;
+    int          index;
+} TraceThread_t;
+
+volatile bool Trace_Enabled = true;
+
+static TraceThread_t *Trace_Threads[TRACE_MAX_THREADS];
+static int32_t        Trace_Number_Of_Threads = 0;
+
+static THREAD_LOCAL TraceThread_t *Trace_This_Thread = NULL;
+
+static TraceThread_t *_Trace_Get_Thread(void)
+{
+    if (Trace_This_Thread)
+        return Trace_This_Thread;
+
+    const int32_t index = Platform_InterlockedIncrement(&Trace_Number_Of_Threads) - 1;
+    if (index >= TRACE_MAX_THREADS)
+        return NULL;
+
+    /* Own cache lines, the threads never write next to each other */
+    TraceThread_t *thread = _mm_malloc(sizeof(TraceThread_t), 64);
+    ASSERT(thread);
+    thread->number_of_events = 0;
+    thread->name             = NULL;
+    thread->index            = index;
+
+    Trace_Threads[index] = thread;
+    Trace_This_Thread    = thread;
+    return thread;
+}
+
+void Trace_Record(const char *name, const uint64_t start, const uint64_t end)
+{
+    TraceThread_t *thread = _Trace_Get_Thread();
+    if (thread == NULL)
+        return;
+
+    TraceEvent_t *event = &thread->events[thread->number_of_events & (TRACE_EVENTS_PER_THREAD - 1)];
+    event->name         = name;
+    event->start        = start;
+    event->end          = end;
+    thread->number_of_events++;
+}
+
+void Trace_Set_Thread_Name(const char *name)
+{
+    TraceThread_t *thread = _Trace_Get_Thread();
+    if (thread)
+        thread->name = name;
+}
+
+bool Trace_Write_Chrome_JSON(const char *file_path)
+{
+    FILE *fp = fopen(file_path, "w");
+    if (fp == NULL)
+    {
+        perror(file_path);
+        return false;
+    }
+
+    const int32_t number_of_threads = (Trace_Number_Of_Threads < TRACE_MAX_THREADS) ? Trace_Number_Of_Threads : TRACE_MAX_THREADS;
+    const double  ticks_per_us      = Timer_Frequency() / 1000000.0;
+
+    /* Times are written from the oldest event still in any ring, so the numbers stay small */
+    uint64_t first_tick = UINT64_MAX;
+    for (int32_t t = 0; t < number_of_threads; t++)
+    {
+        const TraceThread_t *thread = Trace_Threads[t];
+        if (thread == NULL || thread->number_of_events == 0)
+            continue;
+
+        const uint64_t oldest = (thread->number_of_events > TRACE_EVENTS_PER_THREAD) ? thread->number_of_events - TRACE_EVENTS_PER_THREAD : 0;
+        const uint64_t tick   = thread->events[oldest & (TRACE_EVENTS_PER_THREAD - 1)].start;
+        first_tick            = (tick < first_tick) ? tick : first_tick;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first_event = true;
+    for (int32_t t = 0; t < number_of_threads; t++)
+    {
+        const TraceThread_t *thread = Trace_Threads[t];
+        if (thread == NULL)
+            continue;
+
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                (first_event) ? "" : ",\n", thread->index, (thread->name) ? thread->name : "worker", thread->index);
+        first_event = false;
+
+        const uint64_t oldest = (thread->number_of_events > TRACE_EVENTS_PER_THREAD) ? thread->number_of_events - TRACE_EVENTS_PER_THREAD : 0;
+        for (uint64_t e = oldest; e < thread->number_of_events; e++)
+        {
+            const TraceEvent_t *event = &thread->events[e & (TRACE_EVENTS_PER_THREAD - 1)];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event->name, thread->index,
+                    (double)(int64_t)(event->start - first_tick) / ticks_per_us, /* A scope is written when it ends, an outer one can start first */
+                    (double)(event->end - event->start) / ticks_per_us);
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    printf("Trace written to : %s\n", file_path);
+    return true;
+}
+
+#endif // TRACE_IMPLEMENTATION
+
+#endif // __TRACE_H__
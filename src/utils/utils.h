@@ -6,6 +6,14 @@
 
 #define LOG_UNUSED(val) ((void)(val))
 
+#if defined(_MSC_VER)
+    #define THREAD_LOCAL __declspec(thread)
+    #define ALIGNED(x)   __declspec(align(x))
+#else
+    #define THREAD_LOCAL _Thread_local
+    #define ALIGNED(x)   __attribute__((aligned(x)))
+#endif
+
 #ifdef _DEBUG
     #define ASSERT(expr) assert(expr)
 